@@ -0,0 +1,41 @@
+#include "cbor_writer.h"
+
+#include <math.h>
+
+void CborWriter::head(uint8_t major, uint64_t v) {
+    uint8_t mt = (uint8_t)(major << 5);
+    if (v < 24) {
+        buf_.push_back((char)(mt | v));
+    } else if (v <= 0xff) {
+        buf_.push_back((char)(mt | 24));
+        be(v, 1);
+    } else if (v <= 0xffff) {
+        buf_.push_back((char)(mt | 25));
+        be(v, 2);
+    } else if (v <= 0xffffffffULL) {
+        buf_.push_back((char)(mt | 26));
+        be(v, 4);
+    } else {
+        buf_.push_back((char)(mt | 27));
+        be(v, 8);
+    }
+}
+
+CborWriter& CborWriter::number(double v) {
+    if (v == floor(v) && fabs(v) < 9007199254740992.0) {  // integral and exact (< 2^53)
+        return integer((int64_t)v);
+    }
+    float f = (float)v;
+    if ((double)f == v || isnan(v)) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        buf_.push_back((char)0xfa);
+        be(bits, 4);
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        buf_.push_back((char)0xfb);
+        be(bits, 8);
+    }
+    return *this;
+}
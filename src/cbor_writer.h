@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// Minimal streaming CBOR (RFC 8949) encoder writing into a reusable buffer.
+// Containers are indefinite length, so the number of entries need not be known
+// up front: every begin*() must be closed with end().
+class CborWriter {
+public:
+    explicit CborWriter(size_t reserve = 1024) { buf_.reserve(reserve); }
+
+    void clear() { buf_.clear(); }
+    const std::string& str() const { return buf_; }
+    const char* data() const { return buf_.data(); }
+    size_t size() const { return buf_.size(); }
+
+    CborWriter& beginMap() { buf_.push_back((char)0xbf); return *this; }
+    CborWriter& beginArray() { buf_.push_back((char)0x9f); return *this; }
+    // definite length array, no end() needed
+    CborWriter& array(size_t n) { head(4, n); return *this; }
+    CborWriter& end() { buf_.push_back((char)0xff); return *this; }
+
+    CborWriter& uint(uint64_t v) { head(0, v); return *this; }
+    CborWriter& integer(int64_t v) {
+        if (v >= 0) head(0, (uint64_t)v);
+        else head(1, (uint64_t)(-1 - v));
+        return *this;
+    }
+    // numbers are written as integer if integral, else as float32 if lossless, else float64
+    CborWriter& number(double v);
+    CborWriter& text(const char* s, size_t len) { head(3, len); buf_.append(s, len); return *this; }
+    CborWriter& text(const char* s) { return text(s, strlen(s)); }
+    CborWriter& text(const std::string& s) { return text(s.data(), s.size()); }
+    CborWriter& boolean(bool b) { buf_.push_back(b ? (char)0xf5 : (char)0xf4); return *this; }
+    CborWriter& null() { buf_.push_back((char)0xf6); return *this; }
+
+private:
+    // major type and argument in the shortest encoding
+    void head(uint8_t major, uint64_t v);
+    void be(uint64_t v, int bytes) {
+        for (int i = bytes - 1; i >= 0; --i) buf_.push_back((char)(v >> (8 * i)));
+    }
+
+    std::string buf_;
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+// Circuit breaker for a remote sink. After `threshold` consecutive failures
+// the circuit opens and isClosed() turns false, so callers on the hot path stop
+// touching the network. After the open time one probe is allowed (half open);
+// its result closes the circuit again or reopens it with doubled open time.
+class CircuitBreaker {
+public:
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    CircuitBreaker(unsigned threshold, unsigned openMs, unsigned maxOpenMs)
+        : threshold_(threshold), baseOpenMs_(openMs), maxOpenMs_(maxOpenMs), openMs_(openMs) {}
+
+    // cheap check for the hot path: true while requests may go straight to the sink
+    bool isClosed() const { return state_.load(std::memory_order_relaxed) == CLOSED; }
+
+    // true if a (probe) request may be attempted now
+    bool allow() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        State s = state_.load(std::memory_order_relaxed);
+        if (s == CLOSED) return true;
+        if (s == OPEN && std::chrono::steady_clock::now() >= reopenAt_) {
+            state_ = HALF_OPEN;
+            return true;
+        }
+        return false;
+    }
+
+    void success() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failures_ = 0;
+        openMs_ = baseOpenMs_;
+        state_ = CLOSED;
+    }
+
+    void failure() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        State s = state_.load(std::memory_order_relaxed);
+        if (s == HALF_OPEN) {
+            // probe failed: back off further
+            openMs_ = (openMs_ * 2 > maxOpenMs_) ? maxOpenMs_ : openMs_ * 2;
+        } else if (++failures_ < threshold_) {
+            return;
+        }
+        if (s == CLOSED) trips_++;
+        state_ = OPEN;
+        reopenAt_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(openMs_);
+    }
+
+    State state() const { return state_.load(std::memory_order_relaxed); }
+    uint64_t trips() const { return trips_; }
+
+private:
+    unsigned threshold_;
+    unsigned baseOpenMs_;
+    unsigned maxOpenMs_;
+    unsigned openMs_;
+    unsigned failures_ = 0;
+    std::atomic<uint64_t> trips_{0};
+    std::atomic<State> state_{CLOSED};
+    std::chrono::steady_clock::time_point reopenAt_;
+    std::mutex mutex_;
+};
@@ -0,0 +1,202 @@
+#include "connection.h"
+#include "log.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int64_t monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+TcpEndpoint::TcpEndpoint(const char* host, int port, unsigned connectTimeoutMs, unsigned backoffMinMs, unsigned backoffMaxMs)
+    : host_(host), port_(port), connectTimeoutMs_(connectTimeoutMs),
+      backoffMinMs_(backoffMinMs), backoffMaxMs_(backoffMaxMs) {
+    memset(&addr_, 0, sizeof(addr_));
+    rng_ = (uint32_t)monotonicMs() ^ (uint32_t)getpid() ^ (uint32_t)port;
+    if (rng_ == 0) rng_ = 1;
+}
+
+// resolve host with the thread-safe getaddrinfo and cache the first address (mutex held)
+bool TcpEndpoint::resolve() {
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char portbuf[16];
+    snprintf(portbuf, sizeof(portbuf), "%d", port_);
+    struct addrinfo *res = nullptr;
+    int rc = getaddrinfo(host_.c_str(), portbuf, &hints, &res);
+    if (rc != 0 || !res) {
+        LOG_ERROR("Failed to resolve hostname %s: %s", host_.c_str(), gai_strerror(rc));
+        return false;
+    }
+    memcpy(&addr_, res->ai_addr, res->ai_addrlen);
+    addrLen_ = res->ai_addrlen;
+    family_ = res->ai_family;
+    resolved_ = true;
+    freeaddrinfo(res);
+    return true;
+}
+
+// schedule next attempt: exponential backoff with jitter (mutex held)
+void TcpEndpoint::backoff() {
+    ++failures_;
+    lost_ = true;
+    unsigned shift = consecutiveFailures_ < 16 ? consecutiveFailures_ : 16;
+    uint64_t delay = (uint64_t)backoffMinMs_ << shift;
+    if (delay > backoffMaxMs_) delay = backoffMaxMs_;
+    ++consecutiveFailures_;
+    // xorshift32; jitter spreads retries over [delay/2, delay]
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    uint64_t half = delay / 2;
+    delay = half + (half ? rng_ % (half + 1) : 0);
+    nextAttemptMs_ = monotonicMs() + (int64_t)delay;
+}
+
+int TcpEndpoint::connect() {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    int family;
+    std::string host;
+    int port;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (monotonicMs() < nextAttemptMs_) return -1;  // still backing off
+        if (!resolved_ && !resolve()) {
+            backoff();
+            return -1;
+        }
+        addr = addr_;
+        addrLen = addrLen_;
+        family = family_;
+        host = host_;
+        port = port_;
+    }
+
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create socket");
+        return -1;
+    }
+
+    // non-blocking connect, wait for completion up to the connect timeout
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int rc = ::connect(fd, (struct sockaddr*)&addr, addrLen);
+    if (rc != 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        rc = poll(&pfd, 1, (int)connectTimeoutMs_);
+        if (rc == 1) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            rc = err ? -1 : 0;
+            errno = err;
+        } else {
+            if (rc == 0) errno = ETIMEDOUT;
+            rc = -1;
+        }
+    }
+    if (rc != 0) {
+        LOG_ERROR("Failed to connect to %s:%d: %s", host.c_str(), port, strerror(errno));
+        close(fd);
+        std::lock_guard<std::mutex> lock(mutex_);
+        resolved_ = false;  // address may have changed
+        backoff();
+        return -1;
+    }
+
+    // back to blocking mode, bounded sends
+    fcntl(fd, F_SETFL, flags);
+    struct timeval tv;
+    tv.tv_sec = connectTimeoutMs_ / 1000;
+    tv.tv_usec = (connectTimeoutMs_ % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    consecutiveFailures_ = 0;
+    nextAttemptMs_ = 0;
+    ++connects_;
+    if (lost_) {
+        lost_ = false;
+        ++reconnects_;
+        LOG("Reconnected to %s:%d (reconnect #%llu)", host_.c_str(), port_, (unsigned long long)reconnects_);
+    }
+    return fd;
+}
+
+void TcpEndpoint::retarget(const char* host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    host_ = host;
+    port_ = port;
+    resolved_ = false;
+    consecutiveFailures_ = 0;
+    nextAttemptMs_ = 0;
+}
+
+std::string TcpEndpoint::host() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return host_;
+}
+
+int TcpEndpoint::port() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return port_;
+}
+
+void TcpEndpoint::fail() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resolved_ = false;
+    backoff();
+}
+
+ssize_t recvAll(int fd, void* buf, size_t len, int64_t deadlineMs, uint64_t* syscalls) {
+    size_t got = 0;
+    while (got < len) {
+        int64_t remaining = deadlineMs - monotonicMs();
+        if (remaining <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (syscalls) ++*syscalls;
+        int rc = poll(&pfd, 1, (int)remaining);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (rc == 0) continue;  // deadline is checked above
+        if (syscalls) ++*syscalls;
+        ssize_t r = recv(fd, (char*)buf + got, len - got, 0);
+        if (r == 0) return 0;
+        if (r < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        got += r;
+    }
+    return (ssize_t)got;
+}
+
+bool sendAll(int fd, const void* buf, size_t len, uint64_t* syscalls) {
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        if (syscalls) ++*syscalls;
+        ssize_t s = send(fd, p, len, MSG_NOSIGNAL);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return false;
+        p += s;
+        len -= s;
+    }
+    return true;
+}
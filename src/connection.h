@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <string>
+
+// Monotonic milliseconds for deadlines
+int64_t monotonicMs();
+
+// TCP endpoint supervision: caches the resolved address (refreshed after a
+// failure), connects non-blocking with a deadline and spaces failed attempts
+// with exponential backoff plus jitter. Thread-safe; sockets returned by
+// connect() are blocking with the send timeout set to the connect timeout.
+class TcpEndpoint {
+public:
+    TcpEndpoint(const char* host, int port, unsigned connectTimeoutMs, unsigned backoffMinMs, unsigned backoffMaxMs);
+
+    /**
+     * Open a new connection. Returns the socket, or -1 if the attempt failed
+     * or the endpoint is still backing off from an earlier failure.
+     */
+    int connect();
+
+    // Report that a connection obtained from connect() broke or timed out.
+    // Drops the cached address and backs off before the next attempt.
+    void fail();
+
+    // Change the target; the next connect() resolves the new host
+    void retarget(const char* host, int port);
+
+    std::string host() const;
+    int port() const;
+    uint64_t connects() const { return connects_; }
+    // connections established again after a failure
+    uint64_t reconnects() const { return reconnects_; }
+    uint64_t failures() const { return failures_; }
+
+private:
+    bool resolve();
+    void backoff();
+
+    std::string host_;
+    int port_;
+    unsigned connectTimeoutMs_;
+    unsigned backoffMinMs_;
+    unsigned backoffMaxMs_;
+
+    mutable std::mutex mutex_;
+    bool resolved_ = false;
+    struct sockaddr_storage addr_;
+    socklen_t addrLen_ = 0;
+    int family_ = 0;
+    unsigned consecutiveFailures_ = 0;
+    bool lost_ = false;  // failure since the last successful connect
+    int64_t nextAttemptMs_ = 0;
+    uint64_t connects_ = 0;
+    uint64_t reconnects_ = 0;
+    uint64_t failures_ = 0;
+    uint32_t rng_;
+};
+
+/**
+ * Receive exactly len bytes before the monotonic deadline.
+ * Returns len on success, 0 if the peer closed the connection,
+ * -1 on error or timeout (errno ETIMEDOUT).
+ * syscalls (optional) is incremented by the system calls made.
+ */
+ssize_t recvAll(int fd, void* buf, size_t len, int64_t deadlineMs, uint64_t* syscalls = nullptr);
+
+// Send all bytes (socket send timeout applies). Returns false on error.
+bool sendAll(int fd, const void* buf, size_t len, uint64_t* syscalls = nullptr);
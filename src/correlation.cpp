@@ -0,0 +1,145 @@
+#include "correlation.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// two doubles per operation (SSE2, the x86-64 baseline; plain code elsewhere)
+typedef double v2d __attribute__((vector_size(16)));
+static const size_t LANES = 2;
+
+static inline v2d load2(const double* p) {
+    v2d v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store2(double* p, v2d v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+void CorrelationEngine::configure(const std::vector<uint16_t>& addrs, size_t refs) {
+    addrs_ = addrs;
+    refs_ = std::min(refs, (size_t)MAX_REFERENCES);
+    padded_ = (addrs_.size() + LANES - 1) / LANES * LANES;
+    n_ = 0;
+    for (int r = 0; r < READINGS; ++r) {
+        x_[r].assign(padded_, 0);
+        mean_[r].assign(padded_, 0);
+        m2_[r].assign(padded_, 0);
+        co_[r].assign(padded_ * refs_, 0);
+    }
+    refMean_.assign(refs_, 0);
+    refM2_.assign(refs_, 0);
+    prev_.assign(addrs_.size(), 0);
+    toggledBits_.assign(addrs_.size(), 0);
+    toggleCount_.assign(addrs_.size(), 0);
+    bitToggles_.assign(addrs_.size() * 16, 0);
+}
+
+void CorrelationEngine::update(const uint16_t* words, const double* ref) {
+    size_t n = addrs_.size();
+    if (n == 0) return;
+
+    // bit toggles: sparse, most words do not change between observations
+    if (n_ > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            uint16_t t = words[i] ^ prev_[i];
+            if (!t) continue;
+            toggledBits_[i] |= t;
+            toggleCount_[i] += (uint32_t)__builtin_popcount(t);
+            for (int b = 0; b < 16; ++b) {
+                if (t & (1u << b)) bitToggles_[i * 16 + b]++;
+            }
+        }
+    }
+    memcpy(prev_.data(), words, n * sizeof(uint16_t));
+
+    for (size_t i = 0; i < n; ++i) {
+        x_[UNSIGNED][i] = words[i];
+        x_[SIGNED][i] = (int16_t)words[i];
+    }
+
+    // Welford: mean_n = mean + (x - mean) / n, M2 += (x - mean_old)(x - mean_n),
+    // co-moment C += (x - mean_old)(y - meanY_n)
+    ++n_;
+    const double inv = 1.0 / (double)n_;
+    double dyNew[MAX_REFERENCES];
+    const size_t refs = refs_;
+    for (size_t k = 0; k < refs; ++k) {
+        double d = ref[k] - refMean_[k];
+        refMean_[k] += d * inv;
+        refM2_[k] += d * (ref[k] - refMean_[k]);
+        dyNew[k] = ref[k] - refMean_[k];
+    }
+
+    const v2d vinv = { inv, inv };
+    for (int r = 0; r < READINGS; ++r) {
+        const double* x = x_[r].data();
+        double* mean = mean_[r].data();
+        double* m2 = m2_[r].data();
+        double* co = co_[r].data();
+        for (size_t i = 0; i < padded_; i += LANES) {
+            v2d xv = load2(x + i);
+            v2d m = load2(mean + i);
+            v2d dx = xv - m;
+            m += dx * vinv;
+            store2(mean + i, m);
+            store2(m2 + i, load2(m2 + i) + dx * (xv - m));
+            for (size_t k = 0; k < refs; ++k) {
+                double* c = co + k * padded_ + i;
+                const v2d dy = { dyNew[k], dyNew[k] };
+                store2(c, load2(c) + dx * dy);
+            }
+        }
+    }
+}
+
+size_t CorrelationEngine::topMatches(size_t ref, Match* out, size_t k) const {
+    if (ref >= refs_ || n_ < 3 || refM2_[ref] <= 0) return 0;
+    std::vector<Match> all;
+    all.reserve(addrs_.size());
+    for (size_t i = 0; i < addrs_.size(); ++i) {
+        if (!toggledBits_[i]) continue;
+        Match best = { addrs_[i], 0, false };
+        for (int r = 0; r < READINGS; ++r) {
+            double var = m2_[r][i];
+            if (var <= 0) continue;
+            double c = co_[r][ref * padded_ + i] / sqrt(var * refM2_[ref]);
+            if (fabs(c) > fabs(best.r) + 1e-9) {  // unsigned reading wins ties
+                best.r = (float)c;
+                best.isSigned = r == SIGNED;
+            }
+        }
+        all.push_back(best);
+    }
+    k = std::min(k, all.size());
+    std::partial_sort(all.begin(), all.begin() + k, all.end(),
+                      [](const Match& a, const Match& b) { return fabsf(a.r) > fabsf(b.r); });
+    std::copy(all.begin(), all.begin() + k, out);
+    return k;
+}
+
+size_t CorrelationEngine::topToggles(Toggle* out, size_t k, int maxBits) const {
+    std::vector<size_t> idx;
+    for (size_t i = 0; i < addrs_.size(); ++i) {
+        if (toggleCount_[i] && __builtin_popcount(toggledBits_[i]) <= maxBits) idx.push_back(i);
+    }
+    k = std::min(k, idx.size());
+    std::partial_sort(idx.begin(), idx.begin() + k, idx.end(),
+                      [this](size_t a, size_t b) { return toggleCount_[a] > toggleCount_[b]; });
+    for (size_t j = 0; j < k; ++j) {
+        size_t i = idx[j];
+        out[j].addr = addrs_[i];
+        out[j].count = toggleCount_[i];
+        out[j].bits = toggledBits_[i];
+        memcpy(out[j].perBit, &bitToggles_[i * 16], sizeof(out[j].perBit));
+    }
+    return k;
+}
+
+size_t CorrelationEngine::moving() const {
+    size_t m = 0;
+    for (uint16_t bits : toggledBits_) m += bits != 0;
+    return m;
+}
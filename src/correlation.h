@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Streaming statistics over many 16-bit registers, to find out what unknown
+// registers mean.
+//
+// Every observation is one value per column (register word) plus the values
+// of a few reference signals (e.g. active power, phase currents). Per column
+// the engine keeps mean and variance, and the co-moment with every
+// reference (Welford updates, so nothing but the running sums is stored),
+// once for the word read as unsigned and once as signed. From these, Pearson
+// correlations rank the columns that follow a reference. Bit toggle counters
+// find flag words.
+//
+// State is columnar (one array per statistic, padded to the vector width) and
+// updated two columns per SSE2 operation with GCC vector extensions.
+class CorrelationEngine {
+public:
+    enum { MAX_REFERENCES = 16 };
+
+    struct Match {
+        uint16_t addr;
+        float r;        // Pearson correlation, -1 .. 1
+        bool isSigned;  // correlation of the word read as S16
+    };
+
+    struct Toggle {
+        uint16_t addr;
+        uint32_t count;          // bit toggles since configure()
+        uint16_t bits;           // bits that toggled
+        uint32_t perBit[16];     // toggles per bit
+    };
+
+    // Analyse the words at addrs against refs (at most MAX_REFERENCES) reference signals; resets all statistics
+    void configure(const std::vector<uint16_t>& addrs, size_t refs);
+
+    // One observation: words[i] is the current value of column i, ref[k] of reference k
+    void update(const uint16_t* words, const double* ref);
+
+    /**
+     * Columns with the strongest correlation (either sign, unsigned or signed
+     * reading) to reference ref, strongest first. Columns that never changed
+     * are skipped. Returns the number of matches written (at most k).
+     */
+    size_t topMatches(size_t ref, Match* out, size_t k) const;
+
+    // Columns with the most bit toggles among those where at most maxBits bits toggle
+    size_t topToggles(Toggle* out, size_t k, int maxBits) const;
+
+    uint64_t samples() const { return n_; }
+    size_t columns() const { return addrs_.size(); }
+    size_t references() const { return refs_; }
+    // columns that changed at least once
+    size_t moving() const;
+
+private:
+    enum { UNSIGNED = 0, SIGNED = 1, READINGS = 2 };
+
+    std::vector<uint16_t> addrs_;
+    size_t refs_ = 0;
+    size_t padded_ = 0;  // column count rounded up to the vector width
+    uint64_t n_ = 0;
+
+    // per reading: x (current observation), mean, M2, and refs_ co-moment columns
+    std::vector<double> x_[READINGS];
+    std::vector<double> mean_[READINGS];
+    std::vector<double> m2_[READINGS];
+    std::vector<double> co_[READINGS];  // co_[r][k * padded_ + i]
+
+    // reference signals
+    std::vector<double> refMean_;
+    std::vector<double> refM2_;
+
+    // bit toggles
+    std::vector<uint16_t> prev_;
+    std::vector<uint16_t> toggledBits_;
+    std::vector<uint32_t> toggleCount_;
+    std::vector<uint32_t> bitToggles_;  // [i * 16 + bit]
+};
@@ -0,0 +1,603 @@
+#include "history_store.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <algorithm>
+
+static const char HISTORY_MAGIC[8] = { 'J', 'S', 'H', 'I', 'S', 'T', '0', '1' };
+static const uint32_t BLOCK_MAGIC = 0x4b4c4248;  // "HBLK"
+static const size_t MAX_SAMPLE_BITS = 4 + 32 + 2 + 5 + 6 + 64;  // worst case encoding of one sample
+static const size_t MAP_STEP = 1 << 20;                         // mapping grows in steps of 1 MB
+static const size_t BLOCK_HEADER_BYTES = 40;
+
+// blocks are padded to 8 bytes so the mapped headers stay aligned
+static size_t blockSize(size_t bytes) { return (BLOCK_HEADER_BYTES + bytes + 7) & ~(size_t)7; }
+
+static uint64_t doubleBits(double v) {
+    uint64_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+static double bitsDouble(uint64_t b) {
+    double v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+// Register values are integers times a decimal gain (e.g. 231.7 V). Their
+// doubles differ in almost all mantissa bits, the integers 2317 and 2318 in a
+// few low ones, so a block stores v * 10^decimals when that round trips exactly.
+static const double POW10[] = { 1, 10, 100, 1000, 10000 };
+static const int MAX_DECIMALS = 4;
+static const uint8_t RAW_DECIMALS = 0xff;  // block stores the doubles as they are
+
+static bool scaleDecimal(double v, int decimals, double& out) {
+    double r = nearbyint(v * POW10[decimals]);
+    if (!(fabs(r) < 9007199254740992.0) || doubleBits(r / POW10[decimals]) != doubleBits(v)) return false;
+    out = r;
+    return true;
+}
+
+void HistoryStore::Encoder::put(uint64_t v, int n) {
+    while (n > 0) {
+        size_t byte = bits >> 3;
+        if (byte >= buf.size()) buf.push_back(0);
+        int room = 8 - (int)(bits & 7);
+        int take = n < room ? n : room;
+        uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+        buf[byte] |= (uint8_t)(chunk << (room - take));
+        bits += take;
+        n -= take;
+    }
+}
+
+bool HistoryStore::Encoder::add(int64_t t, double v, size_t maxBytes) {
+    double stored = v;
+    if (count == 0) {
+        // first sample: time is in the block header, value stored verbatim;
+        // it picks the fewest decimals that represent it exactly
+        decimals = RAW_DECIMALS;
+        for (int d = 0; d <= MAX_DECIMALS; ++d) {
+            if (scaleDecimal(v, d, stored)) {
+                decimals = (uint8_t)d;
+                break;
+            }
+        }
+        buf.clear();
+        buf.reserve(maxBytes);
+        bits = 0;
+        tFirst = t;
+        delta = 0;
+        leading = -1;
+        put(doubleBits(stored), 64);
+    } else {
+        int64_t d = t - tLast;
+        int64_t dod = d - delta;
+        if (bits + MAX_SAMPLE_BITS > maxBytes * 8 || dod < INT32_MIN || dod > INT32_MAX) return false;
+        if (decimals != RAW_DECIMALS && !scaleDecimal(v, decimals, stored)) return false;  // needs more decimals
+
+        // timestamp: delta of deltas in variable sized buckets
+        if (dod == 0) {
+            put(0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            put(0x2, 2);
+            put((uint64_t)(dod + 63), 7);
+        } else if (dod >= -255 && dod <= 256) {
+            put(0x6, 3);
+            put((uint64_t)(dod + 255), 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            put(0xe, 4);
+            put((uint64_t)(dod + 2047), 12);
+        } else {
+            put(0xf, 4);
+            put((uint64_t)(uint32_t)(int32_t)dod, 32);
+        }
+        delta = d;
+
+        // value: XOR with the previous one, meaningful bits only
+        uint64_t x = doubleBits(stored) ^ vBits;
+        if (x == 0) {
+            put(0, 1);
+        } else {
+            int lead = __builtin_clzll(x);
+            int trail = __builtin_ctzll(x);
+            if (lead > 31) lead = 31;
+            if (leading >= 0 && lead >= leading && trail >= trailing) {
+                // fits into the previous window
+                put(0x2, 2);
+                put(x >> trailing, 64 - leading - trailing);
+            } else {
+                int len = 64 - lead - trail;
+                put(0x3, 2);
+                put((uint64_t)lead, 5);
+                put((uint64_t)(len - 1), 6);
+                put(x >> trail, len);
+                leading = lead;
+                trailing = trail;
+            }
+        }
+    }
+    tLast = t;
+    vBits = doubleBits(stored);
+    vLast = v;
+    ++count;
+    return true;
+}
+
+namespace {
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t bits = 0;
+
+    uint64_t get(int n) {
+        uint64_t v = 0;
+        while (n > 0) {
+            size_t byte = bits >> 3;
+            uint8_t cur = byte < size ? data[byte] : 0;
+            int room = 8 - (int)(bits & 7);
+            int take = n < room ? n : room;
+            v = (v << take) | ((cur >> (room - take)) & ((1u << take) - 1));
+            bits += take;
+            n -= take;
+        }
+        return v;
+    }
+};
+}
+
+template <typename Fn>
+void HistoryStore::decode(const uint8_t* data, size_t bytes, uint32_t count, int64_t tFirst, uint8_t decimals, Fn fn) {
+    if (count == 0) return;
+    BitReader in{ data, bytes };
+    double scale = decimals <= MAX_DECIMALS ? POW10[decimals] : 1;
+    uint64_t vBits = in.get(64);
+    int64_t t = tFirst, delta = 0;
+    int leading = 0, trailing = 0;
+    if (!fn(t, bitsDouble(vBits) / scale)) return;
+
+    for (uint32_t i = 1; i < count; ++i) {
+        int64_t dod;
+        if (!in.get(1)) dod = 0;
+        else if (!in.get(1)) dod = (int64_t)in.get(7) - 63;
+        else if (!in.get(1)) dod = (int64_t)in.get(9) - 255;
+        else if (!in.get(1)) dod = (int64_t)in.get(12) - 2047;
+        else dod = (int32_t)(uint32_t)in.get(32);
+        delta += dod;
+        t += delta;
+
+        if (in.get(1)) {
+            if (in.get(1)) {
+                leading = (int)in.get(5);
+                trailing = 64 - leading - ((int)in.get(6) + 1);
+            }
+            vBits ^= in.get(64 - leading - trailing) << trailing;
+        }
+        if (!fn(t, bitsDouble(vBits) / scale)) return;
+    }
+}
+
+HistoryStore::~HistoryStore() {
+    close();
+}
+
+bool HistoryStore::open(const char* path, size_t maxSeries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) return true;
+
+    path_ = path;
+    maxSeries_ = maxSeries;
+    fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        LOG_ERROR("Failed to open history file %s", path);
+        return false;
+    }
+
+    struct stat st;
+    char magic[sizeof(HISTORY_MAGIC)];
+    if (fstat(fd_, &st) != 0 || st.st_size < (off_t)sizeof(magic) ||
+        pread(fd_, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) || memcmp(magic, HISTORY_MAGIC, sizeof(magic)) != 0) {
+        if (fstat(fd_, &st) == 0 && st.st_size > 0) {
+            LOG_WARN("%s is not a history file, starting a new one", path);
+        }
+        if (ftruncate(fd_, 0) != 0 || pwrite(fd_, HISTORY_MAGIC, sizeof(HISTORY_MAGIC), 0) != (ssize_t)sizeof(HISTORY_MAGIC)) {
+            LOG_ERROR("Failed to initialize history file %s", path);
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        fileEnd_ = sizeof(HISTORY_MAGIC);
+        return true;
+    }
+
+    fileEnd_ = (uint64_t)st.st_size;
+    if (!scan()) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    LOG("History %s: %zu series, %llu blocks, %llu samples in %llu bytes", path, series_.size(),
+        (unsigned long long)blockCount_, (unsigned long long)samples_, (unsigned long long)fileEnd_);
+    return true;
+}
+
+// rebuild the block index from the file, cutting off a partially written tail
+bool HistoryStore::scan() {
+    uint64_t size = fileEnd_;
+    if (!mapFile()) return false;
+    uint64_t off = sizeof(HISTORY_MAGIC);
+    while (off + sizeof(BlockHeader) <= size) {
+        const BlockHeader* h = headerAt(off);
+        uint64_t len = blockSize(h->bytes);
+        if (h->magic != BLOCK_MAGIC || h->count == 0 || off + len > size || h->tLast < h->tFirst) break;
+        auto it = series_.find(h->key);
+        if (it == series_.end()) {
+            if (series_.size() >= maxSeries_) {
+                off += len;  // keep the block in the file, just don't index it
+                continue;
+            }
+            it = series_.emplace(h->key, Series()).first;
+        }
+        Series& s = it->second;
+        s.blocks.push_back(off);
+        s.any = true;
+        s.tLast = h->tLast;
+        s.vLast = h->vLast;
+        ++blockCount_;
+        samples_ += h->count;
+        off += len;
+    }
+    if (off != size) {
+        LOG_WARN("Cutting damaged tail of %s at %llu (%llu bytes)", path_.c_str(), (unsigned long long)off,
+            (unsigned long long)(size - off));
+        if (ftruncate(fd_, (off_t)off) != 0) {
+            LOG_ERROR("Failed to truncate %s", path_.c_str());
+            return false;
+        }
+    }
+    fileEnd_ = off;
+    return true;
+}
+
+void HistoryStore::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) return;
+    for (auto& [key, s] : series_) {
+        if (s.enc.count > 0 && appendBlock(key, s.enc)) s.enc.count = 0;
+    }
+    fsync(fd_);
+    if (map_) munmap((void*)map_, mapLen_);
+    map_ = nullptr;
+    mapLen_ = 0;
+    ::close(fd_);
+    fd_ = -1;
+    series_.clear();
+    blockCount_ = samples_ = 0;
+}
+
+bool HistoryStore::writeBlock(int fd, uint64_t& end, uint32_t key, const Encoder& enc) {
+    static_assert(sizeof(BlockHeader) == BLOCK_HEADER_BYTES, "history block header layout");
+    size_t bytes = (enc.bits + 7) / 8;
+    size_t len = blockSize(bytes);
+    std::vector<uint8_t> block(len, 0);
+    BlockHeader h = { BLOCK_MAGIC, key, enc.count, (uint16_t)bytes, enc.decimals, 0, enc.tFirst, enc.tLast, enc.vLast };
+    memcpy(block.data(), &h, sizeof(h));
+    memcpy(block.data() + sizeof(h), enc.buf.data(), bytes);
+    if (pwrite(fd, block.data(), len, (off_t)end) != (ssize_t)len) {
+        LOG_ERROR("Failed to write history block: %s", strerror(errno));
+        return false;
+    }
+    end += len;
+    return true;
+}
+
+// write a block to the end of the file and index it
+bool HistoryStore::appendBlock(uint32_t key, const Encoder& enc) {
+    uint64_t off = fileEnd_;
+    if (!writeBlock(fd_, fileEnd_, key, enc)) return false;
+    series_[key].blocks.push_back(off);
+    ++blockCount_;
+    return true;
+}
+
+bool HistoryStore::mapFile() const {
+    if (map_ && mapLen_ >= fileEnd_) return true;
+    if (map_) munmap((void*)map_, mapLen_);
+    // map beyond the end of the file, so appended blocks become visible without a remap
+    size_t len = (size_t)(fileEnd_ / MAP_STEP + 1) * MAP_STEP;
+    void* p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("Failed to map history file %s", path_.c_str());
+        map_ = nullptr;
+        mapLen_ = 0;
+        return false;
+    }
+    map_ = (const uint8_t*)p;
+    mapLen_ = len;
+    return true;
+}
+
+const HistoryStore::BlockHeader* HistoryStore::headerAt(uint64_t off) const {
+    return (const BlockHeader*)(map_ + off);
+}
+
+bool HistoryStore::append(uint32_t key, int64_t t_ms, double value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) return false;
+
+    auto it = series_.find(key);
+    if (it == series_.end()) {
+        if (series_.size() >= maxSeries_) {
+            dropped_++;
+            return false;
+        }
+        it = series_.emplace(key, Series()).first;
+    }
+    Series& s = it->second;
+    if (s.any) {
+        if (t_ms < s.tLast) {
+            dropped_++;
+            return false;
+        }
+        if (doubleBits(value) == doubleBits(s.vLast)) return true;  // unchanged
+    }
+
+    if (!s.enc.add(t_ms, value, HISTORY_BLOCK_BYTES)) {
+        // block full: write it and start the next one with this sample
+        if (!appendBlock(key, s.enc)) dropped_ += s.enc.count;
+        s.enc.count = 0;
+        s.enc.add(t_ms, value, HISTORY_BLOCK_BYTES);
+    }
+    s.any = true;
+    s.tLast = t_ms;
+    s.vLast = value;
+    samples_++;
+    return true;
+}
+
+void HistoryStore::flush(int64_t now_ms, int64_t flushMs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) return;
+    for (auto& [key, s] : series_) {
+        if (s.enc.count == 0 || now_ms - s.enc.tFirst < flushMs) continue;
+        if (!appendBlock(key, s.enc)) dropped_ += s.enc.count;
+        s.enc.count = 0;
+    }
+}
+
+size_t HistoryStore::collect(const Series& s, int64_t from_ms, int64_t to_ms, Sample* out, size_t maxOut) const {
+    size_t n = 0;
+    Sample prev = { 0, 0 };
+    bool havePrev = false, done = false;
+
+    auto visit = [&](int64_t t, double v) {
+        if (t < from_ms) {
+            prev = { t, v };
+            havePrev = true;
+            return true;
+        }
+        if (t > to_ms || n >= maxOut) {
+            done = true;
+            return false;
+        }
+        if (havePrev) {
+            // value in effect at from_ms goes first
+            out[n++] = prev;
+            havePrev = false;
+            if (n >= maxOut) {
+                done = true;
+                return false;
+            }
+        }
+        out[n++] = { t, v };
+        return true;
+    };
+
+    for (uint64_t off : s.blocks) {
+        const BlockHeader* h = headerAt(off);
+        if (h->tLast < from_ms) {
+            prev = { h->tLast, h->vLast };  // whole block before the range: only its last sample matters
+            havePrev = true;
+            continue;
+        }
+        if (h->tFirst > to_ms) {
+            done = true;
+            break;
+        }
+        decode((const uint8_t*)(h + 1), h->bytes, h->count, h->tFirst, h->decimals, visit);
+        if (done) break;
+    }
+    if (!done && s.enc.count > 0) {
+        decode(s.enc.buf.data(), s.enc.buf.size(), s.enc.count, s.enc.tFirst, s.enc.decimals, visit);
+    }
+    if (n == 0 && havePrev && maxOut > 0) out[n++] = prev;
+    return n;
+}
+
+size_t HistoryStore::query(uint32_t key, int64_t from_ms, int64_t to_ms, Sample* out, size_t maxOut) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || maxOut == 0) return 0;
+    auto it = series_.find(key);
+    if (it == series_.end() || !mapFile()) return 0;
+    return collect(it->second, from_ms, to_ms, out, maxOut);
+}
+
+bool HistoryStore::compact(int64_t keepFrom_ms) {
+    std::lock_guard<std::mutex> compacting(compactMutex_);
+
+    // Written blocks never change, so the blocks indexed now are rewritten from
+    // a mapping of their own while append() and query() go on
+    std::vector<std::pair<uint32_t, std::vector<uint64_t>>> snapshot;
+    uint64_t snapshotEnd;
+    std::string path;
+    int src;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ < 0) return false;
+        snapshotEnd = fileEnd_;
+        path = path_;
+        snapshot.reserve(series_.size());
+        for (auto& kv : series_) snapshot.emplace_back(kv.first, kv.second.blocks);
+        src = dup(fd_);
+    }
+    if (src < 0) return false;
+    void* p = mmap(nullptr, snapshotEnd, PROT_READ, MAP_SHARED, src, 0);
+    ::close(src);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("Failed to map history file %s", path.c_str());
+        return false;
+    }
+    const uint8_t* map = (const uint8_t*)p;
+    std::sort(snapshot.begin(), snapshot.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create %s", tmp.c_str());
+        munmap(p, snapshotEnd);
+        return false;
+    }
+    bool ok = pwrite(fd, HISTORY_MAGIC, sizeof(HISTORY_MAGIC), 0) == (ssize_t)sizeof(HISTORY_MAGIC);
+    uint64_t end = sizeof(HISTORY_MAGIC);
+
+    std::unordered_map<uint32_t, std::vector<uint64_t>> blocks;
+    uint64_t oldSamples = 0, fileSamples = 0;
+    for (const auto& [key, offsets] : snapshot) {
+        if (!ok) break;
+        std::vector<uint64_t>& out = blocks[key];
+        Encoder enc;
+        Sample carry = { 0, 0 };
+        bool haveCarry = false;
+
+        auto add = [&](int64_t t, double v) {
+            if (!enc.add(t, v, HISTORY_COMPACT_BLOCK_BYTES)) {
+                out.push_back(end);
+                if (!writeBlock(fd, end, key, enc)) return false;
+                fileSamples += enc.count;
+                enc.count = 0;
+                enc.add(t, v, HISTORY_COMPACT_BLOCK_BYTES);
+            }
+            return true;
+        };
+        auto visit = [&](int64_t t, double v) {
+            if (t < keepFrom_ms) {
+                carry = { t, v };
+                haveCarry = true;
+                return true;
+            }
+            if (haveCarry) {
+                haveCarry = false;
+                if (!add(carry.t_ms, carry.value)) return ok = false;
+            }
+            return ok = add(t, v);
+        };
+        for (uint64_t off : offsets) {
+            const BlockHeader* h = (const BlockHeader*)(map + off);
+            oldSamples += h->count;
+            if (h->tLast < keepFrom_ms) {
+                // whole block expires, its last sample may still be the starting value
+                carry = { h->tLast, h->vLast };
+                haveCarry = true;
+                continue;
+            }
+            decode((const uint8_t*)(h + 1), h->bytes, h->count, h->tFirst, h->decimals, visit);
+            if (!ok) break;
+        }
+        // a series without newer samples in the file keeps its last value
+        if (ok && haveCarry) ok = add(carry.t_ms, carry.value);
+        if (ok && enc.count > 0) {
+            out.push_back(end);
+            ok = writeBlock(fd, end, key, enc);
+            fileSamples += enc.count;
+        }
+    }
+    munmap(p, snapshotEnd);
+    if (ok && fsync(fd) != 0) ok = false;
+
+    // Switch to the new file: only the blocks appended meanwhile are copied under the lock
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t tailSamples = 0;
+    if (ok && fd_ >= 0) {
+        std::vector<uint8_t> block;
+        for (auto& [key, s] : series_) {
+            for (uint64_t off : s.blocks) {
+                if (off < snapshotEnd) continue;
+                BlockHeader h;
+                ok = pread(fd_, &h, sizeof(h), (off_t)off) == (ssize_t)sizeof(h);
+                size_t len = blockSize(h.bytes);
+                block.resize(len);
+                ok = ok && pread(fd_, block.data(), len, (off_t)off) == (ssize_t)len &&
+                     pwrite(fd, block.data(), len, (off_t)end) == (ssize_t)len;
+                if (!ok) break;
+                blocks[key].push_back(end);
+                end += len;
+                tailSamples += h.count;
+            }
+            if (!ok) break;
+        }
+    }
+    ::close(fd);
+    if (!ok || fd_ < 0 || rename(tmp.c_str(), path_.c_str()) != 0) {
+        LOG_ERROR("History compaction failed, keeping %s", path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    int newFd = ::open(path_.c_str(), O_RDWR);
+    if (newFd < 0) {
+        LOG_ERROR("Failed to reopen %s", path_.c_str());
+        return false;
+    }
+    uint64_t oldSize = fileEnd_;
+    if (map_) munmap((void*)map_, mapLen_);
+    map_ = nullptr;
+    mapLen_ = 0;
+    ::close(fd_);
+    fd_ = newFd;
+    fileEnd_ = end;
+    blockCount_ = 0;
+    samples_ = fileSamples + tailSamples;
+    for (auto& [key, s] : series_) {
+        s.blocks = std::move(blocks[key]);
+        blockCount_ += s.blocks.size();
+        samples_ += s.enc.count;
+    }
+    LOG("Compacted history: %llu -> %llu bytes, %llu blocks, %llu expired samples dropped",
+        (unsigned long long)oldSize, (unsigned long long)fileEnd_, (unsigned long long)blockCount_,
+        (unsigned long long)(oldSamples - fileSamples));
+    return true;
+}
+
+size_t HistoryStore::seriesCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return series_.size();
+}
+
+size_t HistoryStore::blockCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blockCount_;
+}
+
+uint64_t HistoryStore::fileBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return fileEnd_;
+}
+
+uint64_t HistoryStore::samples() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return samples_;
+}
+
+uint64_t HistoryStore::droppedSamples() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compressed long-term history of numeric register values in a local file.
+//
+// Only changes are stored: a sample equal to the previous one of its series
+// is skipped, so a series is a step function holding each value until the
+// next sample. Samples are packed per series into blocks with Gorilla
+// encoding (delta-of-delta timestamps in ms, XOR of consecutive doubles).
+// Values with up to 4 decimals are XORed as scaled integers, which leaves
+// far fewer meaningful bits than the doubles of decimal fractions.
+//
+// File: 8 byte magic "JSHIST01", then append-only blocks, each a header
+// (key, sample count, value scale, first/last time, last value) followed by
+// the bit stream. A block is written when it is full, spans more than the
+// flush interval or at close(); until then its samples are queried from memory.
+// Reads go through a read-only mapping of the file. compact() rewrites the
+// file with the blocks of each series merged and old samples dropped; it runs
+// on a thread of its own and holds the lock only to switch to the new file.
+
+// maximum number of series (further series are rejected)
+#ifndef HISTORY_MAX_SERIES
+#define HISTORY_MAX_SERIES 4096
+#endif
+// bit stream bytes per block written by append() and by compact()
+#ifndef HISTORY_BLOCK_BYTES
+#define HISTORY_BLOCK_BYTES 256
+#endif
+#ifndef HISTORY_COMPACT_BLOCK_BYTES
+#define HISTORY_COMPACT_BLOCK_BYTES 4096  // at most 65535
+#endif
+
+class HistoryStore {
+public:
+    struct Sample {
+        int64_t t_ms;  // ms since epoch
+        double value;
+    };
+
+    HistoryStore() = default;
+    ~HistoryStore();
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    // open (and create if needed) the history file; a damaged tail is cut off
+    bool open(const char* path, size_t maxSeries = HISTORY_MAX_SERIES);
+    // write all open blocks and close the file
+    void close();
+    bool isOpen() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fd_ >= 0;
+    }
+
+    /**
+     * Add a sample for key ((unitId << 16) | addr). Samples must be in time
+     * order per key; older ones and repeats of the previous value are skipped.
+     * Returns false if the sample was dropped (store full, out of order).
+     */
+    bool append(uint32_t key, int64_t t_ms, double value);
+
+    /**
+     * Copy the samples of a series with from_ms <= t_ms <= to_ms into out
+     * (oldest first), preceded by the last sample before from_ms, which holds
+     * the value in effect at from_ms. Returns the number of samples written
+     * (at most maxOut).
+     */
+    size_t query(uint32_t key, int64_t from_ms, int64_t to_ms, Sample* out, size_t maxOut) const;
+
+    // Write open blocks whose first sample is older than flushMs (bounds the loss on a crash)
+    void flush(int64_t now_ms, int64_t flushMs);
+
+    /**
+     * Rewrite the file: merge the blocks of every series into blocks of
+     * HISTORY_COMPACT_BLOCK_BYTES and drop samples older than keepFrom_ms
+     * (the last older sample of a series is kept as its starting value).
+     * The blocks written so far are rewritten without blocking append() or
+     * query(); blocks written meanwhile are copied over when switching files.
+     */
+    bool compact(int64_t keepFrom_ms);
+
+    size_t seriesCount() const;
+    size_t blockCount() const;
+    uint64_t fileBytes() const;
+    uint64_t samples() const;           // stored samples, file and memory
+    uint64_t droppedSamples() const;
+
+private:
+    struct BlockHeader {
+        uint32_t magic;
+        uint32_t key;
+        uint32_t count;    // samples in the block
+        uint16_t bytes;    // length of the bit stream
+        uint8_t decimals;  // values are stored as v * 10^decimals (0xff: unscaled)
+        uint8_t reserved;
+        int64_t tFirst;
+        int64_t tLast;
+        double vLast;
+    };
+
+    // Gorilla encoder state of the block being filled
+    struct Encoder {
+        std::vector<uint8_t> buf;
+        size_t bits = 0;
+        uint32_t count = 0;
+        int64_t tFirst = 0, tLast = 0, delta = 0;
+        uint64_t vBits = 0;
+        int leading = -1, trailing = 0;  // leading < 0: no previous XOR window
+        uint8_t decimals = 0;
+        double vLast = 0;
+
+        void put(uint64_t v, int n);
+        bool add(int64_t t, double v, size_t maxBytes);
+    };
+
+    struct Series {
+        Encoder enc;
+        std::vector<uint64_t> blocks;  // file offsets of the written blocks, in time order
+        bool any = false;              // any sample stored (file or memory)
+        int64_t tLast = 0;
+        double vLast = 0;
+    };
+
+    // decode a bit stream, calling fn(t, v) for every sample; stops early when fn returns false
+    template <typename Fn>
+    static void decode(const uint8_t* data, size_t bytes, uint32_t count, int64_t tFirst, uint8_t decimals, Fn fn);
+
+    static bool writeBlock(int fd, uint64_t& end, uint32_t key, const Encoder& enc);
+    bool appendBlock(uint32_t key, const Encoder& enc);
+    bool mapFile() const;
+    const BlockHeader* headerAt(uint64_t off) const;
+    bool scan();
+    size_t collect(const Series& s, int64_t from_ms, int64_t to_ms, Sample* out, size_t maxOut) const;
+
+    std::string path_;
+    int fd_ = -1;
+    uint64_t fileEnd_ = 0;  // append offset (complete blocks only)
+    size_t maxSeries_ = HISTORY_MAX_SERIES;
+    std::unordered_map<uint32_t, Series> series_;
+    uint64_t blockCount_ = 0;
+    uint64_t samples_ = 0;
+    uint64_t dropped_ = 0;
+
+    // read-only mapping, grown lazily by queries
+    mutable const uint8_t* map_ = nullptr;
+    mutable size_t mapLen_ = 0;
+
+    mutable std::mutex mutex_;
+    std::mutex compactMutex_;  // one compaction at a time
+};
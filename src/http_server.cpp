@@ -0,0 +1,381 @@
+#include "http_server.h"
+#include "log.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <deque>
+
+// request line and headers larger than this are rejected
+static const size_t MAX_HEAD_BYTES = 16 * 1024;
+// request bodies (ignored) larger than this are rejected
+static const size_t MAX_BODY_BYTES = 64 * 1024;
+// pending response bytes per connection above which pipelined requests are
+// not parsed (nor more input read) until the client has taken some of them
+static const size_t MAX_OUT_BYTES = 256 * 1024;
+
+// one queued piece of output: own bytes or a shared body
+struct OutChunk {
+    std::string own;
+    std::shared_ptr<const std::string> shared;
+    size_t off = 0;
+
+    const char* data() const { return shared ? shared->data() : own.data(); }
+    size_t size() const { return shared ? shared->size() : own.size(); }
+};
+
+struct HttpServer::Connection {
+    int fd;
+    std::string in;              // received bytes not yet processed
+    std::deque<OutChunk> out;    // responses waiting to be sent
+    size_t outBytes = 0;         // bytes in out not sent yet
+    bool closeAfter = false;     // close once out is sent
+    bool held = false;           // requests held back until out drains below MAX_OUT_BYTES
+    uint32_t events = EPOLLIN | EPOLLRDHUP;  // registered epoll events
+    int64_t lastActiveMs = 0;    // last request received or response bytes sent
+};
+
+static int64_t monotonicNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char* statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Error";
+    }
+}
+
+bool HttpRequest::param(const char* name, std::string_view& value) const {
+    size_t nameLen = strlen(name);
+    std::string_view q = query;
+    while (!q.empty()) {
+        size_t amp = q.find('&');
+        std::string_view kv = q.substr(0, amp);
+        size_t eq = kv.find('=');
+        std::string_view k = kv.substr(0, eq);
+        if (k.size() == nameLen && k.compare(0, nameLen, name) == 0) {
+            value = eq == std::string_view::npos ? std::string_view() : kv.substr(eq + 1);
+            return true;
+        }
+        if (amp == std::string_view::npos) break;
+        q.remove_prefix(amp + 1);
+    }
+    return false;
+}
+
+bool HttpServer::start(const char* addr, int port, HttpHandler handler, size_t maxConnections, unsigned idleMs) {
+    stop();
+    handler_ = std::move(handler);
+    maxConnections_ = maxConnections;
+    idleMs_ = idleMs;
+
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) return false;
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1 ||
+        bind(listenFd_, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(listenFd_, 128) != 0) {
+        LOG_ERROR("Cannot listen on %s:%d: %s", addr, port, strerror(errno));
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &ev);
+
+    running_ = true;
+    thread_ = std::thread(&HttpServer::run, this);
+    LOG("HTTP API listening on %s:%d", addr, port);
+    return true;
+}
+
+HttpServer::HttpServer() = default;
+
+HttpServer::~HttpServer() {
+    stop();
+}
+
+void HttpServer::stop() {
+    if (!running_.exchange(false)) return;
+    thread_.join();
+    for (auto& c : conns_) {
+        if (c) close(c->fd);
+    }
+    conns_.clear();
+    connections_ = 0;
+    close(epollFd_);
+    close(listenFd_);
+    epollFd_ = listenFd_ = -1;
+}
+
+void HttpServer::run() {
+    struct epoll_event events[64];
+    int64_t lastSweep = monotonicNowMs();
+    while (running_) {
+        int n = epoll_wait(epollFd_, events, 64, 200);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd_) {
+                accept();
+                continue;
+            }
+            if ((size_t)fd >= conns_.size() || !conns_[fd]) continue;
+            Connection& c = *conns_[fd];
+            bool ok = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) ok = false;
+            if (ok && (events[i].events & EPOLLIN)) ok = onReadable(c);
+            if (ok && (events[i].events & EPOLLOUT)) ok = onWritable(c);
+            if (!ok) closeConnection(fd);
+        }
+        int64_t now = monotonicNowMs();
+        if (now - lastSweep >= 1000) {
+            lastSweep = now;
+            closeIdle();
+        }
+    }
+}
+
+void HttpServer::accept() {
+    for (;;) {
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;  // EAGAIN: all pending connections taken
+        if (connections_ >= maxConnections_) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((size_t)fd >= conns_.size()) conns_.resize(fd + 1);
+        conns_[fd].reset(new Connection());
+        conns_[fd]->fd = fd;
+        conns_[fd]->lastActiveMs = monotonicNowMs();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+        ++connections_;
+    }
+}
+
+void HttpServer::closeConnection(int fd) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns_[fd].reset();
+    --connections_;
+}
+
+// Close connections without requests or progress in sending for idleMs,
+// including clients that stopped reading their responses
+void HttpServer::closeIdle() {
+    int64_t now = monotonicNowMs();
+    for (auto& c : conns_) {
+        if (c && now - c->lastActiveMs > (int64_t)idleMs_) closeConnection(c->fd);
+    }
+}
+
+bool HttpServer::onReadable(Connection& c) {
+    char buf[16 * 1024];
+    for (;;) {
+        ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+        if (r > 0) {
+            c.in.append(buf, r);
+            if ((size_t)r < sizeof(buf)) break;
+            continue;
+        }
+        if (r == 0) {
+            // peer closed: answer what it sent before, as far as the socket takes it
+            process(c);
+            onWritable(c);
+            return false;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        if (errno == EINTR) continue;
+        return false;
+    }
+    c.lastActiveMs = monotonicNowMs();
+    process(c);
+    return onWritable(c);
+}
+
+// Answer every complete request in the input buffer (pipelining keeps the order),
+// holding the rest back while too much output is pending
+void HttpServer::process(Connection& c) {
+    c.held = false;
+    while (!c.closeAfter) {
+        if (c.outBytes >= MAX_OUT_BYTES) {
+            c.held = true;
+            return;
+        }
+        size_t end = c.in.find("\r\n\r\n");
+        HttpResponse resp;
+        bool keepAlive = true;
+        bool headOnly = false;
+        size_t consumed = 0;
+
+        if (end == std::string::npos) {
+            if (c.in.size() <= MAX_HEAD_BYTES) return;  // wait for the rest
+            resp.status = 431;
+            keepAlive = false;
+        } else {
+            std::string_view head(c.in.data(), end);
+            size_t lineEnd = head.find("\r\n");
+            std::string_view line = head.substr(0, lineEnd);
+            size_t sp1 = line.find(' ');
+            size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+            size_t contentLength = 0;
+            bool http10 = false;
+            if (sp2 == std::string_view::npos) {
+                resp.status = 400;
+                keepAlive = false;
+            } else {
+                http10 = line.substr(sp2 + 1) == "HTTP/1.0";
+                keepAlive = !http10;
+                // headers that matter: Connection and Content-Length
+                std::string_view rest = lineEnd == std::string_view::npos ? std::string_view() : head.substr(lineEnd + 2);
+                while (!rest.empty()) {
+                    size_t nl = rest.find("\r\n");
+                    std::string_view h = rest.substr(0, nl);
+                    size_t colon = h.find(':');
+                    if (colon != std::string_view::npos) {
+                        std::string_view name = h.substr(0, colon);
+                        std::string_view value = h.substr(colon + 1);
+                        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+                        if (name.size() == 10 && strncasecmp(name.data(), "connection", 10) == 0) {
+                            if (value.size() == 5 && strncasecmp(value.data(), "close", 5) == 0) keepAlive = false;
+                            if (value.size() == 10 && strncasecmp(value.data(), "keep-alive", 10) == 0) keepAlive = true;
+                        } else if (name.size() == 14 && strncasecmp(name.data(), "content-length", 14) == 0) {
+                            contentLength = strtoul(std::string(value).c_str(), nullptr, 10);
+                        }
+                    }
+                    if (nl == std::string_view::npos) break;
+                    rest.remove_prefix(nl + 2);
+                }
+            }
+            if (contentLength > MAX_BODY_BYTES) {
+                resp.status = 413;
+                keepAlive = false;
+            } else if (resp.status == 200) {
+                if (c.in.size() < end + 4 + contentLength) return;  // body not complete yet
+                consumed = end + 4 + contentLength;
+                HttpRequest req;
+                req.method = line.substr(0, sp1);
+                std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+                size_t q = target.find('?');
+                req.path = target.substr(0, q);
+                req.query = q == std::string_view::npos ? std::string_view() : target.substr(q + 1);
+                if (req.method != "GET" && req.method != "HEAD") {
+                    resp.status = 405;
+                } else {
+                    handler_(req, resp);
+                }
+                headOnly = req.method == "HEAD";  // headers with the length the body would have
+            }
+        }
+
+        if (resp.status != 200 && resp.body.empty() && !resp.shared) {
+            resp.body = std::string("{\"error\":\"") + statusText(resp.status) + "\"}";
+        }
+        size_t bodyLen = resp.shared ? resp.shared->size() : resp.body.size();
+        OutChunk head;
+        char hdr[256];
+        int n = snprintf(hdr, sizeof(hdr),
+                         "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                         resp.status, statusText(resp.status), resp.contentType, bodyLen,
+                         keepAlive ? "keep-alive" : "close");
+        head.own.assign(hdr, n);
+        if (!resp.shared && !headOnly) head.own += resp.body;  // small bodies go with the header
+        c.outBytes += head.size();
+        c.out.push_back(std::move(head));
+        if (resp.shared && !headOnly) {
+            OutChunk body;
+            body.shared = std::move(resp.shared);
+            c.outBytes += body.size();
+            c.out.push_back(std::move(body));
+        }
+        ++requests_;
+
+        if (!keepAlive || consumed == 0) {
+            c.closeAfter = true;
+            c.in.clear();
+            return;
+        }
+        c.in.erase(0, consumed);
+    }
+}
+
+bool HttpServer::onWritable(Connection& c) {
+    for (;;) {
+        while (!c.out.empty()) {
+            struct iovec iov[16];
+            int n = 0;
+            for (auto it = c.out.begin(); it != c.out.end() && n < 16; ++it, ++n) {
+                iov[n].iov_base = (void*)(it->data() + it->off);
+                iov[n].iov_len = it->size() - it->off;
+            }
+            ssize_t w = writev(c.fd, iov, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                break;
+            }
+            c.outBytes -= w;
+            c.lastActiveMs = monotonicNowMs();
+            size_t left = w;
+            while (left > 0 && !c.out.empty()) {
+                OutChunk& ch = c.out.front();
+                size_t rest = ch.size() - ch.off;
+                if (left < rest) {
+                    ch.off += left;
+                    left = 0;
+                } else {
+                    left -= rest;
+                    c.out.pop_front();
+                }
+            }
+        }
+        // output drained below the cap: answer the requests held back
+        if (!c.held || c.outBytes >= MAX_OUT_BYTES) break;
+        process(c);
+        if (c.out.empty()) break;
+    }
+    if (c.out.empty() && c.closeAfter) return false;
+
+    // wait for EPOLLOUT only while output is pending, and read no more input
+    // while requests are held back
+    uint32_t events = (c.held ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP)) | (c.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+    if (events != c.events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.fd = c.fd;
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, c.fd, &ev);
+        c.events = events;
+    }
+    return true;
+}
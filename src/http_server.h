@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Minimal HTTP/1.1 server for local queries: one thread, non-blocking sockets
+// multiplexed with epoll (level triggered), keep-alive and pipelined requests.
+// Only request line and headers are parsed; request bodies are skipped. The
+// handler runs on the server thread and fills the response; a shared body is
+// sent straight from the shared buffer (writev with the header), so cached
+// responses are not copied per request.
+
+struct HttpRequest {
+    std::string_view method;
+    std::string_view path;   // without query
+    std::string_view query;  // after '?', empty if none
+
+    // value of query parameter name ("" if present without value), false if absent
+    bool param(const char* name, std::string_view& value) const;
+};
+
+struct HttpResponse {
+    int status = 200;
+    const char* contentType = "application/json";
+    std::string body;                          // sent if shared is null
+    std::shared_ptr<const std::string> shared;  // cached body, sent without copying
+};
+
+typedef std::function<void(const HttpRequest&, HttpResponse&)> HttpHandler;
+
+class HttpServer {
+public:
+    HttpServer();
+    ~HttpServer();
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    // listen on addr:port and serve on a new thread; false if the socket cannot be bound
+    bool start(const char* addr, int port, HttpHandler handler, size_t maxConnections, unsigned idleMs);
+    void stop();
+
+    uint64_t requests() const { return requests_; }
+    size_t connections() const { return connections_; }
+
+private:
+    struct Connection;
+
+    void run();
+    void accept();
+    bool onReadable(Connection& c);
+    bool onWritable(Connection& c);
+    void process(Connection& c);
+    void closeIdle();
+    void closeConnection(int fd);
+
+    int listenFd_ = -1;
+    int epollFd_ = -1;
+    HttpHandler handler_;
+    size_t maxConnections_ = 0;
+    unsigned idleMs_ = 0;
+    std::vector<std::unique_ptr<Connection>> conns_;  // by fd
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<size_t> connections_{0};
+    std::thread thread_;
+};
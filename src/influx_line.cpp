@@ -0,0 +1,81 @@
+#include "influx_line.h"
+
+#include <charconv>
+
+void InfluxLineWriter::appendEscaped(const char* s, size_t len, const char* special) {
+    // copy runs of plain characters at once, backslash the special ones
+    size_t runStart = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] != '\0' && strchr(special, s[i])) {
+            buf_.append(s + runStart, i - runStart);
+            buf_.push_back('\\');
+            buf_.push_back(s[i]);
+            runStart = i + 1;
+        }
+    }
+    buf_.append(s + runStart, len - runStart);
+}
+
+InfluxLineWriter& InfluxLineWriter::measurement(const char* name, size_t len) {
+    lineStart_ = buf_.size();
+    fields_ = 0;
+    appendEscaped(name, len, ", ");
+    return *this;
+}
+
+InfluxLineWriter& InfluxLineWriter::tag(const char* key, const char* value, size_t len) {
+    buf_.push_back(',');
+    appendEscaped(key, strlen(key), ",= ");
+    buf_.push_back('=');
+    appendEscaped(value, len, ",= ");
+    return *this;
+}
+
+InfluxLineWriter& InfluxLineWriter::tag(const char* key, unsigned value) {
+    char num[16];
+    auto r = std::to_chars(num, num + sizeof(num), value);
+    return tag(key, num, r.ptr - num);
+}
+
+void InfluxLineWriter::fieldKey(const char* key) {
+    buf_.push_back(fields_++ ? ',' : ' ');
+    appendEscaped(key, strlen(key), ",= ");
+    buf_.push_back('=');
+}
+
+InfluxLineWriter& InfluxLineWriter::field(const char* key, double value) {
+    fieldKey(key);
+    char num[32];
+    auto r = std::to_chars(num, num + sizeof(num), value);
+    buf_.append(num, r.ptr - num);
+    return *this;
+}
+
+InfluxLineWriter& InfluxLineWriter::fieldInt(const char* key, int64_t value) {
+    fieldKey(key);
+    char num[24];
+    auto r = std::to_chars(num, num + sizeof(num), value);
+    buf_.append(num, r.ptr - num);
+    buf_.push_back('i');
+    return *this;
+}
+
+InfluxLineWriter& InfluxLineWriter::fieldString(const char* key, const char* value, size_t len) {
+    fieldKey(key);
+    buf_.push_back('"');
+    appendEscaped(value, len, "\"\\");
+    buf_.push_back('"');
+    return *this;
+}
+
+void InfluxLineWriter::end(int64_t ts_ns) {
+    if (ts_ns > 0) {
+        char num[24];
+        auto r = std::to_chars(num, num + sizeof(num), ts_ns);
+        buf_.push_back(' ');
+        buf_.append(num, r.ptr - num);
+    }
+    buf_.push_back('\n');
+    lineStart_ = buf_.size();
+    fields_ = 0;
+}
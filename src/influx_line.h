@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// Reusable Influx line-protocol encoder. Appends measurement, tags, fields and
+// timestamp of one or more lines directly into an internal buffer, escaping in
+// place and formatting numbers with std::to_chars. The buffer keeps its
+// capacity across clear(), so steady-state encoding does not allocate.
+//
+//   w.clear();
+//   w.measurement("m").tag("unit", 3).field("value", 1.5).end(ts_ns);
+//   send(w.str());
+class InfluxLineWriter {
+public:
+    explicit InfluxLineWriter(size_t reserve = 1024) { buf_.reserve(reserve); }
+
+    void clear() { buf_.clear(); lineStart_ = 0; }
+    const std::string& str() const { return buf_; }
+    const char* data() const { return buf_.data(); }
+    size_t size() const { return buf_.size(); }
+    bool empty() const { return buf_.empty(); }
+    // bytes of the line currently being written
+    size_t lineSize() const { return buf_.size() - lineStart_; }
+
+    // start a new line (escapes commas and spaces)
+    InfluxLineWriter& measurement(const char* name, size_t len);
+    InfluxLineWriter& measurement(const char* name) { return measurement(name, strlen(name)); }
+    InfluxLineWriter& measurement(const std::string& name) { return measurement(name.data(), name.size()); }
+
+    // tags must follow measurement and precede the first field
+    InfluxLineWriter& tag(const char* key, const char* value, size_t len);
+    InfluxLineWriter& tag(const char* key, const char* value) { return tag(key, value, strlen(value)); }
+    InfluxLineWriter& tag(const char* key, unsigned value);
+
+    // fields: float, integer (with 'i' suffix) and string
+    InfluxLineWriter& field(const char* key, double value);
+    InfluxLineWriter& fieldInt(const char* key, int64_t value);
+    InfluxLineWriter& fieldString(const char* key, const char* value, size_t len);
+    InfluxLineWriter& fieldString(const char* key, const std::string& value) { return fieldString(key, value.data(), value.size()); }
+
+    // terminate the line with an explicit timestamp in ns since epoch (0 = server time)
+    void end(int64_t ts_ns);
+
+    // drop the line currently being written (e.g. if it got too long)
+    void discardLine() { buf_.resize(lineStart_); fields_ = 0; }
+
+private:
+    void fieldKey(const char* key);
+    void appendEscaped(const char* s, size_t len, const char* special);
+
+    std::string buf_;
+    size_t lineStart_ = 0;
+    unsigned fields_ = 0;
+};
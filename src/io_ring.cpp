@@ -0,0 +1,199 @@
+#include "io_ring.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+static int sysSetup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int sysRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// ring indices are shared with the kernel
+static unsigned loadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoRing::~IoRing() {
+    if (sqes_) munmap(sqes_, sqesSize_);
+    if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if (sqRing_) munmap(sqRing_, sqRingSize_);
+    if (fd_ >= 0) close(fd_);
+}
+
+bool IoRing::init(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sysSetup(entries, &p);
+    if (fd < 0) return false;  // ENOSYS (old kernel), EPERM (disabled), ...
+
+    sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cqRingSize_ > sqRingSize_) sqRingSize_ = cqRingSize_;
+        cqRingSize_ = sqRingSize_;
+    }
+    void* sq = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    void* cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, sqRingSize_);
+            close(fd);
+            return false;
+        }
+    }
+    sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq != sq) munmap(cq, cqRingSize_);
+        munmap(sq, sqRingSize_);
+        close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    sqRing_ = sq;
+    cqRing_ = cq;
+    sqes_ = (io_uring_sqe*)sqes;
+    char* s = (char*)sq;
+    sqHead_ = (unsigned*)(s + p.sq_off.head);
+    sqTail_ = (unsigned*)(s + p.sq_off.tail);
+    sqMask_ = *(unsigned*)(s + p.sq_off.ring_mask);
+    sqArray_ = (unsigned*)(s + p.sq_off.array);
+    char* c = (char*)cq;
+    cqHead_ = (unsigned*)(c + p.cq_off.head);
+    cqTail_ = (unsigned*)(c + p.cq_off.tail);
+    cqMask_ = *(unsigned*)(c + p.cq_off.ring_mask);
+    cqes_ = c + p.cq_off.cqes;
+    entries_ = p.sq_entries;
+    tail_ = *sqTail_;
+    timeouts_.assign(2 * (size_t)entries_, 0);
+    return true;
+}
+
+bool IoRing::registerBuffer(void* buf, size_t len) {
+    if (fd_ < 0) return false;
+    struct iovec iov = { buf, len };
+    return sysRegister(fd_, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+io_uring_sqe* IoRing::next(uint8_t opcode, int fd, uint64_t tag, bool link) {
+    if (fd_ < 0 || tail_ - loadAcquire(sqHead_) >= entries_) return nullptr;
+    unsigned index = tail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    if (link) sqe->flags = IOSQE_IO_LINK;
+    sqArray_[index] = index;
+    ++tail_;
+    ++pending_;
+    return sqe;
+}
+
+bool IoRing::readFixed(int fd, void* buf, size_t len, uint64_t tag, bool link) {
+    io_uring_sqe* sqe = next(IORING_OP_READ_FIXED, fd, tag, link);
+    if (!sqe) return false;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->buf_index = 0;
+    return true;
+}
+
+bool IoRing::writeFixed(int fd, const void* buf, size_t len, uint64_t tag, bool link) {
+    io_uring_sqe* sqe = next(IORING_OP_WRITE_FIXED, fd, tag, link);
+    if (!sqe) return false;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->buf_index = 0;
+    return true;
+}
+
+bool IoRing::sendmsg(int fd, const struct msghdr* msg, uint64_t tag, bool link) {
+    io_uring_sqe* sqe = next(IORING_OP_SENDMSG, fd, tag, link);
+    if (!sqe) return false;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    return true;
+}
+
+bool IoRing::recv(int fd, void* buf, size_t len, uint64_t tag, bool link) {
+    io_uring_sqe* sqe = next(IORING_OP_RECV, fd, tag, link);
+    if (!sqe) return false;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    return true;
+}
+
+bool IoRing::write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t tag, bool link) {
+    io_uring_sqe* sqe = next(IORING_OP_WRITE, fd, tag, link);
+    if (!sqe) return false;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = offset;
+    return true;
+}
+
+bool IoRing::linkTimeout(int64_t ms, uint64_t tag) {
+    unsigned index = tail_ & sqMask_;
+    io_uring_sqe* sqe = next(IORING_OP_LINK_TIMEOUT, -1, tag, false);
+    if (!sqe) return false;
+    // the timespec is read at submission, its slot is reused with the entry
+    int64_t* ts = &timeouts_[2 * (size_t)index];
+    ts[0] = ms / 1000;
+    ts[1] = (ms % 1000) * 1000000;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    return true;
+}
+
+unsigned IoRing::completionsReady() const {
+    return loadAcquire(cqTail_) - *cqHead_;
+}
+
+int IoRing::submit(unsigned waitFor) {
+    if (fd_ < 0) return -EBADF;
+    storeRelease(sqTail_, tail_);
+    for (;;) {
+        unsigned toSubmit = tail_ - loadAcquire(sqHead_);
+        if (toSubmit == 0 && completionsReady() >= waitFor) return 0;
+        ++enters_;
+        int rc = sysEnter(fd_, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+        if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -errno;
+        if (waitFor == 0 && rc >= 0) return 0;
+    }
+}
+
+bool IoRing::complete(uint64_t& tag, int& res) {
+    unsigned head = *cqHead_;
+    if (head == loadAcquire(cqTail_)) return false;
+    const io_uring_cqe* cqe = (const io_uring_cqe*)cqes_ + (head & cqMask_);
+    tag = cqe->user_data;
+    res = cqe->res;
+    storeRelease(cqHead_, head + 1);
+    if (pending_) --pending_;
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct msghdr;
+
+// Minimal io_uring submission/completion ring (raw system calls, no liburing)
+// for the few blocking I/O paths of the gateway: operations are queued and
+// handed to the kernel with one system call, linked operations run in order
+// (a failed one cancels the rest of its chain), and a linked timeout bounds
+// the operation queued before it.
+//
+// One ring is used by one thread at a time. init() fails on kernels without
+// io_uring (or with it disabled); callers then use the plain system calls.
+class IoRing {
+public:
+    IoRing() = default;
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Set up a ring for up to entries queued operations; false if io_uring is unavailable
+    bool init(unsigned entries);
+    bool ready() const { return fd_ >= 0; }
+    // Register buf as fixed buffer 0 for readFixed()/writeFixed() (pinned once, not per operation)
+    bool registerBuffer(void* buf, size_t len);
+
+    // Queue an operation tagged with tag; link: the next queued operation
+    // starts only after this one succeeded. False if the queue is full.
+    bool readFixed(int fd, void* buf, size_t len, uint64_t tag, bool link = false);
+    bool writeFixed(int fd, const void* buf, size_t len, uint64_t tag, bool link = false);
+    bool sendmsg(int fd, const struct msghdr* msg, uint64_t tag, bool link = false);
+    bool recv(int fd, void* buf, size_t len, uint64_t tag, bool link = false);
+    bool write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t tag, bool link = false);
+    // Cancel the operation queued just before (which must be linked) after ms;
+    // it then completes with -ECANCELED
+    bool linkTimeout(int64_t ms, uint64_t tag);
+
+    // Submit all queued operations and wait until waitFor completions are
+    // ready, in one system call unless interrupted. 0 or -errno.
+    int submit(unsigned waitFor = 0);
+    // Take the oldest completion (res: result or -errno); false if none is ready
+    bool complete(uint64_t& tag, int& res);
+    // Operations submitted or queued whose completion was not taken yet
+    unsigned pending() const { return pending_; }
+    // io_uring_enter calls made so far
+    uint64_t enterCalls() const { return enters_; }
+
+private:
+    io_uring_sqe* next(uint8_t opcode, int fd, uint64_t tag, bool link);
+    unsigned completionsReady() const;
+
+    int fd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingSize_ = 0, cqRingSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+    unsigned *sqHead_ = nullptr, *sqTail_ = nullptr, *sqArray_ = nullptr;
+    unsigned *cqHead_ = nullptr, *cqTail_ = nullptr;
+    void* cqes_ = nullptr;
+    unsigned sqMask_ = 0, cqMask_ = 0, entries_ = 0;
+    unsigned tail_ = 0;  // local submission tail (published by submit())
+    unsigned pending_ = 0;
+    uint64_t enters_ = 0;
+    std::vector<int64_t> timeouts_;  // __kernel_timespec per submission slot (tv_sec, tv_nsec)
+};
@@ -0,0 +1,78 @@
+#include "json_writer.h"
+
+#include <charconv>
+#include <math.h>
+
+void JsonWriter::appendString(const char* s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    buf_.push_back('"');
+    size_t runStart = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        buf_.append(s + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"':  buf_.append("\\\""); break;
+            case '\\': buf_.append("\\\\"); break;
+            case '\n': buf_.append("\\n"); break;
+            case '\r': buf_.append("\\r"); break;
+            case '\t': buf_.append("\\t"); break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                buf_.append(esc, sizeof(esc));
+            }
+        }
+    }
+    buf_.append(s + runStart, len - runStart);
+    buf_.push_back('"');
+}
+
+JsonWriter& JsonWriter::key(const char* k, size_t len) {
+    separator();
+    appendString(k, len);
+    buf_.push_back(':');
+    afterKey_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(unsigned k) {
+    char num[16];
+    auto r = std::to_chars(num, num + sizeof(num), k);
+    return key(num, r.ptr - num);
+}
+
+JsonWriter& JsonWriter::value(const char* s, size_t len) {
+    separator();
+    appendString(s, len);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double v) {
+    separator();
+    if (!isfinite(v)) {
+        // JSON has no representation for NaN/Inf
+        buf_.append("null");
+        return *this;
+    }
+    char num[32];
+    auto r = std::to_chars(num, num + sizeof(num), v);
+    buf_.append(num, r.ptr - num);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int64_t v) {
+    separator();
+    char num[24];
+    auto r = std::to_chars(num, num + sizeof(num), v);
+    buf_.append(num, r.ptr - num);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(uint64_t v) {
+    separator();
+    char num[24];
+    auto r = std::to_chars(num, num + sizeof(num), v);
+    buf_.append(num, r.ptr - num);
+    return *this;
+}
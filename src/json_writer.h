@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+// Streaming JSON encoder writing straight into a reusable buffer.
+// Commas are inserted automatically; keys and values are emitted in call order,
+// so the caller is responsible for key order and uniqueness. No DOM, and no
+// allocation once the buffer has grown to its working size.
+//
+//   w.clear();
+//   w.beginObject().key("3").beginObject().key("name").value("x").endObject().endObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(size_t reserve = 1024) { buf_.reserve(reserve); }
+
+    void clear() { buf_.clear(); depth_ = 0; first_ = 1; }
+    const std::string& str() const { return buf_; }
+    const char* data() const { return buf_.data(); }
+    size_t size() const { return buf_.size(); }
+
+    JsonWriter& beginObject() { separator(); buf_.push_back('{'); push(); return *this; }
+    JsonWriter& endObject() { buf_.push_back('}'); pop(); return *this; }
+    JsonWriter& beginArray() { separator(); buf_.push_back('['); push(); return *this; }
+    JsonWriter& endArray() { buf_.push_back(']'); pop(); return *this; }
+
+    JsonWriter& key(const char* k, size_t len);
+    JsonWriter& key(const char* k) { return key(k, strlen(k)); }
+    JsonWriter& key(const std::string& k) { return key(k.data(), k.size()); }
+    JsonWriter& key(unsigned k);
+
+    JsonWriter& value(const char* s, size_t len);
+    JsonWriter& value(const char* s) { return value(s, strlen(s)); }
+    JsonWriter& value(const std::string& s) { return value(s.data(), s.size()); }
+    JsonWriter& value(double v);
+    JsonWriter& value(int64_t v);
+    JsonWriter& value(uint64_t v);
+    JsonWriter& value(int v) { return value((int64_t)v); }
+    JsonWriter& value(unsigned v) { return value((uint64_t)v); }
+    JsonWriter& value(bool b) { separator(); buf_.append(b ? "true" : "false"); return *this; }
+    JsonWriter& null() { separator(); buf_.append("null"); return *this; }
+
+    // append an already serialized JSON value as is
+    JsonWriter& raw(const char* json, size_t len) { separator(); buf_.append(json, len); return *this; }
+
+private:
+    // comma before every element but the first of a container; none right after a key
+    void separator() {
+        if (afterKey_) { afterKey_ = false; return; }
+        if (!(first_ & 1)) buf_.push_back(',');
+        first_ &= ~(uint64_t)1;
+    }
+    void push() { first_ = (first_ << 1) | 1; ++depth_; }
+    void pop() { first_ >>= 1; first_ &= ~(uint64_t)1; --depth_; }
+    void appendString(const char* s, size_t len);
+
+    std::string buf_;
+    uint64_t first_ = 1;     // bit n: nothing written yet at nesting level depth-n
+    unsigned depth_ = 0;
+    bool afterKey_ = false;
+};
@@ -0,0 +1,199 @@
+#include "log.h"
+#include "pipeline.h"
+#include "modbus_config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define LOG_LINE_BYTES 256     // longer lines are cut
+#define LOG_IDLE_MAX_US 20000  // logger thread: longest sleep while nothing is logged
+
+std::atomic<int> logLevel(LOG_LEVEL);
+
+static std::atomic<uint64_t> droppedLines(0);
+static std::atomic<uint64_t> suppressedLines(0);
+
+struct LogLine {
+    std::atomic<size_t> seq;  // == position: free, == position + 1: written
+    uint16_t len;
+    char text[LOG_LINE_BYTES];
+};
+
+// Bounded multi-producer ring of formatted lines (a sequence number per slot
+// tells producers and the consumer whose turn it is) and the logger thread
+// writing them out. The thread is started by the first line and stopped,
+// after writing what is left, at exit.
+class Logger {
+public:
+    explicit Logger(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        lines_.reset(new LogLine[n]);
+        mask_ = n - 1;
+        for (size_t i = 0; i < n; ++i) lines_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    ~Logger() {
+        stop_ = true;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    // Free slot for a line, nullptr while the ring is full; publish(line, pos) when written
+    LogLine* claim(size_t& pos) {
+        pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            LogLine& line = lines_[pos & mask_];
+            intptr_t diff = (intptr_t)line.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &line;
+            } else if (diff < 0) {
+                return nullptr;  // the slot still holds a line of the previous round
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    void publish(LogLine* line, size_t pos) {
+        line->seq.store(pos + 1, std::memory_order_release);
+        if (!started_.load(std::memory_order_acquire)) start();
+    }
+
+    void flush() {
+        size_t target = tail_.load(std::memory_order_acquire);
+        if (!started_.load(std::memory_order_acquire)) return;
+        IdleBackoff backoff(1000);
+        while (written_.load(std::memory_order_acquire) < target) backoff.wait();
+    }
+
+private:
+    void start() {
+        std::lock_guard<std::mutex> lock(startMutex_);
+        if (started_) return;
+        thread_ = std::thread(&Logger::run, this);
+        started_ = true;
+    }
+
+    void run() {
+        pipelineThreadSetup("logger", -1);
+        IdleBackoff idle(LOG_IDLE_MAX_US);
+        static char buf[64 * 1024];
+        uint64_t reportedDrops = 0;
+        size_t head = 0;
+        for (;;) {
+            size_t n = 0;
+            for (;;) {
+                LogLine& line = lines_[head & mask_];
+                if (line.seq.load(std::memory_order_acquire) != head + 1) break;
+                if (n + line.len > sizeof(buf)) break;
+                memcpy(buf + n, line.text, line.len);
+                n += line.len;
+                line.seq.store(head + mask_ + 1, std::memory_order_release);
+                ++head;
+            }
+            uint64_t drops = droppedLines.load(std::memory_order_relaxed);
+            if (drops != reportedDrops && n + 128 <= sizeof(buf)) {
+                n += snprintf(buf + n, 128, "[logger] %llu lines dropped, log ring full\n",
+                              (unsigned long long)(drops - reportedDrops));
+                reportedDrops = drops;
+            }
+            if (n == 0) {
+                if (stop_ && tail_.load(std::memory_order_acquire) == head) break;
+                idle.wait();
+                continue;
+            }
+            idle.reset();
+            // may block on a slow consumer of stdout (journald pipe); only this thread waits
+            fwrite(buf, 1, n, stdout);
+            fflush(stdout);
+            written_.store(head, std::memory_order_release);
+        }
+    }
+
+    std::unique_ptr<LogLine[]> lines_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<size_t> written_{0};  // lines handed to stdout
+    std::atomic<bool> started_{false};
+    std::atomic<bool> stop_{false};
+    std::mutex startMutex_;
+    std::thread thread_;
+};
+
+static Logger logger(LOG_RING_LINES);
+
+static int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void logWrite(LogSite& site, int level, const char* func, const char* fmt, ...) {
+    // rate limit per call site: a new window reports what the last one suppressed
+    uint32_t reported = 0;
+    if (LOG_RATE_LINES > 0) {
+        int64_t now = nowMs();
+        int64_t start = site.windowMs.load(std::memory_order_relaxed);
+        if (now - start >= LOG_RATE_WINDOW_MS &&
+            site.windowMs.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            reported = site.suppressed.exchange(0, std::memory_order_relaxed);
+            site.lines.store(0, std::memory_order_relaxed);
+        }
+        if (site.lines.fetch_add(1, std::memory_order_relaxed) >= LOG_RATE_LINES) {
+            site.suppressed.fetch_add(1, std::memory_order_relaxed);
+            suppressedLines.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    size_t pos;
+    LogLine* line = logger.claim(pos);
+    if (!line) {
+        droppedLines.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+#if LOG_SYSLOG_PREFIX
+    // journald takes the priority from an sd-daemon "<n>" prefix
+    static const char* const prefixes[] = { "<3>", "<4>", "<6>", "<7>" };
+    int n = snprintf(line->text, sizeof(line->text), "%s[%s] ", prefixes[level], func);
+#else
+    static const char* const prefixes[] = { "error: ", "warning: ", "", "debug: " };
+    int n = snprintf(line->text, sizeof(line->text), "[%s] %s", func, prefixes[level]);
+#endif
+    const size_t room = sizeof(line->text) - 1;  // keeps one byte for the newline
+    if (n < 0) n = 0;
+    if ((size_t)n < room) {
+        va_list ap;
+        va_start(ap, fmt);
+        int m = vsnprintf(line->text + n, room - n, fmt, ap);
+        va_end(ap);
+        if (m > 0) n += m;
+    }
+    if (reported && (size_t)n < room) {
+        n += snprintf(line->text + n, room - n, " (%u similar lines suppressed)", reported);
+    }
+    size_t len = (size_t)n < room ? (size_t)n : room - 1;
+    line->text[len++] = '\n';
+    line->len = (uint16_t)len;
+    logger.publish(line, pos);
+}
+
+void logSetLevel(int level) {
+    logLevel.store(level, std::memory_order_relaxed);
+}
+
+void logFlush() {
+    logger.flush();
+}
+
+uint64_t logDropped() {
+    return droppedLines.load(std::memory_order_relaxed);
+}
+
+uint64_t logSuppressed() {
+    return suppressedLines.load(std::memory_order_relaxed);
+}
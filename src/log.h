@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Asynchronous leveled logging. A log call checks the level and the rate of
+// its call site, formats the line into a slot of a lock-free ring and returns;
+// the "logger" thread writes the lines to stdout. A call never blocks: lines
+// are dropped (and counted) while the ring is full, and a call site logging
+// more than LOG_RATE_LINES lines per LOG_RATE_WINDOW_MS is suppressed until
+// the next window (the next line it logs reports how many were suppressed).
+//
+//   LOG_ERROR / LOG_WARN / LOG("...") (info) / LOG_DEBUG, printf style
+
+enum LogLevel { LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG };
+
+// Rate limiting state of one call site (zero-initialized static)
+struct LogSite {
+    std::atomic<int64_t> windowMs;
+    std::atomic<uint32_t> lines;       // lines logged in the current window
+    std::atomic<uint32_t> suppressed;  // lines suppressed in the current window
+};
+
+extern std::atomic<int> logLevel;
+
+void logWrite(LogSite& site, int level, const char* func, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#define LOG_AT(level, fmt, ...)                                                   \
+    do {                                                                          \
+        if ((level) <= logLevel.load(std::memory_order_relaxed)) {                \
+            static LogSite logSite_;                                              \
+            logWrite(logSite_, (level), __FUNCTION__, fmt, ##__VA_ARGS__);        \
+        }                                                                         \
+    } while (0)
+
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+void logSetLevel(int level);
+
+// Wait until every line logged so far is written
+void logFlush();
+
+// Lines lost because the ring was full / suppressed by rate limiting, since startup
+uint64_t logDropped();
+uint64_t logSuppressed();
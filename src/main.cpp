@@ -3,6 +3,7 @@
 #include <cstring>
 #include <cstdint>
 #include <cstdlib>
+#include <cmath>
 #include <unistd.h>
 #include <thread>
 #include <chrono>
@@ -15,6 +16,7 @@
 #include <fstream>
 #include <set>
 #include <algorithm>
+#include <csignal>
 #include <nlohmann/json.hpp>
 
 #include "mqtt/client.h"
@@ -22,14 +24,38 @@
 // Networking for InfluxDB line-protocol sender
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
 
 #include "modbus_registers.h"
-
-// Logging helper
-#define LOG(fmt, ...) printf("[%s] " fmt "\n", __FUNCTION__, ##__VA_ARGS__)
+#include "modbus_client.h"
+#include "timeseries.h"
+#include "spill_log.h"
+#include "circuit_breaker.h"
+#include "influx_line.h"
+#include "json_writer.h"
+#include "cbor_writer.h"
+#include "connection.h"
+#include "register_map.h"
+#include "runtime_config.h"
+#include "modbus_capture.h"
+#include "history_store.h"
+#include "register_image.h"
+#include "correlation.h"
+#include "pipeline.h"
+#include "register_snapshot.h"
+#include "register_shm.h"
+#include "query_api.h"
+#include "modbus_proxy.h"
+#include "perf_stats.h"
+#include "trace.h"
+#include "log.h"
+#include "io_ring.h"
 
 // MQTT configuration
 #include "mqtt_config.h"
@@ -46,6 +72,13 @@ static const char* mqttPrefix = MQTT_TOPIC_PREFIX;
 static mqtt::client* mqttClient = nullptr;
 static std::atomic<bool> running(true);
 static std::string influxMeasurement;
+
+// Runtime configuration: the polling thread works on its own snapshot and
+// switches to a newly loaded one only between transactions
+static const char* configFile = RUNTIME_CONFIG_FILE;
+static std::shared_ptr<const RuntimeConfig> pollConfig;  // set in main() once the config file is loaded
+static std::atomic<bool> reloadRequested(false);
+static std::atomic<bool> traceDumpRequested(false);  // "trace dump", written by the maintenance thread
 static const char* CHANGED_ADDRESSES_FILE = ".joba_changed_addresses.json";
 
 // Track register values and changes
@@ -57,21 +90,97 @@ struct RegisterValue {
     bool published = false;
 };
 
+// Owned by the decode stage; other threads read the published snapshots (register_snapshot.h)
 static std::map<uint32_t, RegisterValue> registerValues;  // key: (unitId << 16) | addr
 static std::set<uint32_t> changedAddresses;  // persistent list of changed addresses
 static std::vector<unsigned> changedAddressesRanges;  // indices of ranges containing changed addresses
-static std::mutex registerValuesMutex;
+static bool registerValuesDirty = false;  // changed since the last snapshot
+static std::shared_ptr<const RegisterMetaTable> registerMeta;  // copy of the table for snapshots
+
+// Recent numeric history of changing registers for local consumers (has its own lock)
+static TimeSeriesStore registerHistory;
+
+// Compressed long-term history of the same registers in a local file (has its own lock)
+static HistoryStore registerArchive;
+
+// Influx store-and-forward: lines go to the spill log while the circuit is open
+static SpillLog influxSpill;
+static CircuitBreaker influxBreaker(INFLUX_BREAKER_FAILURES, INFLUX_BREAKER_OPEN_MS, INFLUX_BREAKER_MAX_OPEN_MS);
+
+// Pipeline: the Modbus I/O thread hands received frames to the decode thread, which
+// detects changes and hands them to one thread per sink. Bounded SPSC queues of
+// preallocated records connect the stages: a slow sink backs up into the decode
+// stage, a slow decode stage makes the I/O thread drop frames (they are read again
+// next sweep) instead of delaying transactions.
+struct DecodeRecord {
+    bool sweepEnd;       // no frame: end of a polling sweep (summary, history maintenance)
+    ModbusFrame frame;
+};
+
+struct MqttRecord {
+    char topic[128];
+    char payload[128];
+    uint16_t payloadLen;
+    uint64_t traceId;    // flow from the change to the publish, 0 while not tracing
+};
+
+struct InfluxRecord {
+    enum Kind : uint8_t { FLOAT, INT, TEXT };
+    int64_t tNs;
+    double num;
+    uint16_t addr;
+    uint8_t unitId;
+    Kind kind;
+    bool compact;        // schema of the config the value was decoded with
+    char group[16];      // register type group (compact schema)
+    char name[64];       // topic slug (one series per register)
+    uint16_t textLen;
+    char text[128];
+    uint64_t traceId;    // flow from the change to the write, 0 while not tracing
+};
+
+static SpscRing<DecodeRecord> decodeQueue(PIPELINE_FRAME_QUEUE);
+static SpscRing<MqttRecord> mqttQueue(PIPELINE_SINK_QUEUE);
+static SpscRing<InfluxRecord> influxQueue(PIPELINE_SINK_QUEUE);
+static SpscRing<uint32_t> changedKeyQueue(PIPELINE_SINK_QUEUE);  // decode -> I/O: registers that started changing
+static std::atomic<bool> decodeStop(false);  // set once the I/O stage is done
+static std::atomic<bool> sinkStop(false);    // set once the decode stage is done
+
+// Slot in a queue, waiting while its consumer is behind
+template <typename T>
+static T* claimWait(SpscRing<T>& queue) {
+    IdleBackoff backoff(PIPELINE_IDLE_MAX_US);
+    T* slot = queue.claim();
+    if (slot) return slot;
+    TRACE_SCOPE("queue.wait");
+    while (!(slot = queue.claim())) backoff.wait();
+    return slot;
+}
+
+// Summary thread: builds the summary of the snapshot with epoch summaryRequest
+static std::atomic<uint64_t> summaryRequest(0);
+static std::atomic<uint64_t> summaryDone(0);
 
-// Helper function to format system_clock::time_point as ISO 8601 string
-static std::string formatISO8601(const std::chrono::system_clock::time_point& tp) {
+// Wait until every stage has processed everything queued (the producing stages must be idle)
+static void drainPipeline() {
+    IdleBackoff backoff(PIPELINE_IDLE_MAX_US);
+    while (!decodeQueue.empty() || !mqttQueue.empty() || !influxQueue.empty() ||
+           summaryDone != summaryRequest) {
+        backoff.wait();
+    }
+}
+
+// Helper function to format system_clock::time_point as ISO 8601 string into buf (at least 32 bytes)
+static size_t formatISO8601(const std::chrono::system_clock::time_point& tp, char* buf, size_t size) {
     auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(tp);
     auto tt = std::chrono::system_clock::to_time_t(sctp);
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()) % 1000;
-    
-    std::ostringstream oss;
-    oss << std::put_time(std::gmtime(&tt), "%FT%T");
-    oss << '.' << std::setfill('0') << std::setw(3) << ms.count() << 'Z';
-    return oss.str();
+
+    struct tm tmv;
+    gmtime_r(&tt, &tmv);
+    size_t len = strftime(buf, size, "%FT%T", &tmv);
+    len += snprintf(buf + len, size - len, ".%03dZ", (int)ms.count());
+    return len;
 }
 
 // Load persistent changed addresses from file
@@ -93,97 +202,164 @@ static void loadChangedAddresses() {
             LOG("Loaded %zu persistent changed addresses", changedAddresses.size());
         }
     } catch (const std::exception& e) {
-        LOG("Error loading changed addresses: %s", e.what());
+        LOG_ERROR("Error loading changed addresses: %s", e.what());
     }
     file.close();
 }
 
 // Save persistent changed addresses to file
+// The file stays open and is rewritten in place with one write (the list only
+// grows, shorter contents are padded with blanks). With io_uring the write is
+// not waited for; its buffer is kept until the next save. Decode stage only.
+static int changedAddressesFd = -1;
+static std::string changedAddressesText;  // contents of the last write
+static IoRing changedAddressesRing;
+static int changedAddressesRingState = 0;  // 0 not set up yet, 1 io_uring, -1 pwrite
+
+// Wait for the write in flight, if any
+static void finishChangedAddressesWrite() {
+    if (changedAddressesRing.pending() == 0) return;
+    changedAddressesRing.submit(1);
+    uint64_t tag;
+    int res;
+    while (changedAddressesRing.complete(tag, res)) {
+        if (res != (int)changedAddressesText.size()) LOG_ERROR("Error saving changed addresses: %s", strerror(res < 0 ? -res : EIO));
+    }
+}
+
 static void saveChangedAddresses() {
     try {
         json data = json::array();
         for (uint32_t addr : changedAddresses) {
             data.push_back(addr);
         }
-        
-        std::ofstream file(CHANGED_ADDRESSES_FILE);
-        file << data.dump(2);
-        file.close();
+
+        if (changedAddressesFd < 0) {
+            changedAddressesFd = open(CHANGED_ADDRESSES_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (changedAddressesFd < 0) {
+                LOG_ERROR("Error saving changed addresses: %s", strerror(errno));
+                return;
+            }
+            changedAddressesRingState = (IO_URING && changedAddressesRing.init(2)) ? 1 : -1;
+        }
+        finishChangedAddressesWrite();
+        size_t previous = changedAddressesText.size();
+        changedAddressesText = data.dump(2);
+        if (changedAddressesText.size() < previous) changedAddressesText.append(previous - changedAddressesText.size(), ' ');
+
+        if (changedAddressesRingState > 0) {
+            changedAddressesRing.write(changedAddressesFd, changedAddressesText.data(), changedAddressesText.size(), 0, 0);
+            changedAddressesRing.submit();
+        } else if (pwrite(changedAddressesFd, changedAddressesText.data(), changedAddressesText.size(), 0) != (ssize_t)changedAddressesText.size()) {
+            LOG_ERROR("Error saving changed addresses: %s", strerror(errno));
+            return;
+        }
         LOG("Saved %zu changed addresses to %s", changedAddresses.size(), CHANGED_ADDRESSES_FILE);
     } catch (const std::exception& e) {
-        LOG("Error saving changed addresses: %s", e.what());
+        LOG_ERROR("Error saving changed addresses: %s", e.what());
     }
 }
 
-// escape tag value for Influx line protocol (commas, spaces, equals)
-static std::string escapeInfluxTag(const std::string &s) {
-    std::string out; out.reserve(s.size());
-    for (char c: s) {
-        if (c == ',' || c == ' ' || c == '=') { out.push_back('\\'); out.push_back(c); }
-        else out.push_back(c);
-    }
-    return out;
+// Complete the last write of the changed addresses file and close it
+static void closeChangedAddresses() {
+    finishChangedAddressesWrite();
+    if (changedAddressesFd >= 0) close(changedAddressesFd);
+    changedAddressesFd = -1;
 }
 
-// escape field string for Influx line protocol (backslash and double quote)
-static std::string escapeInfluxFieldString(const std::string &s) {
-    std::string out; out.reserve(s.size());
-    for (char c: s) {
-        if (c == '\\' || c == '"') { out.push_back('\\'); out.push_back(c); }
-        else out.push_back(c);
-    }
-    return out;
+// Nanoseconds since epoch for explicit Influx timestamps
+static int64_t toNanos(const std::chrono::system_clock::time_point& tp) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
 }
 
-// send a line to InfluxDB using HTTP POST to /write?db=<INFLUX_DB>
-static bool sendInfluxLine(const char* host, int port, const std::string &line) {
-    // Build HTTP request
-    std::string path = std::string("/write?db=") + INFLUX_DB;
-    std::string body = line;
-    char headers[256];
-    snprintf(headers, sizeof(headers), "POST %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
-             path.c_str(), host, port, body.size());
-
-    struct addrinfo hints{};
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    char portbuf[16]; snprintf(portbuf, sizeof(portbuf), "%d", port);
-    struct addrinfo *res = nullptr;
-    if (getaddrinfo(host, portbuf, &hints, &res) != 0) return false;
-    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (sock < 0) { freeaddrinfo(res); return false; }
-    bool ok = true;
-    if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) ok = false;
-    if (ok) {
-        // send headers
-        size_t hlen = strlen(headers);
-        ssize_t sent = send(sock, headers, hlen, 0);
-        if (sent != (ssize_t)hlen) ok = false;
-        // send body
-        if (ok && !body.empty()) {
-            const char *buf = body.c_str();
-            size_t remaining = body.size();
-            while (remaining > 0) {
-                ssize_t s = send(sock, buf, remaining, 0);
-                if (s <= 0) { ok = false; break; }
-                remaining -= s;
-                buf += s;
-            }
+// Receive time of the Modbus response being decoded (falls back to now outside of parsing)
+static std::chrono::system_clock::time_point responseTime() {
+    int64_t ns = modbusResponseTimeNs();
+    if (ns <= 0) return std::chrono::system_clock::now();
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ns)));
+}
+
+// Influx connection supervision: cached DNS, connect deadline, backoff after failures
+static TcpEndpoint influxEndpoint(INFLUX_SERVER, INFLUX_PORT, INFLUX_TIMEOUT_MS, INFLUX_BACKOFF_MIN_MS, INFLUX_BACKOFF_MAX_MS);
+
+// Send headers and body on sock and receive the response until its status line
+// is complete (or the server closes, or INFLUX_TIMEOUT_MS pass). With io_uring
+// the request and the first read of the response are submitted together.
+// False if sending failed.
+static bool influxExchange(int sock, const char* headers, size_t hlen, const std::string& body, std::string& resp) {
+    static thread_local IoRing ring;  // sink, replay and summary threads write to Influx
+    static thread_local int ringState = 0;  // 0 not set up yet, 1 io_uring, -1 plain system calls
+    if (ringState == 0) ringState = (IO_URING && ring.init(4)) ? 1 : -1;
+
+    struct iovec iov[2] = { { (void*)headers, hlen }, { (void*)body.data(), body.size() } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    size_t total = hlen + body.size();
+    size_t sent = 0;
+    char rbuf[1024];
+
+    if (ringState > 0) {
+        ring.sendmsg(sock, &msg, 1, true);
+        ring.recv(sock, rbuf, sizeof(rbuf), 2, true);
+        ring.linkTimeout(INFLUX_TIMEOUT_MS, 3);
+        if (ring.submit(3) < 0) return false;
+        int sendRes = -1, recvRes = -1;
+        uint64_t tag;
+        int res;
+        while (ring.complete(tag, res)) {
+            if (tag == 1) sendRes = res;
+            else if (tag == 2) recvRes = res;
         }
+        if (sendRes < 0) return false;
+        sent = (size_t)sendRes;
+        if (recvRes > 0) resp.append(rbuf, recvRes);
+        if (sent == total && (recvRes == 0 || recvRes == -ECANCELED)) return true;  // closed or timed out without a response
+    } else {
+        ssize_t r = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (r < 0 && errno != EINTR) return false;
+        sent = r > 0 ? (size_t)r : 0;
+    }
 
-        // set a short receive timeout so we don't block forever
-        struct timeval tv;
-        tv.tv_sec = 2; tv.tv_usec = 0;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    // plain system calls: what is left of the request (short send), then the response
+    for (int i = 0; i < 2; ++i) {
+        size_t skip = std::min(sent, iov[i].iov_len);
+        sent -= skip;
+        if (!sendAll(sock, (const char*)iov[i].iov_base + skip, iov[i].iov_len - skip)) return false;
+    }
+    int64_t deadline = monotonicMs() + INFLUX_TIMEOUT_MS;
+    while (resp.find("\r\n") == std::string::npos) {
+        int64_t remaining = deadline - monotonicMs();
+        if (remaining <= 0) break;
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)remaining) <= 0) break;
+        ssize_t r = recv(sock, rbuf, sizeof(rbuf), 0);
+        if (r <= 0) break;
+        resp.append(rbuf, r);
+    }
+    return true;
+}
 
-        // read response (headers and optional body) into a buffer
-        std::string resp;
-        char rbuf[1024];
-        while (true) {
-            ssize_t r = recv(sock, rbuf, sizeof(rbuf), 0);
-            if (r > 0) resp.append(rbuf, r);
-            else break;
-        }
+// send a line to InfluxDB using HTTP POST to /write?db=<influx.db>
+// httpStatus (optional) receives the HTTP status code, 0 if no response was received
+static bool postInfluxLine(const std::string &line, int *httpStatus) {
+    if (httpStatus) *httpStatus = 0;
+    // Build HTTP request
+    std::shared_ptr<const RuntimeConfig> cfg = runtimeConfig();
+    char headers[512];
+    int hlen = snprintf(headers, sizeof(headers), "POST /write?db=%s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+             cfg->influxDb.c_str(), cfg->influxServer.c_str(), cfg->influxPort, line.size());
+    if (hlen < 0 || hlen >= (int)sizeof(headers)) return false;
+
+    int sock = influxEndpoint.connect();
+    if (sock < 0) return false;
+
+    // send headers and body, read the response up to its status line
+    std::string resp;
+    bool ok = influxExchange(sock, headers, hlen, line, resp);
+    if (ok) {
 
         // parse status code from response start: "HTTP/1.1 204 ..."
         if (!resp.empty()) {
@@ -198,39 +374,140 @@ static bool sendInfluxLine(const char* host, int port, const std::string &line)
                 std::string code = (sp2 == std::string::npos) ? statusLine.substr(sp1 + 1) : statusLine.substr(sp1 + 1, sp2 - sp1 - 1);
                 status = atoi(code.c_str());
             }
+            if (httpStatus) *httpStatus = status;
             if (status == 204) {
                 // success
                 close(sock);
-                freeaddrinfo(res);
                 return true;
             } else {
                 // log response for debugging
-                LOG("Influx HTTP error: %d response=%s", status, resp.c_str());
+                LOG_ERROR("Influx HTTP error: %d response=%s", status, resp.c_str());
                 ok = false;
             }
         } else {
             // no response
-            LOG("Influx: no HTTP response received");
+            LOG_WARN("Influx: no HTTP response received");
+            influxEndpoint.fail();
             ok = false;
         }
+    } else {
+        LOG_ERROR("Influx: sending request failed");
+        influxEndpoint.fail();
     }
     close(sock);
-    freeaddrinfo(res);
     return ok;
 }
 
+// postInfluxLine() with its duration and result in the stats
+static bool sendInfluxLine(const std::string &line, int *httpStatus = nullptr) {
+    uint64_t t0 = perfNowUs();
+    bool ok = postInfluxLine(line, httpStatus);
+    perfStats.influxWrite.record(perfNowUs() - t0);
+    ++perfStats.influxWrites;
+    if (!ok) ++perfStats.influxFailures;
+    return ok;
+}
+
+// Hand line(s) to Influx, or to the spill log while Influx is unavailable.
+// Returns false if the line was spilled or dropped; *dropped tells which
+// (rejected with a 4xx, or the spill log failed).
+static bool writeInflux(const std::string &line, bool* dropped = nullptr) {
+    if (dropped) *dropped = false;
+    if (influxBreaker.isClosed() && influxSpill.empty()) {
+        int status = 0;
+        bool ok = false;
+        try {
+            ok = sendInfluxLine(line, &status);
+        } catch (...) {
+            LOG_ERROR("Influx publish exception");
+        }
+        if (ok || (status >= 400 && status < 500)) {
+            // server is up; a 4xx means the data was rejected, retrying won't help
+            influxBreaker.success();
+            if (dropped) *dropped = !ok;
+            return ok;
+        }
+        influxBreaker.failure();
+        if (!influxBreaker.isClosed()) {
+            LOG_WARN("Influx unavailable, spilling lines to %s", INFLUX_SPILL_FILE);
+        }
+    }
+    if (!influxSpill.append(line)) {
+        LOG_ERROR("Influx spill failed, line dropped");
+        if (dropped) *dropped = true;
+    }
+    return false;
+}
+
+// Replay spilled Influx lines in large batches at a limited rate once Influx is reachable again.
+// Also the only place that probes Influx while the circuit is open.
+static void influxReplayThread() {
+    std::string batch;
+    batch.reserve(INFLUX_REPLAY_BATCH_BYTES);
+    while (running) {
+        if (!influxSpill.empty() && influxBreaker.allow()) {
+            uint64_t firstSeq = 0;
+            size_t n = influxSpill.peek(batch, INFLUX_REPLAY_BATCH_BYTES, firstSeq);
+            int status = 0;
+            bool ok = false;
+            try {
+                ok = sendInfluxLine(batch, &status);
+            } catch (...) {
+                LOG_ERROR("Influx replay exception");
+            }
+            if (ok || (status >= 400 && status < 500)) {
+                if (!ok) LOG_WARN("Influx rejected %zu spilled lines (HTTP %d), dropping them", n, status);
+                influxSpill.consume(firstSeq, n);
+                influxBreaker.success();
+                size_t left = influxSpill.records();
+                LOG("Replayed %zu spilled lines, %zu left (%llu dropped on overflow)", n, left, (unsigned long long)influxSpill.dropped());
+            } else {
+                influxBreaker.failure();
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(INFLUX_REPLAY_INTERVAL_MS));
+    }
+}
+
+// true for the integer register types (numeric, no fraction)
+static bool isIntegerType(const char* type) {
+    static const char* const types[] = { "U16", "S16", "U32", "S32", "E16", "B16" };
+    if (!type) return false;
+    for (const char* t : types) {
+        if (strcmp(type, t) == 0) return true;
+    }
+    return false;
+}
+
+// Influx measurement suffix for the compact schema: lower case register type, "raw" if unknown
+static const char* influxTypeGroup(const RegisterInfo* ri, char* buf, size_t size) {
+    if (!ri || !ri->type || !ri->type[0]) return "raw";
+    size_t i = 0;
+    for (; ri->type[i] && i + 1 < size; ++i) buf[i] = (char)tolower((unsigned char)ri->type[i]);
+    buf[i] = '\0';
+    return buf;
+}
+
 // Publish to MQTT and Influx only on change or first publish.
-static void publishToMqttAndInfluxOnChange(const char* topic, const char* payload, size_t payload_len, uint8_t unitId, uint16_t addr) {
+// ri: register definition if known; unscaled integer registers are written as Influx integer fields
+static void publishToMqttAndInfluxOnChange(const char* topic, const char* payload, size_t payload_len, uint8_t unitId, uint16_t addr, const RegisterInfo* ri = nullptr) {
     uint32_t key = ((uint32_t)unitId << 16) | addr;
+    bool intValue = ri && ri->gain == 1.0f && isIntegerType(ri->type);
     std::string payloadStr(payload, payload_len);
-    auto now = std::chrono::system_clock::now();
-    
+    auto now = responseTime();
+
+    // Determine if payload is numeric
+    char *endptr = nullptr;
+    double num = strtod(payloadStr.c_str(), &endptr);
+    bool isNum = (endptr && *endptr == '\0');
+    bool track = false;
+    bool changed = false;
+    int64_t changedNs = 0;
+
     {
-        std::lock_guard<std::mutex> lock(registerValuesMutex);
         auto it = registerValues.find(key);
         
         // Check if value has changed
-        bool changed = false;
         if (it == registerValues.end()) {
             // First time seeing this register - just store it, don't mark as changed yet
             registerValues[key] = {payloadStr, "", now, false, false};
@@ -251,190 +528,371 @@ static void publishToMqttAndInfluxOnChange(const char* topic, const char* payloa
             size_t size = changedAddresses.size();
             changedAddresses.insert(key);
             if (changedAddresses.size() != size) {
-                // New entry added, save to file
+                // New entry added, save to file and let the poller prioritize its range
                 saveChangedAddresses();
+                if (uint32_t* slot = changedKeyQueue.claim()) {
+                    *slot = key;
+                    changedKeyQueue.publish();
+                }
             }
         }
         
-        // Only publish if changed
-        if (changed) {
-            // MQTT publish
-            try {
-                if (mqttClient && mqttClient->is_connected()) {
-                    mqttClient->publish(topic, payload, payload_len);
-                }
-            } catch (const mqtt::exception &e) {
-                LOG("MQTT publish failed: %s", e.what());
-            }
+        // Keep history only for registers known to move
+        const RegisterValue& value = registerValues[key];
+        track = isNum && value.hasChanged;
+        if (value.hasChanged) changedNs = toNanos(value.lastChangeTime);
+        registerValuesDirty |= changed || it == registerValues.end();
+    }
+    registerShmValue(unitId, addr, isNum, num, payload, payload_len, toNanos(now), changedNs);
+
+    // Only publish if changed: hand the value to the MQTT and Influx sink threads
+    if (changed) {
+        MqttRecord* m = claimWait(mqttQueue);
+        snprintf(m->topic, sizeof(m->topic), "%s", topic);
+        m->payloadLen = (uint16_t)std::min(payload_len, sizeof(m->payload));
+        memcpy(m->payload, payload, m->payloadLen);
+        m->traceId = 0;
+        if (traceEnabled()) {
+            m->traceId = traceFlowId();
+            traceFlowStart("change.mqtt", m->traceId);
+        }
+        mqttQueue.publish();
+
+        InfluxRecord* r = claimWait(influxQueue);
+        r->tNs = toNanos(now);
+        r->num = num;
+        r->addr = addr;
+        r->unitId = unitId;
+        r->kind = !isNum ? InfluxRecord::TEXT : intValue ? InfluxRecord::INT : InfluxRecord::FLOAT;
+        r->compact = pollConfig->influxCompact;
+        char group[16];
+        snprintf(r->group, sizeof(r->group), "%s", influxTypeGroup(ri, group, sizeof(group)));
+        const char* lastTopic = strrchr(topic, '/');
+        snprintf(r->name, sizeof(r->name), "%s", lastTopic ? lastTopic + 1 : topic);
+        r->textLen = (uint16_t)std::min(payload_len, sizeof(r->text));
+        memcpy(r->text, payload, r->textLen);
+        r->traceId = 0;
+        if (traceEnabled()) {
+            r->traceId = traceFlowId();
+            traceFlowStart("change.influx", r->traceId);
+        }
+        influxQueue.publish();
+
+        LOG_DEBUG("Published change: %s -> %s", topic, payload);
+    }
+
+    if (track) {
+        int64_t t_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+        registerHistory.append(key, t_ms, num);
+        registerArchive.append(key, t_ms, num);
+    }
+}
 
-            // Build Influx line
-            std::string topicStr(topic);
-            size_t p = topicStr.find_last_of('/');
-            std::string lastTopic = (p == std::string::npos) ? topicStr : topicStr.substr(p+1);
-            std::string measurement = influxMeasurement.empty() ? std::string(MQTT_TOPIC_PREFIX) : influxMeasurement;
-
-            // Determine if payload is numeric
-            char *endptr = nullptr;
-            double num = strtod(payloadStr.c_str(), &endptr);
-            bool isNum = (endptr && *endptr == '\0');
-
-            std::string line;
-            line.reserve(128 + payload_len);
-            line += measurement;
-            line += ",unit=" + std::to_string(unitId);
-            line += ",addr=" + std::to_string(addr);
-            line += ",name=" + escapeInfluxTag(lastTopic);
-            line += ' ';
-            if (isNum) {
-                char numbuf[64]; snprintf(numbuf, sizeof(numbuf), "%.6g", num);
-                line += std::string("value=") + numbuf;
+// Encode one change as an Influx line: compact schema (measurement per register
+// type, field per address) or one series per register
+static void encodeInfluxRecord(InfluxLineWriter& line, const InfluxRecord& r) {
+    // NaN and Inf parse as numbers but have no line protocol representation
+    if (r.kind != InfluxRecord::TEXT && !std::isfinite(r.num)) return;
+    const char* measurement = influxMeasurement.c_str();
+    if (r.compact) {
+        // few series: one measurement per register type, field per address
+        char meas[128], field[8];
+        snprintf(meas, sizeof(meas), "%s_%s", measurement, r.kind == InfluxRecord::TEXT ? "text" : r.group);
+        snprintf(field, sizeof(field), "a%u", r.addr);
+        line.measurement(meas).tag("unit", r.unitId);
+        if (r.kind == InfluxRecord::INT) {
+            line.fieldInt(field, (int64_t)r.num);
+        } else if (r.kind == InfluxRecord::FLOAT) {
+            line.field(field, r.num);
+        } else {
+            line.fieldString(field, r.text, r.textLen);
+        }
+    } else {
+        // one series per register: float "value", integer "ivalue" or string "text" field
+        line.measurement(measurement)
+            .tag("unit", r.unitId)
+            .tag("addr", r.addr)
+            .tag("name", r.name);
+        if (r.kind == InfluxRecord::INT) {
+            line.fieldInt("ivalue", (int64_t)r.num);
+        } else if (r.kind == InfluxRecord::FLOAT) {
+            line.field("value", r.num);
+        } else {
+            line.fieldString("text", r.text, r.textLen);
+        }
+    }
+    line.end(r.tNs);
+}
+
+// MQTT sink stage: publish queued changes
+static void mqttSinkThread() {
+    pipelineThreadSetup("mqtt-sink", PIPELINE_CPU_MQTT);
+    IdleBackoff idle(PIPELINE_IDLE_MAX_US);
+    for (;;) {
+        MqttRecord* m = mqttQueue.peek();
+        if (!m) {
+            if (sinkStop) break;
+            idle.wait();
+            continue;
+        }
+        idle.reset();
+        try {
+            if (mqttClient && mqttClient->is_connected()) {
+                TRACE_SCOPE("mqtt.publish");
+                uint64_t t0 = perfNowUs();
+                mqttClient->publish(m->topic, m->payload, m->payloadLen);
+                perfStats.mqttPublish.record(perfNowUs() - t0);
+                ++perfStats.mqttPublished;
+                if (m->traceId) traceFlowEnd("change.mqtt", m->traceId);
             } else {
-                line += "text=\"" + escapeInfluxFieldString(payloadStr) + "\"";
+                ++perfStats.mqttFailures;
             }
-            line += '\n';
+        } catch (const mqtt::exception &e) {
+            ++perfStats.mqttFailures;
+            LOG_ERROR("MQTT publish failed: %s", e.what());
+        }
+        mqttQueue.pop();
+    }
+}
 
-            try {
-                if (!sendInfluxLine(INFLUX_SERVER, INFLUX_PORT, line)) {
-                    LOG("Influx publish failed for %s", topic);
+// Influx sink stage: encode all queued changes (up to INFLUX_BATCH_LINES) into
+// one write, so a burst of changes costs one HTTP request
+static void influxSinkThread() {
+    pipelineThreadSetup("influx-sink", PIPELINE_CPU_INFLUX);
+    IdleBackoff idle(PIPELINE_IDLE_MAX_US);
+    InfluxLineWriter lines(64 * 1024);
+    for (;;) {
+        lines.clear();
+        size_t n = 0;
+        while (n < INFLUX_BATCH_LINES) {
+            const InfluxRecord* r = influxQueue.peek(n);
+            if (!r) break;
+            encodeInfluxRecord(lines, *r);
+            ++n;
+        }
+        if (n == 0) {
+            if (sinkStop) break;
+            idle.wait();
+            continue;
+        }
+        idle.reset();
+        {
+            TRACE_SCOPE("influx.write", n);
+            bool dropped = false;
+            if (lines.empty() || writeInflux(lines.str(), &dropped)) {
+                for (size_t i = 0; i < n; ++i) {
+                    const InfluxRecord* r = influxQueue.peek(i);
+                    if (r->traceId) traceFlowEnd("change.influx", r->traceId);
                 }
-            } catch (...) {
-                LOG("Influx publish exception for %s", topic);
+            } else {
+                LOG_WARN("Influx write of %zu changes %s", n, dropped ? "dropped" : "deferred");
             }
+        }
+        influxQueue.pop(n);
+    }
+}
 
-            LOG("Published change: %s -> %s", topic, payload);
+// Register name for an exact address from the register table, nullptr if none
+static const char* registerNameForAddr(uint16_t addr) {
+    int idx = aiswei_find_register_index(addr);
+    if (idx < 0 || aiswei_registers[idx].addr != addr) return nullptr;
+    const char* name = aiswei_registers[idx].name;
+    return (name && name[0]) ? name : nullptr;
+}
+
+// Publish a retained CBOR map address -> name for all addresses seen in summaries,
+// so the compact summary only needs to carry addresses and values. False if it
+// was not published (MQTT down or the publish failed)
+static bool publishSummaryDictionary(const std::set<uint16_t>& addrs) {
+    static CborWriter dict(16 * 1024);
+    dict.clear();
+    dict.beginMap();
+    for (uint16_t addr : addrs) {
+        const char* name = registerNameForAddr(addr);
+        dict.uint(addr);
+        if (name) dict.text(name); else dict.null();
+    }
+    dict.end();
+
+    std::string dictTopic = std::string(mqttPrefix) + "/summary/dict";
+    try {
+        if (mqttClient && mqttClient->is_connected()) {
+            mqttClient->publish(dictTopic, dict.data(), dict.size(), 1, true);
+            LOG_DEBUG("Published summary dictionary to %s with %zu names", dictTopic.c_str(), addrs.size());
+            return true;
         }
+    } catch (const mqtt::exception &e) {
+        LOG_ERROR("MQTT dictionary publish failed: %s", e.what());
     }
+    return false;
 }
 
-// Publish summary every minute to MQTT (JSON) and Influx
-static void publishSummary() {
-    std::lock_guard<std::mutex> lock(registerValuesMutex);
-    
-    if (registerValues.empty()) {
-        LOG("No values to summarize");
+// Make sure w has an open summary line for unitId with room for estimate more bytes,
+// ending the current line and starting a continuation line (same point) if needed
+static void summaryLine(InfluxLineWriter& w, const char* measurement, unsigned unitId, int64_t ts, size_t estimate) {
+    if (w.lineSize() > 0 && w.lineSize() + estimate > INFLUX_MAX_LINE_BYTES) w.end(ts);
+    if (w.lineSize() == 0) w.measurement(measurement).tag("unit", unitId);
+}
+
+// Publish a summary of a register snapshot to MQTT (JSON and optionally CBOR) and Influx
+static void publishSummary(const RegisterSnapshot& snap) {
+    // encoders keep their buffers between sweeps
+    static JsonWriter summary(64 * 1024);
+    static InfluxLineWriter influxLines(64 * 1024);
+    static InfluxLineWriter influxText(16 * 1024);  // string fields in compact schema
+    static CborWriter compact(16 * 1024);
+    static std::set<uint16_t> dictionaryAddrs;  // addresses already in the retained dictionary
+    static uint64_t dictionaryGeneration = 0;   // config the dictionary was published with
+    static bool dictionaryDirty = false;        // retained dictionary lacks addresses (retried until published)
+    const bool cbor = snap.config->summaryCbor;
+    const bool compactSchema = snap.config->influxCompact;
+    // republish the retained dictionary after a config reload (prefix or broker may have changed)
+    if (dictionaryGeneration != snap.config->generation) dictionaryDirty = true;
+    dictionaryGeneration = snap.config->generation;
+
+    if (snap.registers.empty()) {
+        LOG_DEBUG("No values to summarize");
         return;
     }
 
-    // Build JSON summary for MQTT with hierarchy: unit -> address -> name/value/timestamp
-    json summary = json::object();
-    std::map<uint8_t, json> influxFields;  // unitId -> field map
+    // Stream JSON summary for MQTT with hierarchy: unit -> address -> name/value/timestamp
+    // and size-bounded Influx summary lines per unit. The snapshot is ordered by (unit, address),
+    // so both come out sorted and each unit is a contiguous run.
+    summary.clear();
+    influxLines.clear();
+    influxText.clear();
+    summary.beginObject();
+    int currentUnit = -1;
+    size_t units = 0;
+    int64_t nowNs = toNanos(snap.time);
+
+    // Compact summary: {"t": ms, "u": {unit: [[addr, value, changed_ms], ...]}}
+    compact.clear();
+    if (cbor) {
+        compact.beginMap().text("t").integer(nowNs / 1000000).text("u").beginMap();
+    }
 
-    for (const auto& [key, value] : registerValues) {
+    for (const RegisterState& value : snap.registers) {
         // Only include registers that have changed (from current session or persistent list)
         if (!value.hasChanged) continue;
 
+        uint32_t key = value.key;
         uint8_t unitId = (key >> 16) & 0xFF;
         uint16_t addr = key & 0xFFFF;
 
-        // Ensure unit exists in summary
-        if (summary.find(std::to_string(unitId)) == summary.end()) {
-            summary[std::to_string(unitId)] = json::object();
-        }
-
-        // Ensure address exists under unit
-        std::string addrStr = std::to_string(addr);
-        if (summary[std::to_string(unitId)].find(addrStr) == summary[std::to_string(unitId)].end()) {
-            summary[std::to_string(unitId)][addrStr] = json::object();
+        if (unitId != currentUnit) {
+            if (currentUnit >= 0) {
+                summary.endObject();
+                if (cbor) compact.end();
+            }
+            if (influxLines.lineSize()) influxLines.end(nowNs);
+            if (influxText.lineSize()) influxText.end(nowNs);
+            summary.key(unitId).beginObject();
+            if (cbor) compact.uint(unitId).beginArray();
+            currentUnit = unitId;
+            ++units;
         }
 
         // Find register name for this address
-        std::string registerName = addrStr;  // fallback to address
-        for (size_t i = 0; i < aiswei_registers_count; ++i) {
-            if (aiswei_registers[i].addr == addr) {
-                if (aiswei_registers[i].name && aiswei_registers[i].name[0]) {
-                    registerName = aiswei_registers[i].name;
-                }
-                break;
-            }
+        const char* registerName = registerNameForAddr(addr);
+
+        // Add register data: name (fallback to address), value, and ISO 8601 timestamp
+        char changed[40];
+        size_t changedLen = formatISO8601(value.lastChangeTime, changed, sizeof(changed));
+        summary.key(addr).beginObject();
+        summary.key("name");
+        if (registerName) {
+            summary.value(registerName);
+        } else {
+            char addrStr[8];
+            summary.value(addrStr, snprintf(addrStr, sizeof(addrStr), "%u", addr));
         }
-
-        // Add register data: name, value, and ISO 8601 timestamp
-        summary[std::to_string(unitId)][addrStr]["name"] = registerName;
-        summary[std::to_string(unitId)][addrStr]["value"] = value.payload;
-        summary[std::to_string(unitId)][addrStr]["changed"] = formatISO8601(value.lastChangeTime);
+        summary.key("value").value(value.payload);
+        summary.key("changed").value(changed, changedLen);
+        summary.endObject();
 
         // Determine if numeric for Influx
         char *endptr = nullptr;
         double num = strtod(value.payload.c_str(), &endptr);
         bool isNum = (endptr && *endptr == '\0');
 
-        // Build field name: addr_<address> or addr_<address>_<payload_slug>
-        std::string fieldName = "addr_" + std::to_string(addr);
-        if (!isNum) {
-            // For non-numeric, append slug from payload
-            std::string slug = value.payload;
-            // Remove/replace non-alphanumeric
-            for (auto& c : slug) {
-                if (!isalnum(c)) c = '_';
-            }
-            fieldName += "_" + slug;
+        if (cbor) {
+            compact.array(3).uint(addr);
+            if (isNum) compact.number(num); else compact.text(value.payload);
+            compact.integer(std::chrono::duration_cast<std::chrono::milliseconds>(value.lastChangeTime.time_since_epoch()).count());
+            if (dictionaryAddrs.insert(addr).second) dictionaryDirty = true;
         }
 
-        // Add to Influx field map
-        if (influxFields.find(unitId) == influxFields.end()) {
-            influxFields[unitId] = json::object();
-        }
-        
-        if (isNum) {
-            influxFields[unitId][fieldName] = num;
+        // Build field name: a<address> (compact schema), addr_<address> or addr_<address>_<payload_slug>
+        char fieldName[160];
+        size_t fl = snprintf(fieldName, sizeof(fieldName), compactSchema ? "a%u" : "addr_%u", addr);
+        if (isNum && !std::isfinite(num)) {
+            // NaN/Inf: no line protocol representation, the field is left out
+        } else if (isNum) {
+            summaryLine(influxLines, "summary", unitId, nowNs, fl + 32);
+            influxLines.field(fieldName, num);
+        } else if (compactSchema) {
+            // strings go to their own measurement, keyed by address only
+            summaryLine(influxText, "summary_text", unitId, nowNs, fl + 2 * value.payload.size() + 4);
+            influxText.fieldString(fieldName, value.payload);
         } else {
-            influxFields[unitId][fieldName] = value.payload;
+            // For non-numeric, append slug from payload
+            fieldName[fl++] = '_';
+            for (size_t i = 0; i < value.payload.size() && fl + 1 < sizeof(fieldName); ++i) {
+                char c = value.payload[i];
+                fieldName[fl++] = isalnum((unsigned char)c) ? c : '_';
+            }
+            fieldName[fl] = '\0';
+            summaryLine(influxLines, "summary", unitId, nowNs, fl + 2 * value.payload.size() + 4);
+            influxLines.fieldString(fieldName, value.payload);
         }
     }
 
     // Only publish if there are changed values
-    if (summary.empty()) {
-        LOG("No changed values to summarize");
+    if (currentUnit < 0) {
+        LOG_DEBUG("No changed values to summarize");
         return;
     }
+    summary.endObject();
+    summary.endObject();
+    if (influxLines.lineSize()) influxLines.end(nowNs);
+    if (influxText.lineSize()) influxText.end(nowNs);
+    if (cbor) compact.end().end().end();
 
     // Publish MQTT summary
-    std::string summaryJson = summary.dump();
     std::string summaryTopic = std::string(mqttPrefix) + "/summary";
     try {
         if (mqttClient && mqttClient->is_connected()) {
-            mqttClient->publish(summaryTopic, summaryJson.c_str(), summaryJson.size());
-            LOG("Published MQTT summary to %s with %zu units", summaryTopic.c_str(), summary.size());
+            mqttClient->publish(summaryTopic, summary.data(), summary.size());
+            LOG_DEBUG("Published MQTT summary to %s with %zu units", summaryTopic.c_str(), units);
         }
     } catch (const mqtt::exception &e) {
-        LOG("MQTT summary publish failed: %s", e.what());
+        LOG_ERROR("MQTT summary publish failed: %s", e.what());
     }
 
-    // Publish Influx summary (one data point per unitId)
-    for (const auto& [unitId, fields] : influxFields) {
-        std::string line = "summary,unit=" + std::to_string(unitId);
-        
-        bool first = true;
-        for (const auto& [fieldName, fieldValue] : fields.items()) {
-            if (first) {
-                line += " ";
-            } 
-            else {
-                line += ",";
-            }
-            line += escapeInfluxTag(fieldName) + "=";
-            
-            if (fieldValue.is_number()) {
-                char numbuf[64];
-                snprintf(numbuf, sizeof(numbuf), "%.6g", (double)fieldValue);
-                line += numbuf;
-            } else {
-                line += "\"" + escapeInfluxFieldString(fieldValue.get<std::string>()) + "\"";
-            }
-            first = false;
-        }
-        line += '\n';
-
+    // Publish compact summary (dictionary first, so subscribers can resolve new addresses)
+    if (cbor) {
+        if (dictionaryDirty && publishSummaryDictionary(dictionaryAddrs)) dictionaryDirty = false;
+        std::string compactTopic = summaryTopic + "/cbor";
         try {
-            if (!sendInfluxLine(INFLUX_SERVER, INFLUX_PORT, line)) {
-                LOG("Influx summary publish failed for unit %d", unitId);
-            } else {
-                LOG("Published Influx summary for unit %d with %zu fields", unitId, fields.size());
+            if (mqttClient && mqttClient->is_connected()) {
+                mqttClient->publish(compactTopic, compact.data(), compact.size());
+                LOG_DEBUG("Published CBOR summary to %s (%zu bytes, JSON %zu bytes)", compactTopic.c_str(), compact.size(), summary.size());
             }
-        } catch (...) {
-            LOG("Influx summary publish exception for unit %d", unitId);
+        } catch (const mqtt::exception &e) {
+            LOG_ERROR("MQTT CBOR summary publish failed: %s", e.what());
         }
     }
+
+    // Publish Influx summary (one data point per unitId, possibly split over several lines)
+    bool dropped = false, textDropped = false;
+    bool ok = influxLines.empty() || writeInflux(influxLines.str(), &dropped);
+    if (!influxText.empty() && !writeInflux(influxText.str(), &textDropped)) ok = false;
+    if (!ok) {
+        LOG_WARN("Influx summary publish %s for %zu units", dropped || textDropped ? "dropped" : "deferred", units);
+    } else {
+        LOG_DEBUG("Published Influx summary for %zu units (%zu bytes)", units, influxLines.size() + influxText.size());
+    }
 }
 
 // translate AISWEI warning codes to descriptive strings
@@ -542,16 +1000,11 @@ const char* gridCodeToString(uint16_t code) {
 }
 
 // helper: decode a single Modbus response and publish a human friendly payload to MQTT
-void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t length) {
+static void decodeAndPublish(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t length) {
+    TRACE_SCOPE("decodeAndPublish", addr);
     // find matching register definition by comparing register offsets
-    const RegisterInfo* ri = nullptr;
-    for (size_t i = 0; i < aiswei_registers_count; ++i) {
-        const RegisterInfo &r = aiswei_registers[i];
-        if (addr >= r.addr && addr < r.addr + r.length) {
-            ri = &r;
-            break;
-        }
-    }
+    int ridx = aiswei_find_register_index(addr);
+    const RegisterInfo* ri = ridx >= 0 ? &aiswei_registers[ridx] : nullptr;
 
     // build topic using human readable slug derived from register name when available
     char topic[128];
@@ -645,7 +1098,7 @@ void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t lengt
         }
         payload[pos] = '\0';
         if (payload[0] == '\0') strncpy(payload, "<empty>", sizeof(payload));
-        publishToMqttAndInfluxOnChange(topic, payload, pos, unitId, addr);
+        publishToMqttAndInfluxOnChange(topic, payload, pos, unitId, addr, ri);
         // LOG("0x%02x %s -> %s (%s)", unitId, ri->name, payload, type);
         return;
     }
@@ -678,7 +1131,7 @@ void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t lengt
                 snprintf(payload, sizeof(payload), "0x%04x", raw);
             }
         }
-        publishToMqttAndInfluxOnChange(topic, payload, strlen(payload), unitId, addr);
+        publishToMqttAndInfluxOnChange(topic, payload, strlen(payload), unitId, addr, ri);
         // LOG("0x%02x %s -> %s (%s)", unitId, ri->name, payload, type);
         return;
     }
@@ -695,7 +1148,7 @@ void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t lengt
                 fmt_with_gain(raw);
             }
         }
-        publishToMqttAndInfluxOnChange(topic, payload, strlen(payload), unitId, addr);
+        publishToMqttAndInfluxOnChange(topic, payload, strlen(payload), unitId, addr, ri);
         // LOG("0x%02x %s -> %s (%s)", unitId, ri->name, payload, type);
         return;
     }
@@ -707,36 +1160,543 @@ void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t lengt
             pos += snprintf(payload + pos, sizeof(payload) - pos, "%02x", data[i]);
         }
         payload[pos] = '\0';
-        publishToMqttAndInfluxOnChange(topic, payload, pos, unitId, addr);
+        publishToMqttAndInfluxOnChange(topic, payload, pos, unitId, addr, ri);
         // LOG("0x%02x %s -> %s (hex)", unitId, ri->name, payload);
     }
 }
 
+// Sink of the Modbus client (decode stage): a response identical to the last
+// one for its request changes nothing. Otherwise the returned words are diffed
+// against the previous sweep, and only registers with a changed word are
+// decoded and published
+class GatewaySink : public ModbusSink {
+public:
+    bool responseWords(uint8_t unitId, uint16_t startAddr, const uint8_t* data, size_t words,
+                       int64_t rxNs, uint64_t changed[2]) override {
+        TRACE_SCOPE("image.diff", startAddr);
+        registerShmWords(unitId, startAddr, data, words, rxNs);
+        if (registerImageSame(unitId, startAddr, data, words, rxNs)) return false;
+        return registerImageDiff(unitId, startAddr, data, words, changed) != 0;
+    }
+
+    void registerValue(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t length) override {
+        decodeAndPublish(unitId, addr, data, length);
+    }
+};
+
+static GatewaySink gatewaySink;
+
+// The poller's copy of changedAddresses (owned by the decode stage), fed by changedKeyQueue
+static std::set<uint32_t> polledChangedAddresses;
+
 // Helper function to check if a range contains any changed addresses
 static bool rangeContainsChangedAddress(unsigned startIdx, unsigned k) {
+    while (const uint32_t* key = changedKeyQueue.peek()) {
+        polledChangedAddresses.insert(*key);
+        changedKeyQueue.pop();
+    }
     for (unsigned i = 0; i < k; ++i) {
         unsigned idx = (startIdx + i) % aiswei_registers_count;
         uint16_t addr = aiswei_registers[idx].addr;
-        uint32_t key = ((uint32_t)MODBUS_UNIT_ID << 16) | addr;
-        if (changedAddresses.find(key) != changedAddresses.end()) {
+        uint32_t key = ((uint32_t)pollConfig->unitId << 16) | addr;
+        if (polledChangedAddresses.find(key) != polledChangedAddresses.end()) {
             return true;
         }
     }
     return false;
 }
 
-// Modbus polling thread
+// Whether registers of a poll class are read in the given sweep
+static bool pollDue(uint8_t poll, unsigned sweep) {
+    switch (poll) {
+        case REG_POLL_SLOW: return sweep % pollConfig->slowPollSweeps == 0;
+        case REG_POLL_ONCE: return sweep == 0;
+        case REG_POLL_OFF: return false;
+        default: return true;
+    }
+}
+
+// (Re)connect the MQTT client to the configured broker and subscribe to <prefix>/cmd
+static void connectMqtt(const RuntimeConfig& cfg) {
+    if (mqttClient) {
+        try {
+            if (mqttClient->is_connected()) mqttClient->disconnect();
+        } catch (...) {}
+        delete mqttClient;
+        mqttClient = nullptr;
+    }
+    try {
+        auto opts = mqtt::connect_options_builder()
+                        .keep_alive_interval(std::chrono::seconds(60))
+                        .clean_session(false)
+                        .automatic_reconnect(true)
+                        .finalize();
+
+        mqttClient = new mqtt::client(
+            std::string("tcp://") + cfg.mqttServer + ":" + std::to_string(cfg.mqttPort), cfg.mqttPrefix
+        );
+        mqttClient->start_consuming();
+
+        LOG("Connecting to MQTT %s:%d", cfg.mqttServer.c_str(), cfg.mqttPort);
+        mqttClient->connect(opts);
+        mqttClient->subscribe(cfg.mqttPrefix + "/cmd", 1);
+        LOG("MQTT connected for topics %s/#", cfg.mqttPrefix.c_str());
+
+    } catch (const mqtt::exception& exc) {
+        LOG_ERROR("MQTT connection failed: %s", exc.what());
+    }
+}
+
+// Write the recorded trace events to TRACE_FILE
+static void writeTraceFile() {
+    std::string json;
+    traceDump(json);
+    std::ofstream f(TRACE_FILE, std::ios::trunc);
+    f << json;
+    if (f) LOG("Trace written to %s (%zu bytes)", TRACE_FILE, json.size());
+    else LOG_ERROR("Cannot write trace to %s", TRACE_FILE);
+}
+
+// Commands published on <prefix>/cmd: "reload" rereads the config file,
+// "trace on|off" starts/stops the tracer, "trace dump" writes TRACE_FILE
+static void pollMqttCommands() {
+    if (!mqttClient) return;
+    mqtt::const_message_ptr msg;
+    while (mqttClient->try_consume_message(&msg)) {
+        if (!msg) continue;
+        std::string command = msg->to_string();
+        if (command == "reload") {
+            reloadRequested = true;
+        } else if (command == "trace on" || command == "trace off") {
+            traceSetEnabled(command == "trace on");
+            LOG("Tracing %s", traceEnabled() ? "on" : "off");
+        } else if (command == "trace dump") {
+            traceDumpRequested = true;
+        } else {
+            LOG_WARN("Unknown command '%s' on %s", command.c_str(), msg->get_topic().c_str());
+        }
+    }
+}
+
+static void onSighup(int) {
+    reloadRequested = true;
+}
+
+// Stop polling and shut down cleanly (writes the open history blocks)
+static void onTerminate(int) {
+    running = false;
+}
+
+// Write history blocks older than HISTORY_FLUSH_MS (decode stage, end of a sweep)
+static void maintainHistory() {
+    if (!registerArchive.isOpen()) return;
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    registerArchive.flush(now, HISTORY_FLUSH_MS);
+}
+
+// Slow file work off the pipeline threads: compact the history file once at
+// startup and then every HISTORY_COMPACT_INTERVAL_MS (the rewrite and its fsync
+// take a while on a large file), and write TRACE_FILE when a dump is requested
+static void maintenanceThread() {
+    pipelineThreadSetup("maintenance", -1);
+    int64_t lastCompactMs = 0;
+    while (running) {
+        if (traceDumpRequested.exchange(false)) writeTraceFile();
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (registerArchive.isOpen() && (lastCompactMs == 0 || now - lastCompactMs >= HISTORY_COMPACT_INTERVAL_MS)) {
+            lastCompactMs = now;
+            registerArchive.compact(now - (int64_t)HISTORY_RETENTION_DAYS * 24 * 3600 * 1000);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    }
+}
+
+// Print the stored history of a register as CSV (ISO time, value)
+static int dumpHistory(uint16_t addr) {
+    if (!registerArchive.open(HISTORY_FILE)) return 1;
+    uint32_t key = ((uint32_t)pollConfig->unitId << 16) | addr;
+    std::vector<HistoryStore::Sample> samples(registerArchive.samples() + 1);
+    size_t n = registerArchive.query(key, INT64_MIN, INT64_MAX, samples.data(), samples.size());
+    char ts[32];
+    for (size_t i = 0; i < n; ++i) {
+        formatISO8601(std::chrono::system_clock::time_point(std::chrono::milliseconds(samples[i].t_ms)), ts, sizeof(ts));
+        printf("%s,%.10g\n", ts, samples[i].value);
+    }
+    registerArchive.close();
+    return 0;
+}
+
+// Analysis mode (--analyze): streaming statistics of every word of the register
+// table against reference registers, to identify unknown registers
+static bool analysisMode = ANALYSIS_MODE;
+static bool analysisDirty = true;  // register table or unit changed: rebuild the columns
+static int analysisUnit = -1;
+static CorrelationEngine analysis;
+struct AnalysisRun { uint16_t addr; uint16_t words; };
+static std::vector<AnalysisRun> analysisRuns;   // contiguous column ranges, read from the image in one go
+static std::vector<int> analysisRefs;           // register table index of each reference
+static std::vector<uint16_t> analysisWords;     // current observation
+
+// Columns: every polled word of the register table except the words of the references
+static void configureAnalysis(uint8_t unitId) {
+    analysisDirty = false;
+    analysisUnit = unitId;
+    analysisRefs.clear();
+    std::set<uint16_t> refWords;
+    const char* p = ANALYSIS_REFERENCES;
+    while (*p) {
+        char* end = nullptr;
+        unsigned long addr = strtoul(p, &end, 10);
+        if (end == p) break;
+        int idx = aiswei_find_register_index((uint16_t)addr);
+        if (idx >= 0 && aiswei_registers[idx].addr == addr && aiswei_registers[idx].length <= 2 &&
+            analysisRefs.size() < CorrelationEngine::MAX_REFERENCES) {
+            analysisRefs.push_back(idx);
+            for (uint16_t i = 0; i < aiswei_registers[idx].length; ++i) refWords.insert((uint16_t)(addr + i));
+        } else {
+            LOG_WARN("Reference register %lu is not a numeric register of the table, ignored", addr);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    std::vector<uint16_t> columns;
+    analysisRuns.clear();
+    for (size_t i = 0; i < aiswei_registers_count; ++i) {
+        const RegisterInfo& ri = aiswei_registers[i];
+        if (ri.poll == REG_POLL_OFF) continue;
+        for (uint16_t w = 0; w < ri.length; ++w) {
+            uint16_t a = (uint16_t)(ri.addr + w);
+            if (refWords.count(a)) continue;
+            if (!analysisRuns.empty() && analysisRuns.back().addr + analysisRuns.back().words == a) {
+                analysisRuns.back().words++;
+            } else {
+                analysisRuns.push_back({ a, 1 });
+            }
+            columns.push_back(a);
+        }
+    }
+    analysis.configure(columns, analysisRefs.size());
+    analysisWords.assign(columns.size(), 0);
+    LOG("Analysing %zu words against %zu reference registers", columns.size(), analysisRefs.size());
+}
+
+// Current value of a reference register from the register image, false if not read yet
+static bool referenceValue(uint8_t unitId, const RegisterInfo& ri, double& out) {
+    uint16_t w[2];
+    if (registerImageSeenNs(unitId, ri.addr) == 0 || !registerImageRead(unitId, ri.addr, ri.length, w)) return false;
+    const char* type = ri.type ? ri.type : "";
+    if (ri.length == 2) {
+        uint32_t v = (uint32_t)w[0] << 16 | w[1];
+        out = strcmp(type, "S32") == 0 ? (double)(int32_t)v : (double)v;
+    } else {
+        out = strcmp(type, "S16") == 0 ? (double)(int16_t)w[0] : (double)w[0];
+    }
+    out *= ri.gain;
+    return true;
+}
+
+// Publish the top candidates per reference and the most active flag words on <prefix>/analysis
+static void publishAnalysis() {
+    static JsonWriter out(16 * 1024);
+    CorrelationEngine::Match matches[ANALYSIS_TOP_K];
+    CorrelationEngine::Toggle toggles[ANALYSIS_TOP_K];
+
+    out.clear();
+    out.beginObject();
+    out.key("samples").value((uint64_t)analysis.samples());
+    out.key("columns").value((uint64_t)analysis.columns());
+    out.key("moving").value((uint64_t)analysis.moving());
+    out.key("references").beginArray();
+    for (size_t k = 0; k < analysisRefs.size(); ++k) {
+        const RegisterInfo& ri = aiswei_registers[analysisRefs[k]];
+        out.beginObject().key("addr").value((unsigned)ri.addr).key("name").value(ri.name ? ri.name : "");
+        out.key("matches").beginArray();
+        size_t n = analysis.topMatches(k, matches, ANALYSIS_TOP_K);
+        for (size_t j = 0; j < n; ++j) {
+            out.beginObject().key("addr").value((unsigned)matches[j].addr);
+            if (const char* name = registerNameForAddr(matches[j].addr)) out.key("name").value(name);
+            out.key("r").value(round(matches[j].r * 1000.0) / 1000.0).key("signed").value(matches[j].isSigned);
+            out.endObject();
+        }
+        out.endArray().endObject();
+        if (n > 0) LOG("%s: best match %u (r=%.3f)", ri.name, matches[0].addr, matches[0].r);
+    }
+    out.endArray();
+
+    // flag words: few bits toggle
+    out.key("flags").beginArray();
+    size_t n = analysis.topToggles(toggles, ANALYSIS_TOP_K, ANALYSIS_FLAG_BITS);
+    for (size_t j = 0; j < n; ++j) {
+        out.beginObject().key("addr").value((unsigned)toggles[j].addr);
+        if (const char* name = registerNameForAddr(toggles[j].addr)) out.key("name").value(name);
+        out.key("toggles").value((unsigned)toggles[j].count).key("bits").beginObject();
+        for (unsigned b = 0; b < 16; ++b) {
+            if (toggles[j].perBit[b]) out.key(b).value((unsigned)toggles[j].perBit[b]);
+        }
+        out.endObject().endObject();
+    }
+    out.endArray();
+    out.endObject();
+
+    std::string topic = std::string(mqttPrefix) + "/analysis";
+    try {
+        if (mqttClient && mqttClient->is_connected()) {
+            mqttClient->publish(topic, out.data(), out.size());
+        }
+    } catch (const mqtt::exception &e) {
+        LOG_ERROR("MQTT analysis publish failed: %s", e.what());
+    }
+}
+
+// Feed the register image into the analysis every ANALYSIS_INTERVAL_MS of response
+// time (rxNs of the frame decoded last: recorded time while replaying), publish
+// every ANALYSIS_PUBLISH_MS
+static void analysisTick(int64_t rxNs) {
+    static int64_t lastSampleMs = 0, lastPublishMs = 0;
+    if (!analysisMode) return;
+    int64_t now = rxNs / 1000000;
+    if (now - lastSampleMs < ANALYSIS_INTERVAL_MS) return;
+    lastSampleMs = now;
+
+    uint8_t unitId = pollConfig->unitId;
+    if (analysisDirty || analysisUnit != unitId) {
+        configureAnalysis(unitId);
+        lastPublishMs = now;
+    }
+    double refs[CorrelationEngine::MAX_REFERENCES];
+    for (size_t k = 0; k < analysisRefs.size(); ++k) {
+        if (!referenceValue(unitId, aiswei_registers[analysisRefs[k]], refs[k])) return;
+    }
+    uint16_t* w = analysisWords.data();
+    for (const AnalysisRun& run : analysisRuns) {
+        if (!registerImageRead(unitId, run.addr, run.words, w)) return;
+        w += run.words;
+    }
+    analysis.update(analysisWords.data(), refs);
+
+    if (now - lastPublishMs >= ANALYSIS_PUBLISH_MS) {
+        lastPublishMs = now;
+        publishAnalysis();
+    }
+}
+
+// Install the register table for cfg (its maps, or a scan of all registers if there
+// are none and no table yet) and apply the per-register poll overrides
+static bool installRegisterTable(const RuntimeConfig& cfg) {
+    if (!loadRegisterMaps(cfg.registerMaps.c_str(), cfg.deviceType.c_str(), MODBUS_MAP_MAX_ENTRIES, MODBUS_MAP_MAX_BYTES)) {
+        if (aiswei_registers_count > 0) {
+            LOG_WARN("No usable register map for %s in %s, keeping current table", cfg.deviceType.c_str(), cfg.registerMaps.c_str());
+        } else {
+            // without a map, scan every word at addresses 30000..49999
+            LOG("No register map for %s in %s, scanning all registers", cfg.deviceType.c_str(), cfg.registerMaps.c_str());
+            if (!generateRegisterScan(30000, 49999, MODBUS_MAP_MAX_ENTRIES, MODBUS_MAP_MAX_BYTES)) return false;
+        }
+    }
+    applyPollOverrides(cfg.pollOverrides);
+    registerMeta = buildRegisterMetaTable();
+    // types and boundaries may differ now: decode every register of the next sweep
+    registerImageReset();
+    registerShmResetValues();
+    analysisDirty = true;
+    return true;
+}
+
+// Switch the poller and the sinks to a config snapshot. Runs on the polling thread
+// between transactions (or before it starts), so nothing is in flight while
+// endpoints or the register table change. Returns true if the register table was
+// replaced, which invalidates indices into it.
+static bool switchConfig(const std::shared_ptr<const RuntimeConfig>& next, bool initial) {
+    std::shared_ptr<const RuntimeConfig> prev = pollConfig;
+    pollConfig = next;
+    mqttPrefix = next->mqttPrefix.c_str();
+    influxMeasurement = next->influxMeasurement;
+
+    setModbusServer(next->modbusServer.c_str(), next->modbusPort);
+    if (initial || next->influxServer != prev->influxServer || next->influxPort != prev->influxPort) {
+        influxEndpoint.retarget(next->influxServer.c_str(), next->influxPort);
+    }
+    if (initial || next->mqttServer != prev->mqttServer || next->mqttPort != prev->mqttPort ||
+        next->mqttPrefix != prev->mqttPrefix) {
+        connectMqtt(*next);
+    }
+    bool mapsChanged = initial || next->registerMaps != prev->registerMaps ||
+                       next->deviceType != prev->deviceType || next->pollOverrides != prev->pollOverrides;
+    if (mapsChanged && !installRegisterTable(*next)) {
+        LOG_ERROR("Failed to install a register table");
+    }
+    if (!initial) {
+        LOG("Switched to config generation %llu", (unsigned long long)next->generation);
+    }
+    return mapsChanged;
+}
+
+// Publish a snapshot of registerValues for the readers on other threads (decode stage)
+static void snapshotRegisters() {
+    TRACE_SCOPE("snapshot.build");
+    uint64_t t0 = perfNowUs();
+    std::shared_ptr<RegisterSnapshot> snap = beginRegisterSnapshot();
+    snap->time = std::chrono::system_clock::now();
+    snap->config = pollConfig;
+    snap->meta = registerMeta;
+    snap->registers.resize(registerValues.size());
+    RegisterState* out = snap->registers.data();
+    for (const auto& [key, value] : registerValues) {
+        out->key = key;
+        out->payload = value.payload;  // reuses the buffer's string capacity
+        out->lastChangeTime = value.lastChangeTime;
+        out->hasChanged = value.hasChanged;
+        ++out;
+    }
+    publishRegisterSnapshot(std::move(snap));
+    registerValuesDirty = false;
+    perfStats.snapshotBuild.record(perfNowUs() - t0);
+}
+
+// Decode stage: decode received frames, detect changes and feed the sinks.
+// Snapshots for readers are published every REGISTER_SNAPSHOT_MS while values
+// change and at every sweep end, which also hands the summary to its thread.
+static void decodeThread() {
+    pipelineThreadSetup("decode", PIPELINE_CPU_DECODE);
+    IdleBackoff idle(PIPELINE_IDLE_MAX_US);
+    auto lastSnapshot = std::chrono::steady_clock::now();
+    for (;;) {
+        const DecodeRecord* rec = decodeQueue.peek();
+        if (!rec) {
+            if (decodeStop) break;
+            idle.wait();
+            continue;
+        }
+        idle.reset();
+        auto now = std::chrono::steady_clock::now();
+        if (rec->sweepEnd) {
+            snapshotRegisters();
+            lastSnapshot = now;
+            summaryRequest = registerSnapshotEpoch();
+            maintainHistory();
+        } else {
+            decodeModbusTCPResponse(&rec->frame);
+            analysisTick(rec->frame.rxNs);
+            if (registerValuesDirty && now - lastSnapshot >= std::chrono::milliseconds(REGISTER_SNAPSHOT_MS)) {
+                snapshotRegisters();
+                lastSnapshot = now;
+            }
+        }
+        decodeQueue.pop();
+    }
+}
+
+// Stats owned by other modules and the pipeline, sampled whenever the stats are written
+static void samplePipelineStats(JsonWriter& w) {
+    w.key("queues").beginObject();
+    w.key("decode").value(decodeQueue.size());
+    w.key("mqtt").value(mqttQueue.size());
+    w.key("influx").value(influxQueue.size());
+    w.key("changed_keys").value(changedKeyQueue.size());
+    w.endObject();
+    w.key("reconnects").value((unsigned)modbusReconnectCount());
+    w.key("responses_skipped").value(registerImageSkipped());
+    w.key("influx_spill").beginObject();
+    w.key("records").value(influxSpill.records());
+    w.key("dropped").value(influxSpill.dropped());
+    w.endObject();
+    w.key("log").beginObject();
+    w.key("dropped").value(logDropped());
+    w.key("suppressed").value(logSuppressed());
+    w.endObject();
+}
+
+// Publish the stats on <prefix>/$stats, at most every STATS_PUBLISH_MS (summary thread)
+static void publishStats() {
+    static JsonWriter stats(8 * 1024);
+    static auto lastPublish = std::chrono::steady_clock::time_point();
+    auto now = std::chrono::steady_clock::now();
+    if (STATS_PUBLISH_MS == 0 || now - lastPublish < std::chrono::milliseconds(STATS_PUBLISH_MS)) return;
+    lastPublish = now;
+    stats.clear();
+    writePerfStats(stats);
+    try {
+        if (mqttClient && mqttClient->is_connected()) {
+            mqttClient->publish(std::string(mqttPrefix) + "/$stats", stats.data(), stats.size());
+        }
+    } catch (const mqtt::exception &e) {
+        LOG_ERROR("MQTT stats publish failed: %s", e.what());
+    }
+}
+
+// Summary stage: summarize the snapshot of each sweep end while polling goes on.
+// A summary still running when the next sweep ends is followed by one of the latest snapshot.
+static void summaryThread() {
+    pipelineThreadSetup("summary", -1);
+    while (!sinkStop || summaryDone != summaryRequest) {
+        uint64_t epoch = summaryRequest;
+        if (epoch == summaryDone) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        std::shared_ptr<const RegisterSnapshot> snap = registerSnapshot();
+        if (snap) {
+            TRACE_SCOPE("summary.publish");
+            publishSummary(*snap);
+        }
+        publishStats();
+        summaryDone = epoch;
+    }
+}
+
+// Queue the end of a sweep for the decode stage; false while its queue is full
+static bool queueSweepEnd() {
+    DecodeRecord* rec = decodeQueue.claim();
+    if (!rec) return false;
+    rec->sweepEnd = true;
+    decodeQueue.publish();
+    return true;
+}
+
+// Modbus polling thread (I/O stage): requests and receives frames, decoding
+// happens on the decode thread
 static void modbusThread() {
+    pipelineThreadSetup("modbus-io", PIPELINE_CPU_IO);
     unsigned pollCount = 0;
     unsigned index = 0;
     unsigned prev_index = index;
+    unsigned sweep = 0;  // completed sweeps, selects the due poll classes
     /// uint8_t id = 0;
     bool requested = false;
     bool prioRange = true;
     int changedRangeIndex = 0;  // Index into changedAddressesRanges
+    bool sweepEndPending = false;  // sweep end not queued yet (decode queue full)
+    uint64_t reportedDrops = 0;
+    uint64_t sweepStartUs = 0;     // end of the previous sweep (perfNowUs)
+    uint64_t sweepRequests = 0;    // requests sent until then
+    uint64_t sweepSyscalls = 0;    // transaction system calls until then
+    uint64_t sweepCtxSwitches = 0; // context switches of this thread until then
+    ModbusFrame scratch;           // receives frames that do not fit into the decode queue
     
     while (running) {
-        if (++pollCount % 4 == 0) {  // Every 0.4 seconds
+        pollMqttCommands();
+        // requests of proxy clients go out between our own transactions
+        if (!requested) modbusProxyForward();
+
+        // apply a requested config reload between transactions, once the
+        // other stages are done with the current register table and sinks
+        if (!requested && reloadRequested.exchange(false)) {
+            LOG("Reloading %s", configFile);
+            drainPipeline();
+            if (loadRuntimeConfig(configFile) && switchConfig(runtimeConfig(), false)) {
+                // new register table: start a fresh sweep
+                index = prev_index = 0;
+                sweep = 0;
+                changedAddressesRanges.clear();
+                changedRangeIndex = 0;
+            }
+        }
+
+        bool sweepComplete = false;  // nothing due: the sweep ends without a request
+        unsigned tickMs = std::min(100u, pollConfig->pollIntervalMs);
+        unsigned ticks = pollConfig->pollIntervalMs / tickMs;
+        if (++pollCount % ticks == 0) {  // every poll interval
             prioRange = !prioRange;
             bool shouldProcessChanged = false;
             unsigned startIdx = 0;
@@ -766,7 +1726,7 @@ static void modbusThread() {
                     uint16_t prevReg = startReg + totalRegs;
                     bool startIsHolding = (startAddrDec >= 40000 && startAddrDec < 50000);
 
-                    while (totalRegs < MODBUS_BATCH_SIZE && k < aiswei_registers_count) {
+                    while (totalRegs < pollConfig->batchSize && k < aiswei_registers_count) {
                         unsigned idx = (startIdx + k) % aiswei_registers_count;
                         uint16_t addr_dec = aiswei_registers[idx].addr;
                         uint16_t reg = aiswei_dec2reg(addr_dec);
@@ -775,7 +1735,7 @@ static void modbusThread() {
                         // stop if non-contiguous or different register type
                         if (reg != prevReg) break;
                         if (isHolding != startIsHolding) break;
-                        if (totalRegs + len > MODBUS_BATCH_SIZE) break;
+                        if (totalRegs + len > pollConfig->batchSize) break;
                         totalRegs += len;
                         prevReg = reg + len;
                         ++k;
@@ -783,113 +1743,273 @@ static void modbusThread() {
                     // LOG("Processing changed address range: idx=%u addr=%u regs=%u entries=%u", startIdx, startAddrDec, totalRegs, k);
                 } 
                 else {
-                    // Normal processing: build a contiguous batch starting at `index`
+                    // Normal processing: build a contiguous batch starting at `index`,
+                    // skipping registers whose poll class is not due in this sweep
                     startIdx = index;
-                    startAddrDec = aiswei_registers[startIdx].addr;
-                    uint16_t startReg = aiswei_dec2reg(startAddrDec);
-                    totalRegs = aiswei_registers[startIdx].length;
-                    k = 1;
-                    uint16_t prevReg = startReg + totalRegs;
-                    bool startIsHolding = (startAddrDec >= 40000 && startAddrDec < 50000);
-
-                    while (totalRegs < MODBUS_BATCH_SIZE && k < aiswei_registers_count) {
-                        unsigned idx = (startIdx + k) % aiswei_registers_count;
-                        uint16_t addr_dec = aiswei_registers[idx].addr;
-                        uint16_t reg = aiswei_dec2reg(addr_dec);
-                        uint16_t len = aiswei_registers[idx].length;
-                        bool isHolding = (addr_dec >= 40000 && addr_dec < 50000);
-                        // stop if non-contiguous or different register type
-                        if (reg != prevReg) break;
-                        if (isHolding != startIsHolding) break;
-                        if (totalRegs + len > MODBUS_BATCH_SIZE) break;
-                        totalRegs += len;
-                        prevReg = reg + len;
-                        ++k;
+                    unsigned skipped = 0;
+                    while (skipped < aiswei_registers_count && !pollDue(aiswei_registers[startIdx].poll, sweep)) {
+                        startIdx = (startIdx + 1) % aiswei_registers_count;
+                        ++skipped;
+                    }
+                    if (skipped == aiswei_registers_count) {
+                        // nothing due in this sweep (e.g. only "once" registers):
+                        // end it below like any other, without a request
+                        sweepComplete = true;
+                    } else if (startIdx < index) {
+                        // wrapped while skipping: let the sweep end be detected below
+                        index = aiswei_registers_count - 1;
                     }
+                    if (!sweepComplete) {
+                        startAddrDec = aiswei_registers[startIdx].addr;
+                        uint16_t startReg = aiswei_dec2reg(startAddrDec);
+                        totalRegs = aiswei_registers[startIdx].length;
+                        k = 1;
+                        uint16_t prevReg = startReg + totalRegs;
+                        bool startIsHolding = (startAddrDec >= 40000 && startAddrDec < 50000);
+
+                        while (totalRegs < pollConfig->batchSize && k < aiswei_registers_count) {
+                            unsigned idx = (startIdx + k) % aiswei_registers_count;
+                            uint16_t addr_dec = aiswei_registers[idx].addr;
+                            uint16_t reg = aiswei_dec2reg(addr_dec);
+                            uint16_t len = aiswei_registers[idx].length;
+                            bool isHolding = (addr_dec >= 40000 && addr_dec < 50000);
+                            // stop if non-contiguous or different register type
+                            if (reg != prevReg) break;
+                            if (isHolding != startIsHolding) break;
+                            if (totalRegs + len > pollConfig->batchSize) break;
+                            if (!pollDue(aiswei_registers[idx].poll, sweep)) break;
+                            totalRegs += len;
+                            prevReg = reg + len;
+                            ++k;
+                        }
 
-                    // Check if this range contains changed addresses
-                    if (rangeContainsChangedAddress(startIdx, k)) {
-                        // Add to changed ranges list if not already there
-                        if (std::find(changedAddressesRanges.begin(), changedAddressesRanges.end(), startIdx) 
-                            == changedAddressesRanges.end()) {
-                            changedAddressesRanges.push_back(startIdx);
-                            // LOG("Added range to changed list: idx=%u (total changed ranges=%zu)", startIdx, changedAddressesRanges.size());
+                        // Check if this range contains changed addresses
+                        if (rangeContainsChangedAddress(startIdx, k)) {
+                            // Add to changed ranges list if not already there
+                            if (std::find(changedAddressesRanges.begin(), changedAddressesRanges.end(), startIdx) 
+                                == changedAddressesRanges.end()) {
+                                changedAddressesRanges.push_back(startIdx);
+                                // LOG("Added range to changed list: idx=%u (total changed ranges=%zu)", startIdx, changedAddressesRanges.size());
+                            }
                         }
-                    }
 
-                    prev_index = index;
-                    index = (startIdx + k) % aiswei_registers_count;
+                        prev_index = index;
+                        index = (startIdx + k) % aiswei_registers_count;
+                    }
                 }
 
                 // request the batch (totalRegs = number of 16-bit registers)
-                requested = requestAisweiReadRange(MODBUS_UNIT_ID, startAddrDec, totalRegs);
+                if (!sweepComplete) requested = requestAisweiReadRange(pollConfig->unitId, startAddrDec, totalRegs);
             }
         }
         
-        // Try to parse response
-        if (requested && parseModbusTCPResponse()) {
-            requested = false;
+        // Try to receive the response, straight into a decode queue slot
+        if (requested) {
+            DecodeRecord* rec = decodeQueue.claim();
+            ModbusFrame* frame = rec ? &rec->frame : &scratch;
+            if (receiveModbusTCPResponse(frame)) {
+                requested = false;
+                if (rec && frame->len) {
+                    rec->sweepEnd = false;
+                    decodeQueue.publish();
+                } else if (frame->len) {
+                    ++perfStats.droppedFrames;
+                }
+            }
         }
 
         // Check if we finished a sweep for summary publication
-        if (index < prev_index && !requested) {
+        if ((index < prev_index || sweepComplete) && !requested) {
             // completed a full sweep
             prev_index = index;
-            publishSummary();
+            ++sweep;
+            uint64_t nowUs = perfNowUs();
+            uint64_t requests = perfStats.requests;
+            uint64_t syscalls = modbusSyscallCount();
+            struct rusage ru;
+            getrusage(RUSAGE_THREAD, &ru);
+            uint64_t ctxSwitches = (uint64_t)ru.ru_nvcsw + (uint64_t)ru.ru_nivcsw;
+            if (sweepStartUs) {
+                perfStats.sweep.record(nowUs - sweepStartUs);
+                perfStats.requestRateMilli = (requests - sweepRequests) * 1000000000ULL / std::max<uint64_t>(1, nowUs - sweepStartUs);
+                perfStats.sweepSyscalls = syscalls - sweepSyscalls;
+                perfStats.sweepCtxSwitches = ctxSwitches - sweepCtxSwitches;
+            }
+            sweepStartUs = nowUs;
+            sweepRequests = requests;
+            sweepSyscalls = syscalls;
+            sweepCtxSwitches = ctxSwitches;
+            modbusCaptureSweepEnd();
+            sweepEndPending = true;
+            uint64_t drops = perfStats.droppedFrames;
+            if (drops != reportedDrops) {
+                LOG_WARN("Decode stage behind: %llu frames dropped", (unsigned long long)(drops - reportedDrops));
+                reportedDrops = drops;
+            }
         }
+        if (sweepEndPending && queueSweepEnd()) sweepEndPending = false;
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::this_thread::sleep_for(std::chrono::milliseconds(tickMs));
     }
 }
 
+// Feed a capture file back through the response parser and the sinks, at the
+// recorded pace or as fast as possible. Runs instead of the polling thread.
+static void modbusReplayThread(const char* path, bool fast) {
+    pipelineThreadSetup("modbus-io", PIPELINE_CPU_IO);
+    ModbusCaptureReader reader;
+    if (!reader.open(path)) return;
+    LOG("Replaying %s %s", path, fast ? "as fast as possible" : "at recorded speed");
+
+    int fds[2] = { -1, -1 };  // [0] is read by the parser, [1] gets the recorded frames
+    ModbusCaptureReader::Record rec;
+    uint16_t tid = 0, addr = 0;
+    bool pending = false;  // request still waiting for its response
+    uint64_t responses = 0;
+    int64_t firstNs = -1;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    while (running && reader.next(rec)) {
+        if (firstNs < 0) firstNs = rec.timeNs;
+        if (!fast) {
+            std::this_thread::sleep_until(wallStart + std::chrono::nanoseconds(rec.timeNs - firstNs));
+        }
+        if (rec.kind == 'S') {
+            claimWait(decodeQueue)->sweepEnd = true;
+            decodeQueue.publish();
+            continue;
+        }
+        if (rec.kind == 'Q') {
+            if (rec.len < 2) continue;
+            tid = (uint16_t)((rec.data[0] << 8) | rec.data[1]);
+            addr = rec.addrDec;
+            pending = true;
+            continue;
+        }
+        if (rec.len < 2) continue;
+
+        // the parser closes the connection on errors: start over with a new pair
+        if (fds[0] >= 0 && modbusConnectionFd() != fds[0]) {
+            close(fds[1]);
+            fds[0] = fds[1] = -1;
+        }
+        if (fds[0] < 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            LOG_ERROR("socketpair failed: %s", strerror(errno));
+            break;
+        }
+        if (!sendAll(fds[1], rec.data, rec.len)) break;
+
+        // stale responses stay queued and are discarded with the next matching one
+        uint16_t rtid = (uint16_t)((rec.data[0] << 8) | rec.data[1]);
+        if (!pending || rtid != tid) continue;
+        pending = false;
+        modbusReplayExpect(fds[0], tid, addr, rec.timeNs);
+        // nothing is lost while replaying: wait for the decode stage instead of dropping
+        DecodeRecord* slot = claimWait(decodeQueue);
+        if (receiveModbusTCPResponse(&slot->frame) && slot->frame.len) {
+            slot->sweepEnd = false;
+            decodeQueue.publish();
+        }
+        ++responses;
+    }
+    drainPipeline();
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    LOG("Replayed %llu responses in %.3f s (%.0f/s)", (unsigned long long)responses, secs,
+        secs > 0 ? responses / secs : 0.0);
+    cleanupModbusTCP();
+    if (fds[1] >= 0) close(fds[1]);
+}
+
 int main(int argc, char** argv) {
     std::cout << "Starting Joba Solplanet Gateway..." << std::endl;
 
     // Load persistent changed addresses
     loadChangedAddresses();
 
-    // derive Influx measurement from the last part of MQTT topic prefix
-    {
-        std::string prefix(MQTT_TOPIC_PREFIX);
-        size_t pos = prefix.find_last_of('/');
-        if (pos == std::string::npos) influxMeasurement = prefix; else influxMeasurement = prefix.substr(pos+1);
+    // Runtime configuration (file name may be given as the first argument),
+    // reloaded on SIGHUP or a "reload" command on <prefix>/cmd
+    // Options: --capture <file> records all Modbus frames,
+    // --replay <file> [--fast] replays a capture instead of polling the dongle,
+    // --history <addr> prints the local history of a register and exits,
+    // --analyze correlates all registers with the reference registers,
+    // --trace records trace events from the start (written to TRACE_FILE on exit),
+    // --verbose logs debug lines (every published change)
+    const char* capturePath = nullptr;
+    const char* replayPath = nullptr;
+    const char* historyAddr = nullptr;
+    bool replayFast = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--capture") && i + 1 < argc) capturePath = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) replayPath = argv[++i];
+        else if (!strcmp(argv[i], "--fast")) replayFast = true;
+        else if (!strcmp(argv[i], "--history") && i + 1 < argc) historyAddr = argv[++i];
+        else if (!strcmp(argv[i], "--analyze")) analysisMode = true;
+        else if (!strcmp(argv[i], "--trace")) traceSetEnabled(true);
+        else if (!strcmp(argv[i], "--verbose")) logSetLevel(LOG_LEVEL_DEBUG);
+        else configFile = argv[i];
+    }
+    loadRuntimeConfig(configFile);
+    pollConfig = runtimeConfig();
+    if (historyAddr) {
+        return dumpHistory((uint16_t)atoi(historyAddr));
+    }
+    signal(SIGHUP, onSighup);
+    signal(SIGINT, onTerminate);
+    signal(SIGTERM, onTerminate);
+
+    // Register table, endpoints and MQTT connection for the loaded config
+    switchConfig(runtimeConfig(), true);
+    LOG("Register image diff uses %s", registerImageKernel());
+    if (aiswei_registers_count == 0) {
+        return 1;
     }
 
-    // Start MQTT
-    try {
-        auto opts = mqtt::connect_options_builder()
-                        .keep_alive_interval(std::chrono::seconds(60))
-                        .clean_session(false)
-                        .automatic_reconnect(true)
-                        .finalize();
-        
-        mqttClient = new mqtt::client(
-            std::string("tcp://") + MQTT_SERVER + ":" + std::to_string(MQTT_PORT), MQTT_TOPIC_PREFIX
-        );
-        
-        LOG("Connecting to MQTT %s:%d", MQTT_SERVER, MQTT_PORT);
-        mqttClient->connect(opts);
-        LOG("MQTT connected for topics %s/#", MQTT_TOPIC_PREFIX);
-        
-    } catch (const mqtt::exception& exc) {
-        LOG("MQTT connection failed: %s", exc.what());
+    // Open Influx spill log (resumes a backlog from a previous run)
+    if (!influxSpill.open(INFLUX_SPILL_FILE, INFLUX_SPILL_SIZE)) {
+        LOG("Influx store-and-forward disabled");
+    }
+
+    // Open the local history (an empty HISTORY_FILE disables it)
+    if (HISTORY_FILE[0] && !registerArchive.open(HISTORY_FILE)) {
+        LOG("Local history disabled");
+    }
+
+    // Live register image for local readers (an empty REGISTER_SHM_NAME disables it)
+    if (REGISTER_SHM_NAME[0] && !registerShmOpen(REGISTER_SHM_NAME, REGISTER_SHM_UNITS, REGISTER_SHM_VALUES)) {
+        LOG("Shared memory register image disabled");
     }
 
-    // Initialize aiswei_registers array for testing (iterating through all entries): 
-    // each word as unsigned 16-bit at addresses 30000..49999
-    for (unsigned i=0; i < aiswei_registers_count; i++) {
-        aiswei_registers[i].addr = 30000 + i;
-        aiswei_registers[i].length = 1;
-        std::string *name = new std::string("Register " + std::to_string(30000 + i));
-        aiswei_registers[i].name = name->c_str();
-        aiswei_registers[i].type = "B16";
-        aiswei_registers[i].unit = NULL;
-        aiswei_registers[i].gain = 1.0f;
-        aiswei_registers[i].access = "RO";
+    modbusDefaultClient().setSink(&gatewaySink);
+
+    if (capturePath && !modbusStartCapture(capturePath)) {
+        return 1;
     }
 
-    // Start Modbus polling thread
-    std::thread modbus_th(modbusThread);
+    setPerfStatsSampler(samplePipelineStats);
+
+    // Start the pipeline: sinks, decode stage and the Modbus polling thread (or the replay of a capture)
+    polledChangedAddresses = changedAddresses;
+    std::thread mqtt_th(mqttSinkThread);
+    std::thread influx_th(influxSinkThread);
+    std::thread decode_th(decodeThread);
+    std::thread summary_th(summaryThread);
+    std::thread modbus_th = replayPath ? std::thread(modbusReplayThread, replayPath, replayFast)
+                                       : std::thread(modbusThread);
+    std::thread replay_th(influxReplayThread);
+    std::thread maintenance_th(maintenanceThread);
+
+    // Modbus proxy for other clients (MODBUS_PROXY_PORT 0 disables it; not while replaying)
+    if (MODBUS_PROXY_PORT && !replayPath &&
+        !modbusProxyStart(MODBUS_PROXY_ADDR, MODBUS_PROXY_PORT, MODBUS_PROXY_MAX_CONNECTIONS, MODBUS_PROXY_MAX_AGE_MS)) {
+        LOG("Modbus proxy disabled");
+    }
+
+    // Local query API over the published snapshots (HTTP_API_PORT 0 disables it)
+    if (HTTP_API_PORT && !startQueryApi(HTTP_API_ADDR, HTTP_API_PORT, HTTP_API_MAX_CONNECTIONS, HTTP_API_IDLE_MS,
+                                        &registerHistory)) {
+        LOG("HTTP API disabled");
+    }
 
     // Main thread: handle signals/commands
     std::string command;
@@ -902,12 +2022,28 @@ int main(int argc, char** argv) {
     //     }
     // }
 
-    // Cleanup
+    // Cleanup: the other stages finish what is queued
     modbus_th.join();
+    modbusProxyStop();
+    stopQueryApi();
     running = false;
+    decodeStop = true;
+    decode_th.join();
+    closeChangedAddresses();
+    sinkStop = true;
+    summary_th.join();
+    mqtt_th.join();
+    influx_th.join();
+    replay_th.join();
+    maintenance_th.join();
+    if (traceEnabled() || traceDumpRequested) writeTraceFile();
+    influxSpill.close();
+    registerArchive.close();
+    registerShmClose();
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
     
     cleanupModbusTCP();
+    modbusStopCapture();
 
     if (mqttClient) {
         try {
@@ -916,6 +2052,7 @@ int main(int argc, char** argv) {
         } catch (...) {}
     }
 
+    logFlush();
     std::cout << "Shutdown complete." << std::endl;
     return 0;
 }
\ No newline at end of file
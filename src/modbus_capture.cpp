@@ -0,0 +1,150 @@
+#include "modbus_capture.h"
+#include "log.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char CAPTURE_MAGIC[8] = { 'J', 'S', 'M', 'B', 'C', 'A', 'P', '1' };
+
+static int64_t captureMonotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool ModbusCaptureWriter::open(const char* path) {
+    close();
+    file_ = fopen(path, "wb");
+    if (!file_) {
+        LOG_ERROR("Failed to open capture file %s", path);
+        return false;
+    }
+    setvbuf(file_, nullptr, _IOFBF, 64 * 1024);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t startNs = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    uint8_t start[8];
+    for (int i = 0; i < 8; ++i) start[i] = (uint8_t)((uint64_t)startNs >> (8 * i));
+    fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), file_);
+    fwrite(start, 1, sizeof(start), file_);
+    lastUs_ = startNs / 1000;
+    lastFlushMs_ = captureMonotonicMs();
+    records_ = 0;
+    LOG("Capturing Modbus traffic to %s", path);
+    return true;
+}
+
+void ModbusCaptureWriter::close() {
+    if (!file_) return;
+    fclose(file_);
+    file_ = nullptr;
+    LOG("Capture closed after %llu records", (unsigned long long)records_);
+}
+
+void ModbusCaptureWriter::varint(uint64_t v) {
+    uint8_t buf[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (uint8_t)v;
+    fwrite(buf, 1, n, file_);
+}
+
+void ModbusCaptureWriter::record(char kind, const uint8_t* addr, const uint8_t* frame, size_t len, int64_t timeNs) {
+    if (!file_) return;
+    int64_t us = timeNs / 1000;
+    int64_t delta = us - lastUs_;  // may be negative if the clock was set back
+    lastUs_ = us;
+    fputc(kind, file_);
+    varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));  // zigzag
+    varint(len);
+    if (addr) fwrite(addr, 1, 2, file_);
+    if (len) fwrite(frame, 1, len, file_);
+    ++records_;
+
+    // bounded loss if the process dies: flush at least once a second
+    int64_t now = captureMonotonicMs();
+    if (now - lastFlushMs_ >= 1000) {
+        lastFlushMs_ = now;
+        fflush(file_);
+    }
+    if (ferror(file_)) {
+        LOG_ERROR("Write error, capture stopped");
+        close();
+    }
+}
+
+void ModbusCaptureWriter::request(uint16_t addrDec, const uint8_t* frame, size_t len, int64_t timeNs) {
+    uint8_t addr[2] = { (uint8_t)(addrDec >> 8), (uint8_t)addrDec };
+    record('Q', addr, frame, len, timeNs);
+}
+
+void ModbusCaptureWriter::response(const uint8_t* frame, size_t len, int64_t timeNs) {
+    record('R', nullptr, frame, len, timeNs);
+}
+
+bool ModbusCaptureReader::open(const char* path) {
+    close();
+    file_ = fopen(path, "rb");
+    if (!file_) {
+        LOG_ERROR("Failed to open capture file %s", path);
+        return false;
+    }
+    char magic[8];
+    uint8_t start[8];
+    if (fread(magic, 1, sizeof(magic), file_) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+        fread(start, 1, sizeof(start), file_) != sizeof(start)) {
+        LOG_WARN("%s is not a Modbus capture", path);
+        close();
+        return false;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)start[i] << (8 * i);
+    startNs_ = (int64_t)v;
+    lastUs_ = startNs_ / 1000;
+    return true;
+}
+
+void ModbusCaptureReader::close() {
+    if (file_) fclose(file_);
+    file_ = nullptr;
+}
+
+bool ModbusCaptureReader::varint(uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file_);
+        if (c == EOF) return false;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool ModbusCaptureReader::next(Record& rec) {
+    if (!file_) return false;
+    int kind = fgetc(file_);
+    if (kind == EOF) return false;
+    uint64_t zz, len;
+    if ((kind != 'Q' && kind != 'R' && kind != 'S') || !varint(zz) || !varint(len) || len > sizeof(frame_)) {
+        LOG_WARN("Damaged capture record, stopping");
+        return false;
+    }
+    rec.kind = (char)kind;
+    rec.addrDec = 0;
+    if (kind == 'Q') {
+        uint8_t addr[2];
+        if (fread(addr, 1, 2, file_) != 2) return false;
+        rec.addrDec = (uint16_t)((addr[0] << 8) | addr[1]);
+    }
+    if (fread(frame_, 1, len, file_) != len) return false;  // truncated at the end
+    int64_t delta = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+    lastUs_ += delta;
+    rec.timeNs = lastUs_ * 1000;
+    rec.data = frame_;
+    rec.len = (size_t)len;
+    return true;
+}
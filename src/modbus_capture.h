@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Raw Modbus TCP traffic capture.
+//
+// File: 8 byte magic "JSMBCAP1", start time (int64 ns since epoch, little
+// endian), then one record per frame:
+//   kind      1 byte, 'Q' request sent, 'R' response received, 'S' end of a
+//             polling sweep (no frame, length 0)
+//   delta     zigzag varint, microseconds since the previous record
+//   length    varint, number of frame bytes
+//   [addr]    requests only: 2 bytes big endian, decimal start address of the
+//             transaction (e.g. 31301), which the response parser needs
+//   frame     the complete ADU (MBAP header + PDU) as sent or received
+// Every response frame is recorded, including stale ones the parser discards,
+// so a replay takes the same code paths as the live run.
+
+class ModbusCaptureWriter {
+public:
+    ~ModbusCaptureWriter() { close(); }
+
+    bool open(const char* path);
+    void close();
+    bool isOpen() const { return file_ != nullptr; }
+
+    void request(uint16_t addrDec, const uint8_t* frame, size_t len, int64_t timeNs);
+    void response(const uint8_t* frame, size_t len, int64_t timeNs);
+    void sweepEnd(int64_t timeNs) { record('S', nullptr, nullptr, 0, timeNs); }
+    uint64_t records() const { return records_; }
+
+private:
+    void record(char kind, const uint8_t* addr, const uint8_t* frame, size_t len, int64_t timeNs);
+    void varint(uint64_t v);
+
+    FILE* file_ = nullptr;
+    int64_t lastUs_ = 0;
+    int64_t lastFlushMs_ = 0;
+    uint64_t records_ = 0;
+};
+
+class ModbusCaptureReader {
+public:
+    struct Record {
+        char kind;           // 'Q', 'R' or 'S'
+        int64_t timeNs;      // send or receive time
+        uint16_t addrDec;    // requests only
+        const uint8_t* data; // frame, valid until the next call to next()
+        size_t len;
+    };
+
+    ~ModbusCaptureReader() { close(); }
+
+    bool open(const char* path);
+    void close();
+    int64_t startNs() const { return startNs_; }
+
+    // Read the next record; false at the end of the file or on a damaged record
+    bool next(Record& rec);
+
+private:
+    bool varint(uint64_t& v);
+
+    FILE* file_ = nullptr;
+    int64_t startNs_ = 0;
+    int64_t lastUs_ = 0;
+    uint8_t frame_[300];
+};
@@ -0,0 +1,525 @@
+#include "modbus_client.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "modbus_config.h"
+#include "perf_stats.h"
+#include "word_mask.h"
+#include "trace.h"
+#include "log.h"
+
+enum { RING_TX = 1, RING_RX, RING_TIMEOUT };
+
+static int64_t realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+ModbusClient::ModbusClient(const char* host, int port, ModbusSink* sink)
+    : endpoint_(host, port, MODBUS_CONNECT_TIMEOUT_MS, MODBUS_BACKOFF_MIN_MS, MODBUS_BACKOFF_MAX_MS),
+      sink_(sink), stats_(&perfStats) {
+}
+
+// The table set with setRegisterTable(), else the installed aiswei_registers
+const RegisterInfo* ModbusClient::registers(size_t& count) const {
+    if (registers_) {
+        count = registerCount_;
+        return registers_;
+    }
+    count = aiswei_registers_count;
+    return aiswei_registers;
+}
+
+ModbusClient::~ModbusClient() {
+    // quietly: the default client goes away with the other statics at exit
+    if (socket_ != -1) ::close(socket_);
+}
+
+bool ModbusClient::useRing() {
+    if (ringState_ == 0) {
+        ringState_ = -1;
+        if (IO_URING && ring_.init(8) && ring_.registerBuffer(&io_, sizeof(io_))) {
+            ringState_ = 1;
+        }
+        stats_->ioUring = ringState_ > 0;
+        LOG("Modbus I/O uses %s", ringState_ > 0 ? "io_uring" : "poll/send/recv (no io_uring)");
+    }
+    return ringState_ > 0;
+}
+
+// Modbus TCP connection management
+bool ModbusClient::connect() {
+    if (socket_ != -1) {
+        return true;  // already connected
+    }
+
+    socket_ = endpoint_.connect();
+    if (socket_ < 0) {
+        return false;  // failed or backing off
+    }
+    txQueued_ = rxHave_ = 0;
+
+    LOG("Connected to Modbus TCP server %s:%d", endpoint_.host().c_str(), endpoint_.port());
+    return true;
+}
+
+// Drop a broken connection; the next request reconnects after the backoff
+void ModbusClient::fail() {
+    if (socket_ != -1) {
+        ::close(socket_);
+        socket_ = -1;
+    }
+    txQueued_ = rxHave_ = 0;
+    endpoint_.fail();
+}
+
+void ModbusClient::setServer(const char* host, int port) {
+    if (endpoint_.host() == host && endpoint_.port() == port) return;
+    LOG("Modbus TCP server changed to %s:%d", host, port);
+    close();
+    endpoint_.retarget(host, port);
+}
+
+void ModbusClient::close() {
+    if (socket_ != -1) {
+        ::close(socket_);
+        socket_ = -1;
+        LOG("Modbus TCP connection closed");
+    }
+}
+
+// Send a request frame: queued for the next receive with io_uring, else sent now
+bool ModbusClient::sendFrame(const uint8_t* frame, size_t len) {
+    if (!useRing()) return sendAll(socket_, frame, len, &syscalls_);
+    if (txQueued_) {
+        // a request nobody waited for (double word write): send it on its own
+        ring_.writeFixed(socket_, io_.tx, txQueued_, RING_TX);
+        uint64_t enters = ring_.enterCalls();
+        int rc = ring_.submit(1);
+        syscalls_ += ring_.enterCalls() - enters;
+        uint64_t tag;
+        int res = rc;
+        while (ring_.complete(tag, res)) {}
+        if (rc < 0 || res != (int)txQueued_) return false;
+    }
+    memcpy(io_.tx, frame, len);
+    txQueued_ = len;
+    return true;
+}
+
+// Read one MBAP frame (header with an invalid length: just the 6 header bytes)
+// through the ring: submits a queued request, then reads until a frame is complete
+ssize_t ModbusClient::recvFrameRing(uint8_t* buffer, size_t max) {
+    for (;;) {
+        if (rxHave_ >= 6) {
+            size_t len = ((size_t)io_.rx[4] << 8) | io_.rx[5];
+            size_t total = (len < 2 || len > max - 6) ? 6 : 6 + len;
+            if (rxHave_ >= total) {
+                memcpy(buffer, io_.rx, total);
+                rxHave_ -= total;
+                memmove(io_.rx, io_.rx + total, rxHave_);
+                return (ssize_t)total;
+            }
+        }
+        int64_t remaining = transactionDeadline_ - monotonicMs();
+        if (remaining <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        // [write request ->] read -> timeout, one io_uring_enter for all of them
+        size_t sent = txQueued_;
+        unsigned ops = 2;
+        if (sent) {
+            ring_.writeFixed(socket_, io_.tx, sent, RING_TX, true);
+            ++ops;
+            transactionSentUs_ = perfNowUs();
+        }
+        ring_.readFixed(socket_, io_.rx + rxHave_, sizeof(io_.rx) - rxHave_, RING_RX, true);
+        ring_.linkTimeout(remaining, RING_TIMEOUT);
+        txQueued_ = 0;
+        uint64_t enters = ring_.enterCalls();
+        int rc = ring_.submit(ops);
+        syscalls_ += ring_.enterCalls() - enters;
+        if (rc < 0) {
+            errno = -rc;
+            return -1;
+        }
+        int txRes = (int)sent, rxRes = -ECANCELED;
+        uint64_t tag;
+        int res;
+        while (ring_.complete(tag, res)) {
+            if (tag == RING_TX) txRes = res;
+            else if (tag == RING_RX) rxRes = res;
+        }
+        if (txRes != (int)sent) {
+            errno = txRes < 0 ? -txRes : EIO;
+            return -1;
+        }
+        if (rxRes == 0) return 0;
+        if (rxRes == -ECANCELED || rxRes == -EINTR || rxRes == -EAGAIN) continue;  // timeout: checked above
+        if (rxRes < 0) {
+            errno = -rxRes;
+            return -1;
+        }
+        rxHave_ += rxRes;
+    }
+}
+
+// Read one MBAP frame into buffer (max bytes) before the transaction deadline:
+// frame length, 0 if the peer closed the connection, -1 on error or timeout
+// (errno ETIMEDOUT). A header with an invalid length is returned alone (6 bytes).
+ssize_t ModbusClient::recvFrame(uint8_t* buffer, size_t max) {
+    if (useRing()) return recvFrameRing(buffer, max);
+    ssize_t r = recvAll(socket_, buffer, 6, transactionDeadline_, &syscalls_);
+    if (r <= 0) return r;
+    size_t len = ((size_t)buffer[4] << 8) | buffer[5];
+    if (len < 2 || len > max - 6) return 6;
+    r = recvAll(socket_, buffer + 6, len, transactionDeadline_, &syscalls_);
+    return r <= 0 ? r : (ssize_t)(6 + len);
+}
+
+// Start the response timeout of a request just sent
+void ModbusClient::sent(uint8_t functionCode) {
+    transactionDeadline_ = monotonicMs() + MODBUS_RESPONSE_TIMEOUT_MS;
+    transactionSentUs_ = perfNowUs();
+    transactionFc_ = functionCode;
+    ++stats_->requests;
+}
+
+// Modbus TCP read request builder and sender (no address translation)
+bool ModbusClient::sendRequest(uint8_t unitId, uint8_t functionCode, uint16_t startAddress, uint16_t quantity) {
+    TRACE_SCOPE("modbus.send", transactionAddr_);
+    if (!connect()) {
+        return false;
+    }
+
+    // Build Modbus TCP frame
+    uint8_t frame[12];
+    uint16_t tid = ++transactionId_;
+
+    // MBAP Header (7 bytes)
+    frame[0] = (tid >> 8) & 0xFF;           // Transaction ID (high)
+    frame[1] = tid & 0xFF;                  // Transaction ID (low)
+    frame[2] = 0x00;                        // Protocol ID (high) = 0
+    frame[3] = 0x00;                        // Protocol ID (low) = 0
+    frame[4] = 0x00;                        // Length (high) = 6 bytes
+    frame[5] = 0x06;                        // Length (low)
+    frame[6] = unitId;                      // Unit ID
+
+    // PDU (5 bytes)
+    frame[7] = functionCode;                // Function code (0x03 = Read Holding Registers)
+    frame[8] = (startAddress >> 8) & 0xFF;  // Starting Address (high)
+    frame[9] = startAddress & 0xFF;         // Starting Address (low)
+    frame[10] = (quantity >> 8) & 0xFF;     // Quantity (high)
+    frame[11] = quantity & 0xFF;            // Quantity (low)
+
+    if (!sendFrame(frame, sizeof(frame))) {
+        LOG_ERROR("Failed to send Modbus TCP request");
+        fail();
+        return false;
+    }
+    sent(functionCode);
+    if (capture_.isOpen()) capture_.request(transactionAddr_, frame, sizeof(frame), realtimeNs());
+
+    // LOG("Sent Modbus TCP request: unitId=%u, fc=0x%02x, addr=%u, qty=%u", unitId, functionCode, startAddress, quantity);
+    return true;
+}
+
+// Modbus TCP write word request builder and sender (no address translation)
+bool ModbusClient::sendWriteRequest(uint8_t unitId, uint16_t registerAddress, uint16_t value) {
+    TRACE_SCOPE("modbus.send", transactionAddr_);
+    if (!connect()) {
+        return false;
+    }
+
+    uint8_t frame[12];
+    uint16_t tid = ++transactionId_;
+
+    // MBAP Header
+    frame[0] = (tid >> 8) & 0xFF;
+    frame[1] = tid & 0xFF;
+    frame[2] = 0x00;
+    frame[3] = 0x00;
+    frame[4] = 0x00;
+    frame[5] = 0x06;
+    frame[6] = unitId;
+
+    // PDU (Function Code 0x06 - Write Single Register)
+    frame[7] = 0x06;
+    frame[8] = (registerAddress >> 8) & 0xFF;
+    frame[9] = registerAddress & 0xFF;
+    frame[10] = (value >> 8) & 0xFF;
+    frame[11] = value & 0xFF;
+
+    if (!sendFrame(frame, sizeof(frame))) {
+        LOG_ERROR("Failed to send write request");
+        fail();
+        return false;
+    }
+    sent(0x06);
+    if (capture_.isOpen()) capture_.request(transactionAddr_, frame, sizeof(frame), realtimeNs());
+
+    LOG("Sent Modbus TCP write: reg=%u, value=%u", registerAddress, value);
+    return true;
+}
+
+bool ModbusClient::requestRead(uint8_t unitId, uint16_t addrDec) {
+    // determine register index and length from table if present
+    size_t count;
+    const RegisterInfo* regs = registers(count);
+    int idx = registerTableFind(regs, count, addrDec);
+    if (idx < 0) {
+        LOG_WARN("Unknown modbus address: %u", addrDec);
+        return false;
+    }
+    uint16_t length = regs[idx].length;
+    uint16_t reg = aiswei_dec2reg(addrDec);
+
+    transactionAddr_ = addrDec;
+
+    if (addrDec >= 40000 && addrDec < 50000) {
+        // addresses starting with 4xxxx are holding registers (function code 0x03)
+        return sendRequest(unitId, 0x03, reg, length);
+    }
+
+    // default to input registers for 3xxxx (function code 0x04)
+    return sendRequest(unitId, 0x04, reg, length);
+}
+
+// Request a contiguous range of registers (quantity = number of 16-bit registers)
+bool ModbusClient::requestReadRange(uint8_t unitId, uint16_t startAddrDec, uint16_t quantity) {
+    // set transaction start address for parser
+    transactionAddr_ = startAddrDec;
+    uint16_t reg = aiswei_dec2reg(startAddrDec);
+    // choose function code based on address range (3xxxx -> input regs (0x04), 4xxxx -> holding regs (0x03))
+    if (startAddrDec >= 40000 && startAddrDec < 50000) {
+        return sendRequest(unitId, 0x03, reg, quantity);
+    }
+    return sendRequest(unitId, 0x04, reg, quantity);
+}
+
+bool ModbusClient::requestWriteWord(uint8_t unitId, uint16_t addrDec, uint16_t value) {
+    uint16_t reg = aiswei_dec2reg(addrDec);
+    transactionAddr_ = addrDec;
+    return sendWriteRequest(unitId, reg, value);
+}
+
+bool ModbusClient::requestWriteDWord(uint8_t unitId, uint16_t addrDec, uint32_t value) {
+    // For U32, we need to write two consecutive registers
+    uint16_t reg = aiswei_dec2reg(addrDec);
+    uint16_t highWord = (value >> 16) & 0xFFFF;
+    uint16_t lowWord = value & 0xFFFF;
+
+    // Write high word first
+    transactionAddr_ = addrDec;
+    if (!sendWriteRequest(unitId, reg, highWord)) return false;
+    usleep(50000); // 50ms delay between writes
+    // Write low word second
+    return sendWriteRequest(unitId, reg + 1, lowWord);
+}
+
+bool ModbusClient::forwardRequest(uint8_t unitId, const uint8_t* pdu, size_t len, ModbusFrame* frame) {
+    TRACE_SCOPE("modbus.forward");
+    frame->len = 0;
+    if (len == 0 || len > 253 || !connect()) {
+        return false;
+    }
+
+    uint8_t request[7 + 253];
+    uint16_t tid = ++transactionId_;
+    request[0] = (tid >> 8) & 0xFF;
+    request[1] = tid & 0xFF;
+    request[2] = 0x00;
+    request[3] = 0x00;
+    request[4] = ((len + 1) >> 8) & 0xFF;
+    request[5] = (len + 1) & 0xFF;
+    request[6] = unitId;
+    memcpy(request + 7, pdu, len);
+
+    if (!sendFrame(request, 7 + len)) {
+        LOG_ERROR("Failed to send forwarded request");
+        fail();
+        return false;
+    }
+    sent(pdu[0]);
+    forwarding_ = true;
+    bool ok = receive(frame);
+    forwarding_ = false;
+    return ok;
+}
+
+void ModbusClient::captureSweepEnd() {
+    if (capture_.isOpen()) capture_.sweepEnd(realtimeNs());
+}
+
+void ModbusClient::replayExpect(int fd, uint16_t tid, uint16_t addrDec, int64_t timeNs) {
+    socket_ = fd;
+    transactionId_ = tid;
+    transactionAddr_ = addrDec;
+    transactionDeadline_ = monotonicMs() + MODBUS_RESPONSE_TIMEOUT_MS;
+    replayTimeNs_ = timeNs;
+}
+
+// Modbus TCP response receiver
+bool ModbusClient::receive(ModbusFrame* frame) {
+    frame->len = 0;
+    if (socket_ < 0) return false;
+    TRACE_SCOPE("modbus.receive", transactionAddr_);
+
+    // Read one frame: MBAP header, then the rest as announced by its length field.
+    // Frames of older (timed out) transactions are skipped until the deadline.
+    uint8_t* buffer = frame->data;
+    uint16_t tid, len;
+    int64_t rxNs;
+    for (;;) {
+        ssize_t r = recvFrame(buffer, sizeof(frame->data));
+        if (r > 0) {
+            len = ((uint16_t)buffer[4] << 8) | buffer[5];
+            if (r == 6) {
+                LOG_WARN("Invalid frame length %u, resynchronizing connection", len);
+                fail();
+                return true;
+            }
+        }
+
+        if (r < 0) {
+            if (errno == ETIMEDOUT) {
+                ++stats_->timeouts;
+                LOG_WARN("Timeout waiting for response to transaction %u", transactionId_);
+            } else {
+                LOG_ERROR("Failed to read from socket");
+            }
+            fail();
+            return true;
+        }
+
+        if (r == 0) {
+            // e.g. dongle reboot: reconnect with backoff
+            LOG_WARN("Connection closed by server");
+            fail();
+            return true;
+        }
+
+        rxNs = replayTimeNs_ ? replayTimeNs_ : realtimeNs();
+        if (capture_.isOpen() && !forwarding_) capture_.response(buffer, 6 + len, rxNs);
+        tid = ((uint16_t)buffer[0] << 8) | buffer[1];
+        if (tid == transactionId_) break;
+        LOG_DEBUG("Discarding stale response: expected transaction %u, got %u", transactionId_, tid);
+    }
+
+    frame->rxNs = rxNs;
+    frame->addr = transactionAddr_;
+    frame->len = 6 + len;
+    if (!replayTimeNs_) {
+        perfRttHistogram(*stats_, transactionFc_).record(perfNowUs() - transactionSentUs_);
+        ++stats_->responses;
+        if (buffer[7] & 0x80) ++stats_->exceptions;
+    }
+    return true;
+}
+
+bool ModbusClient::receiveAndDecode() {
+    ModbusFrame frame;
+    if (!receive(&frame)) return false;
+    if (frame.len) decode(&frame);
+    return true;
+}
+
+// Decode a received response. Only touches the frame and the sink, so it can
+// run on another thread than the receiver.
+void ModbusClient::decode(const ModbusFrame* frame) {
+    TRACE_SCOPE("modbus.decode", frame->addr);
+    const uint8_t* buffer = frame->data;
+    int bytesRead = frame->len;
+    uint16_t startAddr = frame->addr;  // of this frame's request, not of the one in flight
+    int64_t rxNs = frame->rxNs;
+    uint16_t pid;
+
+    // responseTimeNs() is the receive time only while this response is decoded
+    struct ResetResponseTime {
+        int64_t& ns;
+        ~ResetResponseTime() { ns = 0; }
+    } resetResponseTime{responseTimeNs_};
+    responseTimeNs_ = rxNs;
+
+    if (bytesRead < 9) {
+        LOG_WARN("Response too short: %d bytes", bytesRead);
+        return;
+    }
+
+    // Parse MBAP Header
+    pid = ((uint16_t)buffer[2] << 8) | buffer[3];
+    uint8_t unitId = buffer[6];
+    uint8_t fc = buffer[7];
+
+    if (pid != 0x0000) {
+        LOG_WARN("Invalid Protocol ID: 0x%04x", pid);
+        return;
+    }
+
+    // Check for exception response (bit 7 set)
+    if (fc & 0x80) {
+        uint8_t exceptionCode = buffer[8];
+        LOG_WARN("Modbus exception: fc=0x%02x, exception=0x%02x", fc, exceptionCode);
+        return;
+    }
+
+    // Parse PDU for function code 0x03 (Read Holding or Input Registers or WriteSingleRegister)
+    if (fc == 0x03 || fc == 0x04 || fc == 0x06) {
+        uint16_t dataBytes = buffer[8];
+        if (bytesRead < 9 + dataBytes) {
+            LOG_WARN("Response data incomplete");
+            return;
+        }
+        if (!sink_) return;
+
+        const uint8_t* registerData = &buffer[9];
+        size_t regCount;
+        const RegisterInfo* regs = registers(regCount);
+
+        // The sink may skip words it has seen before (e.g. unchanged since the
+        // previous sweep): registers whose words are all skipped are not decoded
+        uint64_t changed[2] = { ~0ULL, ~0ULL };
+        if (fc != 0x06 && !sink_->responseWords(unitId, startAddr, registerData, dataBytes / 2, rxNs, changed)) return;
+
+        // Decode each known register entry within the returned byte sequence.
+        // The response contains N registers (2 bytes each). We iterate through the
+        // aiswei register table starting from startAddr and hand each
+        // changed entry to the sink with its appropriate byte slice.
+        size_t pos = 0;
+        while (pos + 1 < (size_t)dataBytes) {
+            uint16_t currentAddr = startAddr + (pos / 2);
+            int ridx = registerTableFind(regs, regCount, currentAddr);
+            if (ridx < 0) {
+                // Unknown register: single 16-bit register
+                if (wordMaskAny(changed, pos / 2, 1)) {
+                    uint8_t tmp[2]; tmp[0] = registerData[pos]; tmp[1] = registerData[pos+1];
+                    sink_->registerValue(unitId, currentAddr, tmp, 2);
+                }
+                pos += 2;
+                continue;
+            }
+            uint16_t words = regs[ridx].length;
+            size_t bytesNeeded = words * 2;
+            if (pos + bytesNeeded > (size_t)dataBytes) {
+                LOG_WARN("Response incomplete for addr %u: need %zu bytes, have %u", regs[ridx].addr, bytesNeeded, dataBytes - (int)pos);
+                break;
+            }
+            if (wordMaskAny(changed, pos / 2, words)) {
+                sink_->registerValue(unitId, regs[ridx].addr, &registerData[pos], bytesNeeded);
+            }
+            pos += bytesNeeded;
+        }
+    }
+}
+
+ModbusClient& modbusDefaultClient() {
+    static ModbusClient client(MODBUS_SERVER, MODBUS_PORT);
+    return client;
+}
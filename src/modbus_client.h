@@ -0,0 +1,144 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "modbus_registers.h"
+#include "connection.h"
+#include "modbus_capture.h"
+#include "io_ring.h"
+
+struct PerfStats;
+
+// Receives what a ModbusClient decodes from the responses to its reads
+class ModbusSink {
+public:
+    virtual ~ModbusSink() = default;
+
+    /**
+     * The words of a read response (FC03/FC04) for startAddr, as received,
+     * before they are decoded. changed has bit i set for every word (see
+     * word_mask.h); clear the bits of words that need no decoding (e.g.
+     * unchanged since the last sweep), or return false to decode none.
+     */
+    virtual bool responseWords(uint8_t /*unitId*/, uint16_t /*startAddr*/, const uint8_t* /*data*/, size_t /*words*/,
+                               int64_t /*rxNs*/, uint64_t /*changed*/[2]) {
+        return true;
+    }
+
+    // One register entry of the register table (an unknown address: one word) of a response
+    virtual void registerValue(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t length) = 0;
+};
+
+// Modbus TCP client for one dongle: owns the connection (endpoint with
+// reconnect backoff, socket, io_uring transport and buffers), the state of
+// the transaction in flight and the optional capture, and hands the decoded
+// registers of every response to its sink. One request is outstanding at a
+// time; requests and receive() run on one thread, decode() may run on another
+// (it only touches the frame, the register table and the sink). Registers are
+// decoded with the global aiswei_registers and counted in perfStats unless the
+// client is given a table and stats of its own.
+class ModbusClient {
+public:
+    ModbusClient(const char* host, int port, ModbusSink* sink = nullptr);
+    ~ModbusClient();
+    ModbusClient(const ModbusClient&) = delete;
+    ModbusClient& operator=(const ModbusClient&) = delete;
+
+    // Set before the first response is decoded
+    void setSink(ModbusSink* sink) { sink_ = sink; }
+    // Register table (sorted by address) to decode with; nullptr: aiswei_registers as installed
+    void setRegisterTable(const RegisterInfo* registers, size_t count) {
+        registers_ = registers;
+        registerCount_ = count;
+    }
+    // Counters and round trip histograms of this client (default perfStats)
+    void setStats(PerfStats* stats) { stats_ = stats; }
+
+    // Point the client at another dongle. Call between transactions:
+    // an open connection to a different address is closed.
+    void setServer(const char* host, int port);
+    void close();
+
+    // Send a request (connecting first if needed); false if it could not be sent
+    bool requestRead(uint8_t unitId, uint16_t addrDec);
+    bool requestReadRange(uint8_t unitId, uint16_t startAddrDec, uint16_t quantity);
+    bool requestWriteWord(uint8_t unitId, uint16_t addrDec, uint16_t value);
+    bool requestWriteDWord(uint8_t unitId, uint16_t addrDec, uint32_t value);
+    // Forward the request PDU of another Modbus client (see modbusForwardRequest)
+    bool forwardRequest(uint8_t unitId, const uint8_t* pdu, size_t len, ModbusFrame* frame);
+
+    /**
+     * Receive the response to the pending request into frame; frame->len is 0 if
+     * none arrived (timeout or connection lost, which schedules a reconnect).
+     * Returns false if there is no connection, true once the transaction is over.
+     */
+    bool receive(ModbusFrame* frame);
+    // Validate a received frame and hand its changed registers to the sink
+    void decode(const ModbusFrame* frame);
+    // receive() and decode() on the calling thread
+    bool receiveAndDecode();
+
+    bool startCapture(const char* path) { return capture_.open(path); }
+    void stopCapture() { capture_.close(); }
+    void captureSweepEnd();
+
+    // Replay: use fd as the connection and expect the response to transaction tid (see modbusReplayExpect)
+    void replayExpect(int fd, uint16_t tid, uint16_t addrDec, int64_t timeNs);
+
+    // Receive time (ns since epoch) of the response being decoded, 0 outside of decode()
+    int64_t responseTimeNs() const { return responseTimeNs_; }
+    uint32_t reconnectCount() const { return (uint32_t)endpoint_.reconnects(); }
+    int fd() const { return socket_; }
+    // System calls made for transactions so far (sending, waiting, receiving)
+    uint64_t syscallCount() const { return syscalls_; }
+
+private:
+    bool connect();
+    void fail();
+    bool useRing();
+    bool sendFrame(const uint8_t* frame, size_t len);
+    ssize_t recvFrameRing(uint8_t* buffer, size_t max);
+    ssize_t recvFrame(uint8_t* buffer, size_t max);
+    bool sendRequest(uint8_t unitId, uint8_t functionCode, uint16_t startAddress, uint16_t quantity);
+    bool sendWriteRequest(uint8_t unitId, uint16_t registerAddress, uint16_t value);
+    void sent(uint8_t functionCode);
+    const RegisterInfo* registers(size_t& count) const;
+
+    TcpEndpoint endpoint_;
+    ModbusSink* sink_;
+    const RegisterInfo* registers_ = nullptr;
+    size_t registerCount_ = 0;
+    PerfStats* stats_;
+    int socket_ = -1;
+
+    uint16_t transactionId_ = 0;     // id of current transaction to match register responses
+    uint16_t transactionAddr_ = 0;   // first register address of current transaction
+    int64_t transactionDeadline_ = 0;  // monotonic ms by which the response must have arrived
+    uint64_t transactionSentUs_ = 0;   // when the pending request was sent (perfNowUs)
+    uint8_t transactionFc_ = 0;        // its function code
+    bool forwarding_ = false;          // transaction of a proxy client, kept out of the capture
+    int64_t replayTimeNs_ = 0;         // recorded receive time while replaying, 0 when live
+    int64_t responseTimeNs_ = 0;       // receive time of the response being decoded (decode thread)
+
+    // raw frame capture (--capture)
+    ModbusCaptureWriter capture_;
+
+    // io_uring transport (IO_URING): a request is only queued when sent and goes
+    // to the kernel together with the read of its response and the response
+    // timeout, so a transaction usually costs one system call instead of a send
+    // and a poll and recv per header and body. Both directions use a registered
+    // buffer; bytes received beyond the frame returned are kept for the next one.
+    IoRing ring_;
+    int ringState_ = 0;  // 0 not set up yet, 1 io_uring, -1 plain system calls
+    struct {
+        uint8_t tx[7 + 253];
+        uint8_t rx[2 * (6 + 254)];
+    } io_;
+    size_t txQueued_ = 0;  // request bytes in io_.tx not submitted yet
+    size_t rxHave_ = 0;    // received bytes in io_.rx not returned yet
+    uint64_t syscalls_ = 0;
+};
+
+// Client used by the free functions of modbus_registers.h (MODBUS_SERVER:MODBUS_PORT)
+ModbusClient& modbusDefaultClient();
@@ -0,0 +1,541 @@
+#include "modbus_proxy.h"
+#include "modbus_registers.h"
+#include "register_image.h"
+#include "pipeline.h"
+#include "log.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// upstream requests waiting for the polling thread (and their responses)
+#define PROXY_QUEUE 64
+// most words of one read request (Modbus limit)
+#define PROXY_MAX_READ 125
+
+// Modbus exception codes
+#define EXC_ILLEGAL_VALUE 0x03
+#define EXC_BUSY 0x06
+#define EXC_TARGET_FAILED 0x0B
+
+// request handed to the polling thread, and its response
+struct ProxyJob {
+    uint64_t id;
+    uint8_t unitId;
+    uint8_t len;
+    uint8_t pdu[253];
+};
+
+struct ProxyDone {
+    uint64_t id;
+    int64_t rxNs;
+    uint8_t len;  // 0: no response (timeout or no connection)
+    uint8_t pdu[253];
+};
+
+static SpscRing<ProxyJob> jobs(PROXY_QUEUE);    // proxy thread -> polling thread
+static SpscRing<ProxyDone> done(PROXY_QUEUE);   // polling thread -> proxy thread
+static int wakeFd = -1;                         // eventfd: responses in done
+
+// Everything below is owned by the proxy thread.
+
+struct Conn {
+    int fd;
+    uint64_t serial;  // tells a reused fd from the connection a waiter belongs to
+    std::string in;
+    std::string out;
+};
+
+// client request waiting for an upstream response
+struct Waiter {
+    int fd;
+    uint64_t serial;
+    uint16_t tid;
+    uint8_t unitId;
+    uint16_t offset;  // reads: first word within the upstream response
+    uint16_t words;
+};
+
+struct Upstream {
+    uint8_t unitId;
+    uint8_t fc;
+    bool read;       // FC03/FC04 read that others may share, else passed through
+    uint16_t reg;
+    uint16_t words;
+    std::vector<Waiter> waiters;
+};
+
+// words of an upstream read response, reused within the staleness bound
+struct CachedRead {
+    int64_t rxNs;
+    std::vector<uint8_t> data;  // wire order
+};
+
+// register write: words of the range are stale while it is queued or in flight,
+// and cached words received before the dongle answered it (tNs) after that
+struct WriteMark {
+    uint8_t unitId;
+    uint16_t reg;
+    uint16_t words;
+    uint64_t jobId;
+    bool pending;  // not answered yet
+    int64_t tNs;   // receive time of the write's response
+};
+
+static int listenFd = -1;
+static int epollFd = -1;
+static std::thread proxyThread;
+static std::atomic<bool> running(false);
+static size_t maxConns = 0;
+static int64_t maxAgeNs = 0;
+static std::vector<std::unique_ptr<Conn>> conns;  // by fd
+static size_t connCount = 0;
+static uint64_t nextSerial = 0;
+static uint64_t nextJobId = 0;
+static std::map<uint64_t, Upstream> inflight;          // by job id
+static std::map<uint64_t, CachedRead> readCache;       // by readKey()
+static std::vector<WriteMark> writeMarks;
+
+// statistics (read at stop)
+static uint64_t imageHits = 0, cacheHits = 0, coalesced = 0, forwarded = 0;
+
+static int64_t realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// ordered by unit, function and start register, so covering reads are neighbours
+static uint64_t readKey(uint8_t unitId, uint8_t fc, uint16_t reg, uint16_t words) {
+    return ((uint64_t)unitId << 40) | ((uint64_t)fc << 32) | ((uint64_t)reg << 16) | words;
+}
+
+// Queue an ADU with the client's transaction id and unit for fd (if still the same connection)
+static void reply(int fd, uint64_t serial, uint16_t tid, uint8_t unitId, const uint8_t* pdu, size_t len) {
+    if ((size_t)fd >= conns.size() || !conns[fd] || conns[fd]->serial != serial) return;
+    uint8_t mbap[7] = { (uint8_t)(tid >> 8), (uint8_t)tid, 0, 0, (uint8_t)((len + 1) >> 8), (uint8_t)(len + 1), unitId };
+    std::string& out = conns[fd]->out;
+    out.append((const char*)mbap, sizeof(mbap));
+    out.append((const char*)pdu, len);
+}
+
+static void replyException(const Waiter& w, uint8_t fc, uint8_t code) {
+    uint8_t pdu[2] = { (uint8_t)(fc | 0x80), code };
+    reply(w.fd, w.serial, w.tid, w.unitId, pdu, sizeof(pdu));
+}
+
+// Read response of `words` words in wire order
+static void replyWords(const Waiter& w, uint8_t fc, const uint8_t* data, size_t words) {
+    uint8_t pdu[2 + 2 * PROXY_MAX_READ];
+    pdu[0] = fc;
+    pdu[1] = (uint8_t)(words * 2);
+    memcpy(pdu + 2, data, words * 2);
+    reply(w.fd, w.serial, w.tid, w.unitId, pdu, 2 + words * 2);
+}
+
+// decimal address of the image for a read (3xxxx input, 4xxxx holding registers), -1 if
+// the range does not fit into x0001..x9999 (it would run into the image of the other kind)
+static int imageAddr(uint8_t fc, uint16_t reg, uint16_t words) {
+    if (reg + words > 9999) return -1;
+    return (fc == 0x03 ? 40001 : 30001) + reg;
+}
+
+static bool overlaps(const WriteMark& m, uint8_t unitId, uint16_t reg, uint16_t words) {
+    return m.unitId == unitId && m.reg < reg + words && reg < m.reg + m.words;
+}
+
+// oldest receive time a cached word of the range may have (staleness bound and
+// writes); INT64_MAX while a write of the range has not been answered
+static int64_t freshSince(uint8_t unitId, uint8_t fc, uint16_t reg, uint16_t words, int64_t now) {
+    int64_t since = now - maxAgeNs;
+    if (fc != 0x03) return since;
+    for (const WriteMark& m : writeMarks) {
+        if (!overlaps(m, unitId, reg, words)) continue;
+        if (m.pending) return INT64_MAX;
+        if (m.tNs >= since) since = m.tNs + 1;
+    }
+    return since;
+}
+
+// job id of the last write of the range; reads forwarded before it cannot be shared
+static uint64_t lastWriteJob(uint8_t unitId, uint8_t fc, uint16_t reg, uint16_t words) {
+    uint64_t id = 0;
+    if (fc != 0x03) return id;
+    for (const WriteMark& m : writeMarks) {
+        if (overlaps(m, unitId, reg, words) && m.jobId > id) id = m.jobId;
+    }
+    return id;
+}
+
+// forget upstream holding register reads that overlap a written range
+static void dropCachedReads(uint8_t unitId, uint16_t reg, uint16_t words) {
+    for (auto it = readCache.begin(); it != readCache.end();) {
+        uint16_t cReg = (it->first >> 16) & 0xFFFF;
+        uint16_t cWords = it->first & 0xFFFF;
+        bool overlap = ((it->first >> 32) & 0xFF) == 0x03 && (uint8_t)(it->first >> 40) == unitId &&
+                       cReg < reg + words && reg < cReg + cWords;
+        if (overlap) it = readCache.erase(it); else ++it;
+    }
+}
+
+static bool serveFromCache(const Waiter& w, uint8_t fc, uint16_t reg, int64_t since) {
+    auto it = readCache.lower_bound(readKey(w.unitId, fc, reg >= PROXY_MAX_READ ? reg - PROXY_MAX_READ : 0, 0));
+    auto end = readCache.upper_bound(readKey(w.unitId, fc, reg, 0xFFFF));
+    for (; it != end; ++it) {
+        uint16_t cReg = (it->first >> 16) & 0xFFFF;
+        uint16_t cWords = it->first & 0xFFFF;
+        if (cReg <= reg && reg + w.words <= cReg + cWords && it->second.rxNs >= since) {
+            replyWords(w, fc, it->second.data.data() + 2 * (reg - cReg), w.words);
+            ++cacheHits;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hand a request to the polling thread; false while its queue is full
+static bool forward(uint8_t unitId, const uint8_t* pdu, size_t len, Upstream&& up) {
+    ProxyJob* job = jobs.claim();
+    if (!job) return false;
+    job->id = ++nextJobId;
+    job->unitId = unitId;
+    job->len = (uint8_t)len;
+    memcpy(job->pdu, pdu, len);
+    inflight.emplace(job->id, std::move(up));
+    jobs.publish();
+    ++forwarded;
+    return true;
+}
+
+// register range written by a request, false if it writes no holding registers
+static bool writeRange(const uint8_t* pdu, size_t len, uint16_t& reg, uint16_t& words) {
+    if (len < 5) return false;
+    uint8_t fc = pdu[0];
+    if (fc == 0x06 || fc == 0x16) {  // write single, mask write
+        reg = (uint16_t)(pdu[1] << 8 | pdu[2]);
+        words = 1;
+        return true;
+    }
+    if (fc == 0x10) {  // write multiple
+        reg = (uint16_t)(pdu[1] << 8 | pdu[2]);
+        words = (uint16_t)(pdu[3] << 8 | pdu[4]);
+        return true;
+    }
+    if (fc == 0x17 && len >= 9) {  // read/write multiple
+        reg = (uint16_t)(pdu[5] << 8 | pdu[6]);
+        words = (uint16_t)(pdu[7] << 8 | pdu[8]);
+        return true;
+    }
+    return false;
+}
+
+static void handleRequest(Conn& c, uint16_t tid, uint8_t unitId, const uint8_t* pdu, size_t len) {
+    Waiter w = { c.fd, c.serial, tid, unitId, 0, 0 };
+    uint8_t fc = pdu[0];
+    int64_t now = realtimeNs();
+
+    if (fc == 0x03 || fc == 0x04) {
+        if (len != 5) {
+            replyException(w, fc, EXC_ILLEGAL_VALUE);
+            return;
+        }
+        uint16_t reg = (uint16_t)(pdu[1] << 8 | pdu[2]);
+        w.words = (uint16_t)(pdu[3] << 8 | pdu[4]);
+        if (w.words == 0 || w.words > PROXY_MAX_READ) {
+            replyException(w, fc, EXC_ILLEGAL_VALUE);
+            return;
+        }
+        int64_t since = freshSince(unitId, fc, reg, w.words, now);
+
+        // words the polling loop keeps current
+        int addr = imageAddr(fc, reg, w.words);
+        uint16_t words[PROXY_MAX_READ];
+        if (addr >= 0 && registerImageReadFresh(unitId, (uint16_t)addr, w.words, words, since)) {
+            uint8_t data[2 * PROXY_MAX_READ];
+            for (size_t i = 0; i < w.words; ++i) {
+                data[2 * i] = words[i] >> 8;
+                data[2 * i + 1] = words[i] & 0xFF;
+            }
+            replyWords(w, fc, data, w.words);
+            ++imageHits;
+            return;
+        }
+        // an earlier upstream read
+        if (serveFromCache(w, fc, reg, since)) return;
+
+        // an upstream read in flight that covers the range (single flight), sent after any write of it
+        uint64_t writeJob = lastWriteJob(unitId, fc, reg, w.words);
+        for (auto& [id, up] : inflight) {
+            if (id > writeJob && up.read && up.fc == fc && up.unitId == unitId && up.reg <= reg &&
+                reg + w.words <= up.reg + up.words) {
+                w.offset = reg - up.reg;
+                up.waiters.push_back(w);
+                ++coalesced;
+                return;
+            }
+        }
+        Upstream up = { unitId, fc, true, reg, w.words, { w } };
+        if (!forward(unitId, pdu, len, std::move(up))) replyException(w, fc, EXC_BUSY);
+        return;
+    }
+
+    // everything else goes through as is, in order (the polling thread runs one at a time)
+    Upstream up = { unitId, fc, false, 0, 0, { w } };
+    if (!forward(unitId, pdu, len, std::move(up))) {
+        replyException(w, fc, EXC_BUSY);
+        return;
+    }
+    uint16_t reg, words;
+    if (writeRange(pdu, len, reg, words)) {
+        // the range is stale until the dongle has answered the write (see completeJobs)
+        writeMarks.push_back({ unitId, reg, words, nextJobId, true, 0 });
+        dropCachedReads(unitId, reg, words);
+    }
+}
+
+// Answer the waiters of completed upstream requests
+static void completeJobs() {
+    while (ProxyDone* d = done.peek()) {
+        auto it = inflight.find(d->id);
+        if (it != inflight.end()) {
+            Upstream& up = it->second;
+            bool readOk = up.read && d->len >= 2 && d->pdu[0] == up.fc && d->pdu[1] == 2 * up.words &&
+                          d->len == 2 + 2 * up.words;
+            bool exception = d->len >= 2 && (d->pdu[0] & 0x80);
+            for (const Waiter& w : up.waiters) {
+                if (readOk) {
+                    replyWords(w, up.fc, d->pdu + 2 + 2 * w.offset, w.words);
+                } else if (d->len > 0 && (!up.read || exception)) {
+                    reply(w.fd, w.serial, w.tid, w.unitId, d->pdu, d->len);  // exceptions and pass-through
+                } else {
+                    // no response, or a read response that does not match the request
+                    replyException(w, up.fc, EXC_TARGET_FAILED);
+                }
+            }
+            if (!up.read) {
+                // a write is done: words received before its response are stale, including
+                // reads that were queued ahead of it and cached meanwhile
+                for (WriteMark& m : writeMarks) {
+                    if (m.jobId != d->id) continue;
+                    m.pending = false;
+                    m.tNs = d->rxNs ? d->rxNs : realtimeNs();
+                    dropCachedReads(m.unitId, m.reg, m.words);
+                }
+            }
+            if (readOk) {
+                CachedRead& cached = readCache[readKey(up.unitId, up.fc, up.reg, up.words)];
+                cached.rxNs = d->rxNs;
+                cached.data.assign(d->pdu + 2, d->pdu + d->len);
+            }
+            inflight.erase(it);
+        }
+        done.pop();
+    }
+}
+
+// drop cache entries and write marks older than the staleness bound (writes not answered yet stay)
+static void prune() {
+    int64_t since = realtimeNs() - maxAgeNs;
+    for (auto it = readCache.begin(); it != readCache.end();) {
+        if (it->second.rxNs < since) it = readCache.erase(it); else ++it;
+    }
+    size_t n = 0;
+    for (const WriteMark& m : writeMarks) {
+        if (m.pending || m.tNs >= since) writeMarks[n++] = m;
+    }
+    writeMarks.resize(n);
+}
+
+static void closeConn(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns[fd].reset();
+    --connCount;
+}
+
+// Send queued output; false if the connection failed
+static bool flush(Conn& c) {
+    while (!c.out.empty()) {
+        ssize_t w = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        c.out.erase(0, w);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (c.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+    ev.data.fd = c.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+    return true;
+}
+
+// Read and handle complete ADUs; false if the connection is closed or broken
+static bool onReadable(Conn& c) {
+    char buf[4096];
+    for (;;) {
+        ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+        if (r > 0) {
+            c.in.append(buf, r);
+            continue;
+        }
+        if (r == 0) return false;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+    size_t pos = 0;
+    while (c.in.size() - pos >= 8) {
+        const uint8_t* p = (const uint8_t*)c.in.data() + pos;
+        uint16_t len = (uint16_t)(p[4] << 8 | p[5]);
+        if (p[2] != 0 || p[3] != 0 || len < 2 || len > 254) return false;  // not Modbus TCP
+        if (c.in.size() - pos < 6u + len) break;
+        handleRequest(c, (uint16_t)(p[0] << 8 | p[1]), p[6], p + 7, len - 1);
+        pos += 6 + len;
+    }
+    c.in.erase(0, pos);
+    return true;
+}
+
+static void acceptConns() {
+    for (;;) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (connCount >= maxConns) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((size_t)fd >= conns.size()) conns.resize(fd + 1);
+        conns[fd].reset(new Conn());
+        conns[fd]->fd = fd;
+        conns[fd]->serial = ++nextSerial;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        ++connCount;
+    }
+}
+
+static void run() {
+    pipelineThreadSetup("modbus-proxy", -1);
+    struct epoll_event events[64];
+    int64_t lastPrune = realtimeNs();
+    while (running) {
+        int n = epoll_wait(epollFd, events, 64, 200);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                acceptConns();
+            } else if (fd == wakeFd) {
+                uint64_t v;
+                if (read(wakeFd, &v, sizeof(v)) < 0) {}
+                completeJobs();
+            } else if ((size_t)fd < conns.size() && conns[fd]) {
+                Conn& c = *conns[fd];
+                bool ok = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (ok && (events[i].events & EPOLLIN)) ok = onReadable(c);
+                if (!ok) closeConn(fd);
+            }
+        }
+        // send what the requests and completions above queued
+        for (auto& c : conns) {
+            if (c && !c->out.empty() && !flush(*c)) closeConn(c->fd);
+        }
+        int64_t now = realtimeNs();
+        if (now - lastPrune >= 1000000000LL) {
+            lastPrune = now;
+            prune();
+        }
+    }
+}
+
+bool modbusProxyStart(const char* addr, int port, size_t maxConnections, unsigned maxAgeMs) {
+    maxConns = maxConnections;
+    maxAgeNs = (int64_t)maxAgeMs * 1000000;
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) return false;
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1 ||
+        bind(listenFd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(listenFd, 32) != 0) {
+        LOG_ERROR("Cannot listen on %s:%d: %s", addr, port, strerror(errno));
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+    running = true;
+    proxyThread = std::thread(run);
+    LOG("Modbus proxy listening on %s:%d (max age %u ms)", addr, port, maxAgeMs);
+    return true;
+}
+
+void modbusProxyStop() {
+    if (!running.exchange(false)) return;
+    proxyThread.join();
+    for (auto& c : conns) {
+        if (c) close(c->fd);
+    }
+    conns.clear();
+    connCount = 0;
+    close(epollFd);
+    close(listenFd);
+    close(wakeFd);
+    epollFd = listenFd = wakeFd = -1;
+    LOG("Modbus proxy: %llu reads from the image, %llu from earlier responses, %llu coalesced, %llu forwarded",
+        (unsigned long long)imageHits, (unsigned long long)cacheHits, (unsigned long long)coalesced,
+        (unsigned long long)forwarded);
+}
+
+size_t modbusProxyForward() {
+    if (!running) return 0;
+    // one blocking round trip per call, so a burst of misses cannot hold up a sweep
+    ProxyJob* job = jobs.peek();
+    if (!job) return 0;
+    ProxyDone* d = done.claim();
+    if (!d) return 0;  // proxy thread behind: forward it later
+    ModbusFrame frame;
+    modbusForwardRequest(job->unitId, job->pdu, job->len, &frame);
+    d->id = job->id;
+    d->rxNs = frame.len ? frame.rxNs : 0;
+    // response PDU after the MBAP header
+    d->len = frame.len > 7 ? (uint8_t)(frame.len - 7) : 0;
+    memcpy(d->pdu, frame.data + 7, d->len);
+    done.publish();
+    jobs.pop();
+    uint64_t v = 1;
+    if (write(wakeFd, &v, sizeof(v)) < 0) {}
+    return 1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Modbus TCP server for other clients of the inverter (home automation, ...),
+// so the dongle keeps seeing a single client.
+//
+// Reads (FC03/FC04) are answered from the register image of the polling loop
+// when every requested word was received within the staleness bound. Other
+// reads go to the dongle through the polling thread between its own
+// transactions; concurrent reads of the same or a covered range share one
+// upstream request (single flight), and its response answers later reads
+// within the bound too. Writes and all other function codes are passed
+// through one at a time in arrival order; a register write makes the cached
+// words of its range stale.
+
+// Listen on addr:port on a thread of its own; maxAgeMs is the staleness bound
+bool modbusProxyStart(const char* addr, int port, size_t maxConnections, unsigned maxAgeMs);
+void modbusProxyStop();
+
+/**
+ * Polling thread: forward the oldest queued upstream request of a proxy
+ * client (modbusForwardRequest) and hand the response back; the others stay
+ * queued for the next call. Call between transactions. Returns the number of
+ * requests forwarded (0 or 1).
+ */
+size_t modbusProxyForward();
@@ -1,305 +1,26 @@
 #include "modbus_registers.h"
+#include "modbus_client.h"
 
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-
-#include <unistd.h>
-#include <stdio.h>
-
-// Logging helper
-#define LOG(fmt, ...) printf("[%s] " fmt "\n", __FUNCTION__, ##__VA_ARGS__)
-
-// Modbus TCP configuration
-#include "modbus_config.h"
-
-
-// ModbusTCP socket handle
-int modbusSocket = -1;
-
-static uint16_t transactionId = 0;   // id of current transaction to match register responses
-static uint16_t transactionAddr = 0;  // first register address of current transaction
-
-// decode a single Modbus response and publish a human friendly payload to MQTT (defined in main.cpp)
-void decodeAndPublish(uint8_t unitId, uint16_t addr, uint8_t* data, size_t length);
-
-// table extracted from chapter 3.3 of MB001_ASW GEN-Modbus-en_V2.1.1.
-// addr = decimal AISWEI address, length = number of 16-bit registers
-// name = first line of description, type, unit, gain, access
-const RegisterInfo AISWEI_REGISTERS[] = {
-    {31001, 1,  "Device Type",               "String",    NULL, 1.0f, "RO"},
-    {31002, 1,  "Modbus address",            "U16",       NULL, 1.0f, "RO"},
-    {31003, 16, "Serial Number",             "String",    NULL, 1.0f, "RO"},
-    {31019, 8,  "Machine type",              "String",    NULL, 1.0f, "RO"},
-    {31027, 1,  "Current grid code",         "E16",       NULL, 1.0f, "RO"},
-    {31028, 2,  "Rated Power",               "U32",       "W",  1.0f, "RO"},
-    {31030, 7,  "Software Version",          "String",    NULL, 1.0f, "RO"},
-    {31044, 7,  "Safety Version",            "String",    NULL, 1.0f, "RO"},
-    {31057, 8,  "Manufacturer's name",       "String",    NULL, 1.0f, "RO"},
-    {31065, 8,  "Brand name",                "String",    NULL, 1.0f, "RO"},
-
-    {31301, 1,  "Grid rated voltage",        "U16",       "V",  0.1f, "RO"},
-    {31302, 1,  "Grid rated frequency",      "U16",       "Hz", 0.01f,"RO"},
-    {31303, 2,  "E-Today of inverter",       "U32",       "kWh",0.1f, "RO"},
-    {31305, 2,  "E-Total of inverter",       "U32",       "kWh",0.1f, "RO"},
-    {31307, 2,  "H-Total",                   "U32",       "H",  1.0f, "RO"},
-    {31309, 1,  "Device State",              "E16",       NULL, 1.0f, "RO"},
-    {31310, 1,  "Connect time",              "U16",       "s",  1.0f, "RO"},
-
-    {31311, 1,  "Air temperature",           "S16",       "C",  0.1f, "RO"},
-    {31312, 1,  "Inverter U phase temp",     "S16",       "C",  0.1f, "RO"},
-    {31313, 1,  "Inverter V phase temp",     "S16",       "C",  0.1f, "RO"},
-    {31314, 1,  "Inverter W phase temp",     "S16",       "C",  0.1f, "RO"},
-    {31315, 1,  "Boost temperature",         "S16",       "C",  0.1f, "RO"},
-    {31316, 1,  "Bidirectional DC/DC temp",  "S16",       "C",  0.1f, "RO"},
-    {31317, 1,  "Bus voltage",               "U16",       "V",  0.1f, "RO"},
-
-    {31319, 1,  "PV1 voltage",               "U16",       "V",  0.1f, "RO"},
-    {31320, 1,  "PV1 current",               "U16",       "A",  0.01f,"RO"},
-    {31321, 1,  "PV2 voltage",               "U16",       "V",  0.1f, "RO"},
-    {31322, 1,  "PV2 current",               "U16",       "A",  0.01f,"RO"},
-    {31323, 1,  "PV3 voltage",               "U16",       "V",  0.1f, "RO"},
-    {31324, 1,  "PV3 current",               "U16",       "A",  0.01f,"RO"},
-    {31325, 1,  "PV4 voltage",               "U16",       "V",  0.1f, "RO"},
-    {31326, 1,  "PV4 current",               "U16",       "A",  0.01f,"RO"},
-    {31327, 1,  "PV5 voltage",               "U16",       "V",  0.1f, "RO"},
-    {31328, 1,  "PV5 current",               "U16",       "A",  0.01f,"RO"},
-
-    {31339, 1,  "String 1 current",          "U16",       "A",  0.1f, "RO"},
-    {31340, 1,  "String 2 current",          "U16",       "A",  0.1f, "RO"},
-    {31341, 1,  "String 3 current",          "U16",       "A",  0.1f, "RO"},
-    {31342, 1,  "String 4 current",          "U16",       "A",  0.1f, "RO"},
-    {31343, 1,  "String 5 current",          "U16",       "A",  0.1f, "RO"},
-    {31344, 1,  "String 6 current",          "U16",       "A",  0.1f, "RO"},
-    {31345, 1,  "String 7 current",          "U16",       "A",  0.1f, "RO"},
-    {31346, 1,  "String 8 current",          "U16",       "A",  0.1f, "RO"},
-    {31347, 1,  "String 9 current",          "U16",       "A",  0.1f, "RO"},
-    {31348, 1,  "String 10 current",         "U16",       "A",  0.1f, "RO"},
-
-    {31359, 1,  "L1 Phase voltage",          "U16",       "V",  0.1f, "RO"},
-    {31360, 1,  "L1 Phase current",          "U16",       "A",  0.1f, "RO"},
-    {31361, 1,  "L2 Phase voltage",          "U16",       "V",  0.1f, "RO"},
-    {31362, 1,  "L2 Phase current",          "U16",       "A",  0.1f, "RO"},
-    {31363, 1,  "L3 Phase voltage",          "U16",       "V",  0.1f, "RO"},
-    {31364, 1,  "L3 Phase current",          "U16",       "A",  0.1f, "RO"},
-    {31365, 1,  "RS Line voltage",           "U16",       "V",  0.1f, "RO"},
-    {31366, 1,  "RT Line voltage",           "U16",       "V",  0.1f, "RO"},
-    {31367, 1,  "ST Line voltage",           "U16",       "V",  0.1f, "RO"},
-
-    {31368, 1,  "Grid frequency",            "U16",       "Hz", 0.01f,"RO"},
-    {31369, 2,  "Apparent power",            "U32",       "VA", 1.0f, "RO"},
-    {31371, 2,  "Active power",              "U32",       "W",  1.0f, "RO"},
-    {31373, 2,  "Reactive power",            "S32",       "Var",1.0f, "RO"},
-    {31375, 1,  "Power factor",              "S16",       NULL, 0.01f,"RO"},
-    {31378, 1,  "Error message",             "E16",       NULL, 1.0f, "RO"},
-    {31379, 1,  "Warning message",           "E16",       NULL, 1.0f, "RO"},
-
-    {31601, 2,  "PV total power",            "U32",       "W",  1.0f, "RO"},
-    {31603, 2,  "PV E-Today",                "U32",       "kWh",0.1f, "RO"},
-    {31605, 2,  "PV E-Total",                "U32",       "kWh",0.1f, "RO"},
-    {31607, 1,  "Battery communication status","E16",     NULL, 1.0f, "RO"},
-    {31608, 1,  "Battery status",            "E16",       NULL, 1.0f, "RO"},
-    {31609, 1,  "Battery error status",      "B16",       NULL, 1.0f, "RO"},
-    {31613, 1,  "Battery warning status",    "B16",       NULL, 1.0f, "RO"},
-    {31617, 1,  "Battery voltage",           "U16",       "V",  0.01f,"RO"},
-    {31618, 1,  "Battery current",           "S16",       "A",  0.1f, "RO"},
-    {31619, 2,  "Battery power",             "S32",       "W",  1.0f, "RO"},
-    {31621, 1,  "Battery temperature",       "S16",       "C",  0.1f, "RO"},
-    {31622, 1,  "Battery SOC",               "U16",       NULL, 0.01f,"RO"},
-    {31623, 1,  "Battery SOH",               "U16",       NULL, 0.01f,"RO"},
-    {31624, 1,  "Battery charging current limit", "U16",  "A",  0.1f, "RO"},
-    {31625, 1,  "Battery discharge current limit", "U16", "A",  0.1f, "RO"},
-    {31626, 2,  "Battery E-Charge-Today",    "U32",       "kWh",0.1f, "RO"},
-    {31628, 2,  "Battery E-Discharge-Today", "U32",       "kWh",0.1f, "RO"},
-    {31630, 2,  "E-Consumption-Today at AC side", "U32",  "kWh",0.1f, "RO"},
-    {31632, 2,  "E-Generation-Today at AC side", "U32",   "kWh",0.1f, "RO"},
-    {31634, 1,  "EPS load voltage",          "U16",       "V",  0.1f, "RO"},
-    {31635, 1,  "EPS load current",          "U16",       "A",  0.1f, "RO"},
-    {31636, 1,  "EPS load frequency",        "U16",       "Hz", 0.01f,"RO"},
-    {31637, 2,  "EPS load active power",     "U32",       "W",  1.0f, "RO"},
-    {31639, 2,  "EPS load reactive power",   "U32",       "Var",1.0f, "RO"},
-    {31641, 2,  "E-Consumption-Today at EPS load side", "U32", "kWh", 0.1f, "RO"},
-    {31643, 2,  "E-Consumption-Total at EPS load side", "U32",  "kWh",0.1f, "RO"},
-
-    /* Holding registers */
-    {40201, 1,  "Remote switch command",     "E16",       NULL, 1.0f, "RW"},
-    {41001, 1,  "RTC:Year",                  "U16",       NULL, 1.0f, "RW"},
-    {41002, 1,  "RTC:Month",                 "U16",       NULL, 1.0f, "RW"},
-    {41003, 1,  "RTC:Day",                   "U16",       NULL, 1.0f, "RW"},
-    {41004, 1,  "RTC:Hour",                  "U16",       NULL, 1.0f, "RW"},
-    {41005, 1,  "RTC:Minute",                "U16",       NULL, 1.0f, "RW"},
-    {41006, 1,  "RTC:Seconds",               "U16",       NULL, 1.0f, "RW"},
-
-    /* storage / inverter control area */
-    {41102, 1,  "Storage Inverter Switch",   "E16",       NULL, 1.0f, "RW"},
-    {41103, 1,  "Type selection of energy storage machine", "E16", NULL, 1.0f, "RW"},
-    {41104, 1,  "Run mode",                  "E16",       NULL, 1.0f, "RW"},
-    {41105, 1,  "Battery manufacturer",      "E16",       NULL, 1.0f, "RW"},
-    {41108, 1,  "Smart meter status",        "E16",       NULL, 1.0f, "RW"},
-    {41109, 1,  "Smart meter adjustment flag bit", "E16", NULL, 1.0f, "RW"},
-    {41110, 2,  "Set target power value",    "S32",       "W",  1.0f, "RW"},
-    {41112, 2,  "Current power value of smart meter", "S32", "W", 1.0f, "RW"},
-    {41114, 1,  "Anti reverse current flag", "E16",       NULL, 1.0f, "RW"},
-    {41115, 1,  "Battery wake-up (Force charge) sign", "E16", NULL, 1.0f, "RW"},
-    {41151, 1,  "Commbox and cloud communication status", "E16", NULL, 1.0f, "RW"},
-    {41152, 1,  "Charge discharge flag bit", "E16",       NULL, 1.0f, "RW"},
-    {41153, 1,  "Charge and discharge power command", "S16", "W", 1.0f, "RW"},
-
-    /* 44xxx control group */
-    {44001, 1,  "Active power control function", "E16",   NULL, 1.0f, "RW"},
-    {44002, 1,  "EEG control function",      "E16",       NULL, 1.0f, "RW"},
-    {44003, 1,  "Slope load function",       "E16",       NULL, 1.0f, "RW"},
-    {44004, 1,  "Overvoltage reduce power function", "E16", NULL, 1.0f, "RW"},
-    {44005, 1,  "Overfrequency reduce power function", "E16", NULL, 1.0f, "RW"},
-    {44006, 1,  "Reactive power control function", "E16", NULL, 1.0f, "RW"},
-    {44007, 1,  "LVRT Function",             "E16",       NULL, 1.0f, "RW"},
-    {44009, 1,  "10 Minutes Average Overvoltage protect function", "E16", NULL, 1.0f, "RW"},
-    {44010, 1,  "Islanding protect function", "E16",      NULL, 1.0f, "RW"},
-    {44012, 1,  "PE connection check function", "E16",     NULL, 1.0f, "RW"},
-    {44017, 1,  "Overload function",         "E16",       NULL, 1.0f, "RW"},
-    {44025, 1,  "Shadow MPPT function",      "E16",       NULL, 1.0f, "RW"},
-
-    /* 45xxx grid code & limits */
-    {45201, 1,  "Grid code",                 "E16",       NULL, 1.0f, "RW"},
-    {45202, 1,  "Overvoltage protection value 3", "U16", "V", 0.1f, "RW"},
-    {45203, 1,  "Overvoltage protection value 2", "U16", "V", 0.1f, "RW"},
-    {45204, 1,  "Overvoltage protection value (freq?)", "U16","Hz",0.01f,"RW"},
-    {45205, 1,  "Underfrequency protection value", "U16","Hz",0.01f,"RW"},
-    {45206, 1,  "Grid Voltage High Limit3",  "U16",       "V",  0.1f, "RW"},
-    {45207, 2,  "Grid Voltage High Limit Time3", "U32","ms", 1.0f, "RW"},
-    {45209, 1,  "Grid Voltage High Limit2",  "U16",       "V",  0.1f, "RW"},
-    {45210, 2,  "Grid Voltage High Limit Time2", "U32","ms", 1.0f, "RW"},
-    {45212, 1,  "Grid Voltage High Limit1",  "U16",       "V",  0.1f, "RW"},
-    {45213, 2,  "Grid Voltage High Limit Time1", "U32","ms", 1.0f, "RW"},
-    {45215, 1,  "Grid Voltage Low Limit3",   "U16",       "V",  0.1f, "RW"},
-    {45216, 2,  "Grid Voltage Low Limit Time3", "U32","ms", 1.0f, "RW"},
-    {45218, 1,  "Grid Voltage Low Limit2",   "U16",       "V",  0.1f, "RW"},
-    {45219, 2,  "Grid Voltage Low Limit Time2", "U32","ms", 1.0f, "RW"},
-    {45221, 1,  "Grid Voltage Low Limit1",   "U16",       "V",  0.1f, "RW"},
-    {45222, 2,  "Grid Voltage Low Limit Time1", "U32","ms", 1.0f, "RW"},
-    {45224, 1,  "10 Minutes Average Overvoltage Threshold", "U16","V",0.1f,"RW"},
-    {45225, 1,  "10 Minutes Average Overvoltage Protect Time", "U16","ms",1.0f,"RW"},
-    {45226, 1,  "Overvoltage recover value", "U16",       "V",  0.1f, "RW"},
-    {45227, 1,  "Undervoltage recover value","U16",       "V",  0.1f, "RW"},
-    {45228, 1,  "Grid Frequency High Limit3","U16",       "Hz", 0.01f,"RW"},
-    {45229, 2,  "Grid Frequency High Limit Time3", "U32","ms",1.0f,"RW"},
-    {45231, 1,  "Grid Frequency High Limit2","U16",       "Hz", 0.01f,"RW"},
-    {45232, 2,  "Grid Frequency High Limit Time2", "U32","ms",1.0f,"RW"},
-    {45234, 1,  "Grid Frequency High Limit1","U16",       "Hz", 0.01f,"RW"},
-    {45235, 2,  "Grid Frequency High Limit Time1", "U32","ms",1.0f,"RW"},
-    {45237, 1,  "Grid Frequency Low Limit3", "U16",       "Hz", 0.01f,"RW"},
-    {45238, 2,  "Grid Frequency Low Limit Time3", "U32","ms",1.0f,"RW"},
-    {45240, 1,  "Grid Frequency Low Limit2", "U16",       "Hz", 0.01f,"RW"},
-    {45241, 2,  "Grid Frequency Low Limit Time2", "U32","ms",1.0f,"RW"},
-    {45243, 1,  "Grid Frequency Low Limit1", "U16",       "Hz", 0.01f,"RW"},
-    {45244, 2,  "Grid Frequency Low Limit Time1", "U32","ms",1.0f,"RW"},
-    {45246, 1,  "Vary rate of Frequency protect value", "U16","Hz/s",0.01f,"RW"},
-    {45247, 2,  "Vary rate of Frequency protect time", "U32","ms",1.0f,"RW"},
-    {45249, 1,  "Overfrequency recover value", "U16",     "Hz", 0.01f,"RW"},
-    {45250, 1,  "Underfrequency recover value","U16",     "Hz", 0.01f,"RW"},
-    {45251, 1,  "Time of first connection to grid","U16",  "s",  1.0f, "RW"},
-    {45252, 1,  "Time of re-connection to grid","U16",    "s",  1.0f, "RW"},
-    {45253, 1,  "ISO protect threshold",     "U16",       "kΩ", 1.0f, "RW"},
-    {45254, 1,  "DCI protect threshold",     "U16",       "mA", 1.0f, "RW"},
-    {45255, 1,  "DCI protect time",         "U16",       "ms", 1.0f, "RW"},
-
-    /* 454xx active power / rate / control */
-    {45401, 1,  "Load rate of first connection to grid", "U16", "%Pn/min", 1.0f, "RW"},
-    {45402, 1,  "Load rate of re-connection to grid", "U16", "%Pn/min", 1.0f, "RW"},
-    {45403, 1,  "Active Power Set",         "U16",       "%Pn", 0.01f, "RW"},
-    {45404, 1,  "Increase rate of active power", "U16","%Pn/min",0.01f,"RW"},
-    {45405, 1,  "Decrease rate of active power", "U16","%Pn/min",0.01f,"RW"},
-    {45408, 1,  "Over frequency reduce power mode", "E16", NULL, 1.0f, "RW"},
-    {45409, 1,  "Over frequency reduce power Start frequency", "U16","Hz",0.01f,"RW"},
-    {45410, 1,  "Over frequency reduce power Stop frequency",  "U16","Hz",0.01f,"RW"},
-    {45411, 1,  "Over frequency reduce power Back frequency",  "U16","Hz",0.01f,"RW"},
-    {45412, 1,  "The reduce ratio of over frequency reduce power", "U16","%Pnor%Pm",0.01f,"RW"},
-    {45413, 1,  "Over frequency reduce power :reduce power delay time", "U16","s",0.1f,"RW"},
-    {45414, 1,  "Over frequency reduce power:recover power delay time", "U16","s",0.1f,"RW"},
-    {45416, 1,  "Speed of Over frequency recover to Pn", "U16","%Pn/min",0.01f,"RW"},
-    {45417, 1,  "Over frequency reduce power : 0 power frequency point", "U16","Hz",0.01f,"RW"},
-
-    /* 45419.. overvoltage reduce power */
-    {45419, 1,  "Over voltage reduce power mode", "E16", NULL, 1.0f, "RW"},
-    {45420, 1,  "Over voltage reduce power Start voltage", "U16","%Un",0.01f,"RW"},
-    {45422, 1,  "Over voltage reduce power Stop voltage", "U16","%Un",0.01f,"RW"},
-    {45424, 1,  "Over voltage reduce power Back voltage", "U16","%Un",0.01f,"RW"},
-    {45426, 1,  "The reduce ratio of over voltage reduce power", "U16","%Pnor%Pm",0.01f,"RW"},
-    {45427, 1,  "Over voltage reduce power delay time", "U16","s",0.1f,"RW"},
-    {45428, 1,  "Over voltage recover power delay time", "U16","s",0.1f,"RW"},
-    {45429, 1,  "Speed of Over voltage recover to Pn", "U16","%Pn/min",0.01f,"RW"},
-
-    /* 45432.. Under/Over frequency groups, DRMs etc (some repeated in doc) */
-    {45432, 1,  "Under frequency increase power mode", "E16", NULL, 1.0f, "RW"},
-    {45433, 1,  "Under frequency increase power: Start frequency", "U16", "Hz", 0.01f, "RW"},
-    {45434, 1,  "Under frequency increase power: Stop frequency",  "U16", "Hz", 0.01f, "RW"},
-    {45435, 1,  "Under frequency increase power: Back frequency",  "U16", "Hz", 0.01f, "RW"},
-    {45436, 1,  "The increase ratio of under frequency increase power", "U16", "%Pnor%Pm", 0.01f, "RW"},
-    {45437, 1,  "Under frequency increase power: delay time", "U16", "s", 0.1f, "RW"},
-    {45438, 1,  "Under frequency recover power: delay time", "U16", "s", 0.1f, "RW"},
-    {45440, 1,  "Speed of Under frequency recover to Pn", "U16", "%Pn/min", 0.01f, "RW"},
-    {45441, 1,  "Under frequency increase power: 0 power frequency point", "U16", "Hz", 0.01f, "RW"},
-
-    /* Under-voltage increase power group (45443..45450) */
-    {45443, 1,  "Under voltage increase power mode", "E16", NULL, 1.0f, "RW"},
-    {45444, 1,  "Under voltage increase power: Start voltage", "U16", "%Un", 0.01f, "RW"},
-    {45445, 1,  "Under voltage increase power: Stop voltage",  "U16", "%Un", 0.01f, "RW"},
-    {45446, 1,  "Under voltage increase power: Back voltage",  "U16", "%Un", 0.01f, "RW"},
-    {45447, 1,  "The increase ratio of under voltage increase power", "U16", "%Pnor%Pm", 0.01f, "RW"},
-    {45448, 1,  "Under voltage increase power: delay time", "U16", "s", 0.1f, "RW"},
-    {45449, 1,  "Under voltage increase power: delay time 2", "U16", "s", 0.1f, "RW"},
-    {45450, 1,  "Speed of under voltage recover to Pn", "U16", "%Pn/min", 0.01f, "RW"},
-
-    /* DRMs / Pav entries */
-    {45451, 1,  "Pav", "S16", "%Pn", 0.01f, "RW"},
-    {45452, 1,  "DRMs Pval", "U16", "%Pn", 0.01f, "RW"},
-
-    /* 455xx reactive/power-factor control */
-    {45501, 1,  "Reactive power control mode", "E16", NULL, 1.0f, "RW"},
-    {45502, 1,  "Time constant of reactive power curve", "U16","s",1.0f,"RW"},
-    {45503, 1,  "Power factor",              "S16",       NULL, 0.0001f, "RW"},
-    {45504, 1,  "cos φ(P) curve: Active power first point", "U16","%Pn",0.01f,"RW"},
-    {45505, 1,  "cos φ(P) curve: cos φ of first point", "S16", NULL, 0.0001f, "RW"},
-    {45506, 1,  "cos φ(P) curve: Active power second point", "U16","%Pn",0.01f,"RW"},
-    {45507, 1,  "cos φ(P) curve: cos φ of second point", "S16", NULL, 0.0001f, "RW"},
-    {45508, 1,  "cos φ(P) curve: Active power third point", "U16","%Pn",0.01f,"RW"},
-    {45509, 1,  "cos φ(P) curve: cos φ of third point", "S16", NULL, 0.0001f, "RW"},
-    {45510, 1,  "cos φ(P) curve: Active power fourth point", "U16","%Pn",0.01f,"RW"},
-    {45511, 1,  "cos φ(P) curve: cos φ of fourth point", "S16", NULL, 0.0001f, "RW"},
-    {45512, 1,  "Lock in voltage (for cos φ(P) curve)", "U16","%Un",0.01f,"RW"},
-    {45513, 1,  "Lock out voltage (for cos φ(P) curve)", "U16","%Un",0.01f,"RW"},
-    {45516, 1,  "Q Set Value",               "S16",       "%Sn", 0.01f, "RW"},
-    {45518, 1,  "Q(U) curve: U of the first point", "U16","%Un",0.01f,"RW"},
-    {45519, 1,  "Q(U) curve: Q of the first point", "S16","%Sn",0.01f,"RW"},
-    {45520, 1,  "Q(U) curve: U of the second point", "U16","%Un",0.01f,"RW"},
-    {45521, 1,  "Q(U) curve: Q of the second point", "S16","%Sn",0.01f,"RW"},
-    {45522, 1,  "Q(U) curve: U of the third point", "U16","%Un",0.01f,"RW"},
-    {45523, 1,  "Q(U) curve: Q of the third point", "S16","%Sn",0.01f,"RW"},
-    {45524, 1,  "Q(U) curve: U of the fourth point", "U16","%Un",0.01f,"RW"},
-    {45525, 1,  "Q(U) curve: Q of the fourth point", "S16","%Sn",0.01f,"RW"},
-    {45526, 1,  "Lock in power (for Q(U) curve)", "U16","%Pn",0.01f,"RW"},
-    {45527, 1,  "Lock out power (for Q(U) curve)", "U16","%Pn",0.01f,"RW"},
-
-    {45606, 1,  "LVRT Trigger voltage",      "U16",       "%Un", 0.01f, "RW"},
-    {45609, 1,  "LVRT active power limit mode", "E16",    NULL, 1.0f, "RW"},
-};
-
-// const RegisterInfo *aiswei_registers = AISWEI_REGISTERS;
-RegisterInfo aiswei_registers[20000];
-
-// define count of entries
-// const size_t aiswei_registers_count = sizeof(AISWEI_REGISTERS) / sizeof(AISWEI_REGISTERS[0]);
-const size_t aiswei_registers_count = sizeof(aiswei_registers) / sizeof(aiswei_registers[0]);
 
+// register table, installed by the register map loader (register_map.cpp)
+RegisterInfo* aiswei_registers = nullptr;
+size_t aiswei_registers_count = 0;
 
 int aiswei_find_register_index(uint16_t addr_dec) {
-    for (size_t i = 0; i < aiswei_registers_count; ++i) {
-        uint16_t start = aiswei_registers[i].addr;
-        uint16_t end = start + (aiswei_registers[i].length > 0 ? (aiswei_registers[i].length - 1) : 0);
-        if (addr_dec >= start && addr_dec <= end) return (int)i;
+    return registerTableFind(aiswei_registers, aiswei_registers_count, addr_dec);
+}
+
+int registerTableFind(const RegisterInfo* regs, size_t count, uint16_t addr_dec) {
+    // last entry starting at or below addr_dec
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (regs[mid].addr <= addr_dec) lo = mid + 1; else hi = mid;
     }
-    return -1;
+    if (lo == 0) return -1;
+    const RegisterInfo &r = regs[lo - 1];
+    uint32_t end = (uint32_t)r.addr + (r.length > 0 ? r.length - 1 : 0);
+    return addr_dec <= end ? (int)(lo - 1) : -1;
 }
 
 // Convert AISWEI decimal address (e.g. 31001) to Modbus register index:
@@ -309,279 +30,78 @@ uint16_t aiswei_dec2reg(uint16_t addr_dec) {
     return (v == 0) ? 9999 : (v - 1);
 }
 
-// Modbus TCP connection management
-static bool connectModbusTCP() {
-    if (modbusSocket != -1) {
-        return true;  // already connected
-    }
-
-    const char *server = MODBUS_SERVER;
-    int port = MODBUS_PORT;
+// The free functions below act on the default client (modbus_client.h)
 
-    struct hostent* host = gethostbyname(server);
-    if (!host) {
-        LOG("Failed to resolve hostname: %s", server);
-        return false;
-    }
-
-    modbusSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (modbusSocket < 0) {
-        LOG("Failed to create socket");
-        return false;
-    }
-
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = ((struct in_addr*)host->h_addr)->s_addr;
-
-    if (connect(modbusSocket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        LOG("Failed to connect to Modbus TCP server %s:%d", server, port);
-        close(modbusSocket);
-        modbusSocket = -1;
-        return false;
-    }
-
-    LOG("Connected to Modbus TCP server %s:%d", server, port);
-    return true;
+uint32_t modbusReconnectCount() {
+    return modbusDefaultClient().reconnectCount();
 }
 
-void cleanupModbusTCP() {
-    if (modbusSocket != -1) {
-        close(modbusSocket);
-        modbusSocket = -1;
-        LOG("Modbus TCP connection closed");
-    }
+void setModbusServer(const char* host, int port) {
+    modbusDefaultClient().setServer(host, port);
 }
 
-// Modbus TCP read request builder and sender (no address translation)
-static bool sendModbusTCPRequest(uint8_t unitId, uint8_t functionCode, uint16_t startAddress, uint16_t quantity) {
-    if (!connectModbusTCP()) {
-        return false;
-    }
-
-    // Build Modbus TCP frame
-    uint8_t frame[12];
-    uint16_t tid = ++transactionId;
-    
-    // MBAP Header (7 bytes)
-    frame[0] = (tid >> 8) & 0xFF;           // Transaction ID (high)
-    frame[1] = tid & 0xFF;                  // Transaction ID (low)
-    frame[2] = 0x00;                        // Protocol ID (high) = 0
-    frame[3] = 0x00;                        // Protocol ID (low) = 0
-    frame[4] = 0x00;                        // Length (high) = 6 bytes
-    frame[5] = 0x06;                        // Length (low)
-    frame[6] = unitId;                      // Unit ID
-    
-    // PDU (5 bytes)
-    frame[7] = functionCode;                // Function code (0x03 = Read Holding Registers)
-    frame[8] = (startAddress >> 8) & 0xFF;  // Starting Address (high)
-    frame[9] = startAddress & 0xFF;         // Starting Address (low)
-    frame[10] = (quantity >> 8) & 0xFF;     // Quantity (high)
-    frame[11] = quantity & 0xFF;            // Quantity (low)
-
-    if (send(modbusSocket, frame, sizeof(frame), 0) < 0) {
-        LOG("Failed to send Modbus TCP request");
-        close(modbusSocket);
-        modbusSocket = -1;
-        return false;
-    }
-
-    // LOG("Sent Modbus TCP request: unitId=%u, fc=0x%02x, addr=%u, qty=%u", unitId, functionCode, startAddress, quantity);
-    return true;
+void cleanupModbusTCP() {
+    modbusDefaultClient().close();
 }
 
-// Modbus TCP write word request builder and sender (no address translation)
-static bool sendModbusTCPWriteRequest(uint8_t unitId, uint16_t registerAddress, uint16_t value) {
-    if (!connectModbusTCP()) {
-        return false;
-    }
-
-    uint8_t frame[12];
-    uint16_t tid = ++transactionId;
-
-    // MBAP Header
-    frame[0] = (tid >> 8) & 0xFF;
-    frame[1] = tid & 0xFF;
-    frame[2] = 0x00;
-    frame[3] = 0x00;
-    frame[4] = 0x00;
-    frame[5] = 0x06;
-    frame[6] = unitId;
-    
-    // PDU (Function Code 0x06 - Write Single Register)
-    frame[7] = 0x06;
-    frame[8] = (registerAddress >> 8) & 0xFF;
-    frame[9] = registerAddress & 0xFF;
-    frame[10] = (value >> 8) & 0xFF;
-    frame[11] = value & 0xFF;
-
-    if (send(modbusSocket, frame, sizeof(frame), 0) < 0) {
-        LOG("Failed to send write request\n");
-        return false;
-    }
-
-    LOG("Sent Modbus TCP write: reg=%u, value=%u\n", registerAddress, value);
-    return true;
+uint64_t modbusSyscallCount() {
+    return modbusDefaultClient().syscallCount();
 }
 
-
 bool requestAisweiRead(uint8_t unitId, uint16_t addr_dec) {
-    // determine register index and length from table if present
-    int idx = aiswei_find_register_index(addr_dec);
-    uint16_t length = 1;
-    if (idx >= 0) length = aiswei_registers[idx].length;
-    uint16_t reg = aiswei_dec2reg(addr_dec);
-
-    if (idx < 0) {
-        LOG("Unknown modbus address: %u", addr_dec);
-        return false;
-    }
-
-    transactionAddr = addr_dec;
-
-    if (addr_dec >= 40000 && addr_dec < 50000) {
-        // addresses starting with 4xxxx are holding registers (function code 0x03)
-        return sendModbusTCPRequest(unitId, 0x03, reg, length);
-    } 
-    
-    // default to input registers for 3xxxx (function code 0x04)
-    return sendModbusTCPRequest(unitId, 0x04, reg, length);
+    return modbusDefaultClient().requestRead(unitId, addr_dec);
 }
 
-// Request a contiguous range of registers (quantity = number of 16-bit registers)
 bool requestAisweiReadRange(uint8_t unitId, uint16_t start_addr_dec, uint16_t quantity) {
-    // find index for start address to ensure it's a known region (not strictly required)
-    int idx = aiswei_find_register_index(start_addr_dec);
-    // set transaction start address for parser
-    transactionAddr = start_addr_dec;
-    uint16_t reg = aiswei_dec2reg(start_addr_dec);
-    // choose function code based on address range (3xxxx -> input regs (0x04), 4xxxx -> holding regs (0x03))
-    if (start_addr_dec >= 40000 && start_addr_dec < 50000) {
-        return sendModbusTCPRequest(unitId, 0x03, reg, quantity);
-    }
-    return sendModbusTCPRequest(unitId, 0x04, reg, quantity);
+    return modbusDefaultClient().requestReadRange(unitId, start_addr_dec, quantity);
 }
 
-
 bool requestAisweiWriteWord(uint8_t unitId, uint16_t addr_dec, uint16_t value) {
-    uint16_t reg = aiswei_dec2reg(addr_dec);
-    transactionAddr = addr_dec;
-    return sendModbusTCPWriteRequest(unitId, reg, value);
+    return modbusDefaultClient().requestWriteWord(unitId, addr_dec, value);
 }
 
 bool requestAisweiWriteDWord(uint8_t unitId, uint16_t addr_dec, uint32_t value) {
-    // For U32, we need to write two consecutive registers
-    uint16_t reg = aiswei_dec2reg(addr_dec);
-    uint16_t highWord = (value >> 16) & 0xFFFF;
-    uint16_t lowWord = value & 0xFFFF;
-    
-    // Write high word first
-    transactionAddr = addr_dec;
-    if (!sendModbusTCPWriteRequest(unitId, reg, highWord)) return false;
-    usleep(50000); // 50ms delay between writes
-    // Write low word second
-    return sendModbusTCPWriteRequest(unitId, reg + 1, lowWord);
+    return modbusDefaultClient().requestWriteDWord(unitId, addr_dec, value);
 }
 
+bool modbusForwardRequest(uint8_t unitId, const uint8_t* pdu, size_t len, ModbusFrame* frame) {
+    return modbusDefaultClient().forwardRequest(unitId, pdu, len, frame);
+}
 
-// Modbus TCP response parser
-bool parseModbusTCPResponse() {
-    if (modbusSocket < 0) return false;
-
-    uint8_t buffer[256];
-    int bytesRead = recv(modbusSocket, buffer, sizeof(buffer), 0);
-
-    if (bytesRead < 0) {
-        LOG("Failed to read from socket");
-        close(modbusSocket);
-        modbusSocket = -1;
-        return false;
-    }
+int64_t modbusResponseTimeNs() {
+    return modbusDefaultClient().responseTimeNs();
+}
 
-    if (bytesRead == 0) {
-        LOG("Connection closed by server");
-        close(modbusSocket);
-        modbusSocket = -1;
-        return true;
-    }
+int modbusConnectionFd() {
+    return modbusDefaultClient().fd();
+}
 
-    if (bytesRead < 9) {
-        LOG("Response too short: %d bytes", bytesRead);
-        return true;
-    }
+bool modbusStartCapture(const char* path) {
+    return modbusDefaultClient().startCapture(path);
+}
 
-    // Parse MBAP Header
-    uint16_t tid = ((uint16_t)buffer[0] << 8) | buffer[1];
-    uint16_t pid = ((uint16_t)buffer[2] << 8) | buffer[3];
-    uint16_t len = ((uint16_t)buffer[4] << 8) | buffer[5];
-    uint8_t unitId = buffer[6];
-    uint8_t fc = buffer[7];
+void modbusStopCapture() {
+    modbusDefaultClient().stopCapture();
+}
 
-    if (pid != 0x0000) {
-        LOG("Invalid Protocol ID: 0x%04x", pid);
-        return true;
-    }
+void modbusCaptureSweepEnd() {
+    modbusDefaultClient().captureSweepEnd();
+}
 
-    if (tid != transactionId) {
-        LOG("Transaction ID mismatch: expected %u, got %u", transactionId, tid);
-        return true;
-    }
+void modbusReplayExpect(int fd, uint16_t tid, uint16_t addr_dec, int64_t timeNs) {
+    modbusDefaultClient().replayExpect(fd, tid, addr_dec, timeNs);
+}
 
-    if (len != bytesRead - 6) {
-        LOG("Length mismatch: expected %u, got %d", len, bytesRead - 6);
-        return true;
-    }
+bool receiveModbusTCPResponse(ModbusFrame* frame) {
+    return modbusDefaultClient().receive(frame);
+}
 
-    // Check for exception response (bit 7 set)
-    if (fc & 0x80) {
-        uint8_t exceptionCode = buffer[8];
-        LOG("Modbus exception: fc=0x%02x, exception=0x%02x", fc, exceptionCode);
-        return true;
-    }
+bool parseModbusTCPResponse() {
+    return modbusDefaultClient().receiveAndDecode();
+}
 
-    // Parse PDU for function code 0x03 (Read Holding or Input Registers or WriteSingleRegister)
-    if (fc == 0x03 || fc == 0x04 || fc == 0x06) {
-        uint16_t dataBytes = buffer[8];
-        if (bytesRead < 9 + dataBytes) {
-            LOG("Response data incomplete");
-            return true;
-        }
-
-        uint8_t* registerData = &buffer[9];
-        
-        // printf("[parseModbusTCPResponse] id 0x%02x fc 0x%02x len %u: 0x", unitId, fc, dataBytes);
-        // for (int i = 0; i < dataBytes; ++i) {
-        //     printf("%02x", registerData[i]);
-        // }
-        // printf("\n");
-
-        // Decode and publish each known register entry within the returned byte sequence.
-        // The response contains N registers (2 bytes each). We iterate through the
-        // aiswei register table starting from transactionAddr and dispatch each
-        // entry to decodeAndPublish with its appropriate byte slice.
-        size_t pos = 0;
-        while (pos + 1 < (size_t)dataBytes) {
-            uint16_t currentAddr = transactionAddr + (pos / 2);
-            int ridx = aiswei_find_register_index(currentAddr);
-            if (ridx < 0) {
-                // Unknown register: publish single 16-bit register as hex
-                uint8_t tmp[2]; tmp[0] = registerData[pos]; tmp[1] = registerData[pos+1];
-                decodeAndPublish(unitId, currentAddr, tmp, 2);
-                pos += 2;
-                continue;
-            }
-            uint16_t regs = aiswei_registers[ridx].length;
-            size_t bytesNeeded = regs * 2;
-            if (pos + bytesNeeded > (size_t)dataBytes) {
-                LOG("Response incomplete for addr %u: need %zu bytes, have %u", aiswei_registers[ridx].addr, bytesNeeded, dataBytes - (int)pos);
-                break;
-            }
-            decodeAndPublish(unitId, aiswei_registers[ridx].addr, &registerData[pos], bytesNeeded);
-            pos += bytesNeeded;
-        }
-    }
-    return true;
+void decodeModbusTCPResponse(const ModbusFrame* frame) {
+    modbusDefaultClient().decode(frame);
 }
 
 
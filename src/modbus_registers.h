@@ -14,24 +14,86 @@ typedef struct {
     const char* unit;     // unit string or NULL
     float gain;           // gain (multiply raw by gain to get real value)
     const char* access;   // "RO", "RW", or "WO"
+    uint8_t poll;         // poll class (REG_POLL_*)
 } RegisterInfo;
 
-extern RegisterInfo aiswei_registers[];
-extern const size_t aiswei_registers_count;
+// poll classes: every sweep, every MODBUS_SLOW_POLL_SWEEPS sweeps, first sweep only, never
+#define REG_POLL_FAST 0
+#define REG_POLL_SLOW 1
+#define REG_POLL_ONCE 2
+#define REG_POLL_OFF 3
+
+// register table loaded from the register maps (see register_map.h), sorted by address
+extern RegisterInfo* aiswei_registers;
+extern size_t aiswei_registers_count;
 
 /**
  * Find index of register info for a given decimal AISWEI address.
  * If addr falls into a multi-register entry (addr .. addr+length-1) that entry is returned.
- * Returns -1 if not found.
+ * Returns -1 if not found. Binary search, the table is sorted and non-overlapping.
  */
 int aiswei_find_register_index(uint16_t addr_dec);
+// The same for a register table of count entries
+int registerTableFind(const RegisterInfo* regs, size_t count, uint16_t addr_dec);
 
 // Helper (internal) - you can call directly if needed
 uint16_t aiswei_dec2reg(uint16_t addr_dec);
 
+// One received Modbus TCP response frame (MBAP header and PDU) with the context to decode it
+typedef struct {
+    int64_t rxNs;       // receive time (ns since epoch), recorded time while replaying
+    uint16_t addr;      // first register address (decimal) of the request
+    uint16_t len;       // frame bytes, 0 if no response arrived
+    uint8_t data[260];  // max Modbus TCP ADU
+} ModbusFrame;
+
+// The functions below act on the default client (modbus_client.h), which
+// owns the connection and transaction state; other programs can create
+// ModbusClient instances of their own.
+
 void cleanupModbusTCP();
+// Receive the response to the pending request and decode it (receive + decode below)
 bool parseModbusTCPResponse();
 
+/**
+ * Receive the response to the pending request into frame; frame->len is 0 if
+ * none arrived (timeout or connection lost, which schedules a reconnect).
+ * Returns false if there is no connection, true once the transaction is over.
+ */
+bool receiveModbusTCPResponse(ModbusFrame* frame);
+// Validate a received frame and hand its changed registers to the sink of the default client (may run on another thread)
+void decodeModbusTCPResponse(const ModbusFrame* frame);
+
+// Receive time (ns since epoch) of the response being decoded; 0 outside of decoding.
+int64_t modbusResponseTimeNs();
+
+// Number of times the connection to the dongle was re-established
+uint32_t modbusReconnectCount();
+
+// Socket of the dongle connection, -1 while not connected
+int modbusConnectionFd();
+
+// System calls made for Modbus transactions so far (sending, waiting, receiving)
+uint64_t modbusSyscallCount();
+
+// Record every request and response frame to a capture file (see modbus_capture.h)
+bool modbusStartCapture(const char* path);
+void modbusStopCapture();
+// Mark the end of a polling sweep in the capture (replay publishes the summary there)
+void modbusCaptureSweepEnd();
+
+/**
+ * Replay: use fd (one end of a socket pair) as the dongle connection and expect
+ * the response to transaction tid of a request for addr_dec next, so that
+ * receiveModbusTCPResponse() reads the frame written to the other end.
+ * Decoded values carry the recorded receive time timeNs.
+ */
+void modbusReplayExpect(int fd, uint16_t tid, uint16_t addr_dec, int64_t timeNs);
+
+// Point the connection at another dongle. Call between transactions:
+// an open connection to a different address is closed.
+void setModbusServer(const char* host, int port);
+
 bool requestAisweiRead(uint8_t unitId, uint16_t addr_dec);
 // Read a contiguous range of AISWEI registers starting at decimal address
 // `start_addr_dec` for `quantity` 16-bit registers. This will set the
@@ -41,6 +103,15 @@ bool requestAisweiReadRange(uint8_t unitId, uint16_t start_addr_dec, uint16_t qu
 bool requestAisweiWriteWord(uint8_t unitId, uint16_t addr_dec, uint16_t value);
 bool requestAisweiWriteDWord(uint8_t unitId, uint16_t addr_dec, uint32_t value);
 
+/**
+ * Forward a request PDU (function code and data) of another Modbus client to
+ * unitId and receive the response into frame (frame->len is 0 if none arrived).
+ * Blocks like a polling transaction; call between transactions on the polling
+ * thread. Forwarded transactions are not recorded in a capture. Returns false
+ * if there is no connection.
+ */
+bool modbusForwardRequest(uint8_t unitId, const uint8_t* pdu, size_t len, ModbusFrame* frame);
+
 /* Read wrappers (input & holding read requests) */
 /* Input registers (chapter 3.3) - prototypes */
 bool deviceType(uint8_t unitId);
@@ -0,0 +1,141 @@
+#include "perf_stats.h"
+#include "json_writer.h"
+
+#include <time.h>
+
+PerfStats perfStats;
+
+static PerfStatsSampler sampler = nullptr;
+static const uint64_t startUs = perfNowUs();
+
+uint64_t perfNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t us) {
+    if (us < SUB) return (size_t)us;
+    if (us >> MAX_BITS) return BUCKETS - 1;
+    unsigned shift = 63 - __builtin_clzll(us) - SUB_BITS;
+    return (size_t)(shift + 1) * SUB + ((us >> shift) & (SUB - 1));
+}
+
+uint64_t LatencyHistogram::bucketHigh(size_t bucket) {
+    if (bucket < SUB) return bucket;
+    unsigned shift = bucket / SUB - 1;
+    uint64_t low = (uint64_t)(SUB + bucket % SUB) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    buckets_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+    uint64_t m = min_.load(std::memory_order_relaxed);
+    while (us < m && !min_.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+    m = max_.load(std::memory_order_relaxed);
+    while (us > m && !max_.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+    Summary s = {};
+    // copy first: recording goes on while this runs
+    uint64_t counts[BUCKETS];
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        s.count += counts[i];
+    }
+    if (s.count == 0) return s;
+    s.min = min_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    s.mean = (double)sum_.load(std::memory_order_relaxed) / count_.load(std::memory_order_relaxed);
+
+    const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t* out[4] = { &s.p50, &s.p90, &s.p99, &s.p999 };
+    uint64_t seen = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < BUCKETS && q < 4; ++i) {
+        seen += counts[i];
+        while (q < 4 && seen >= quantiles[q] * s.count) {
+            uint64_t high = bucketHigh(i);
+            *out[q++] = high < s.max ? high : s.max;
+        }
+    }
+    return s;
+}
+
+void LatencyHistogram::write(JsonWriter& w) const {
+    Summary s = summary();
+    w.beginObject();
+    w.key("count").value(s.count);
+    w.key("min").value(s.count ? s.min : 0);
+    w.key("mean").value(s.mean);
+    w.key("p50").value(s.p50);
+    w.key("p90").value(s.p90);
+    w.key("p99").value(s.p99);
+    w.key("p999").value(s.p999);
+    w.key("max").value(s.max);
+    w.endObject();
+}
+
+LatencyHistogram& perfRttHistogram(uint8_t fc) {
+    return perfRttHistogram(perfStats, fc);
+}
+
+LatencyHistogram& perfRttHistogram(PerfStats& stats, uint8_t fc) {
+    switch (fc) {
+        case 0x03: return stats.rttRead03;
+        case 0x04: return stats.rttRead04;
+        case 0x06:
+        case 0x10: return stats.rttWrite;
+        default: return stats.rttOther;
+    }
+}
+
+void setPerfStatsSampler(PerfStatsSampler s) {
+    sampler = s;
+}
+
+void writePerfStats(JsonWriter& w) {
+    const PerfStats& p = perfStats;
+    w.beginObject();
+    w.key("uptime_s").value((perfNowUs() - startUs) / 1000000);
+
+    // durations in microseconds
+    w.key("modbus").beginObject();
+    w.key("requests").value(p.requests.load());
+    w.key("responses").value(p.responses.load());
+    w.key("exceptions").value(p.exceptions.load());
+    w.key("timeouts").value(p.timeouts.load());
+    w.key("requests_per_s").value(p.requestRateMilli.load() / 1000.0);
+    w.key("dropped_frames").value(p.droppedFrames.load());
+    w.key("io").value(p.ioUring.load() ? "io_uring" : "poll");
+    w.key("syscalls_per_sweep").value(p.sweepSyscalls.load());
+    w.key("ctx_switches_per_sweep").value(p.sweepCtxSwitches.load());
+    w.key("rtt_us").beginObject();
+    w.key("fc03"); p.rttRead03.write(w);
+    w.key("fc04"); p.rttRead04.write(w);
+    w.key("write"); p.rttWrite.write(w);
+    w.key("other"); p.rttOther.write(w);
+    w.endObject();
+    w.key("sweep_us"); p.sweep.write(w);
+    w.endObject();
+
+    w.key("mqtt").beginObject();
+    w.key("published").value(p.mqttPublished.load());
+    w.key("failures").value(p.mqttFailures.load());
+    w.key("publish_us"); p.mqttPublish.write(w);
+    w.endObject();
+
+    w.key("influx").beginObject();
+    w.key("writes").value(p.influxWrites.load());
+    w.key("failures").value(p.influxFailures.load());
+    w.key("write_us"); p.influxWrite.write(w);
+    w.endObject();
+
+    w.key("snapshot_us"); p.snapshotBuild.write(w);
+
+    if (sampler) sampler(w);
+    w.endObject();
+}
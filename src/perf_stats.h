@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class JsonWriter;
+
+// Internal performance counters and latency histograms of the gateway,
+// published on <prefix>/$stats and served on the HTTP API (/api/stats).
+// Everything is recorded lock-free from any thread and counts since startup.
+
+// HDR-style histogram of durations in microseconds: a linear bucket per value
+// below 2^SUB_BITS, above that 2^SUB_BITS buckets per power of two, so every
+// recorded value is known within 1/2^SUB_BITS (about 3 %) up to 2^40 us.
+class LatencyHistogram {
+public:
+    enum { SUB_BITS = 5, SUB = 1 << SUB_BITS, MAX_BITS = 40, BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB };
+
+    struct Summary {
+        uint64_t count;
+        uint64_t min, max;    // exact
+        double mean;
+        uint64_t p50, p90, p99, p999;  // upper bound of the bucket holding the quantile
+    };
+
+    void record(uint64_t us);
+    Summary summary() const;
+    // {"count":..,"min":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..}
+    void write(JsonWriter& w) const;
+
+private:
+    static size_t bucketOf(uint64_t us);
+    static uint64_t bucketHigh(size_t bucket);
+
+    std::atomic<uint64_t> buckets_[BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> min_{UINT64_MAX};
+    std::atomic<uint64_t> max_{0};
+};
+
+struct PerfStats {
+    // Modbus transactions: round trip from request sent to response received
+    LatencyHistogram rttRead03, rttRead04, rttWrite, rttOther;
+    LatencyHistogram sweep;          // duration of a full polling sweep
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> responses{0};
+    std::atomic<uint64_t> exceptions{0};  // exception responses
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> requestRateMilli{0};  // requests per second (x1000) of the last sweep
+    std::atomic<uint64_t> droppedFrames{0};     // responses dropped, decode stage behind
+    std::atomic<bool> ioUring{false};           // transactions go through io_uring
+    std::atomic<uint64_t> sweepSyscalls{0};     // system calls of the transactions of the last sweep
+    std::atomic<uint64_t> sweepCtxSwitches{0};  // context switches of the polling thread in the last sweep
+
+    // sinks
+    LatencyHistogram mqttPublish;    // publish call of a change
+    LatencyHistogram influxWrite;    // HTTP write incl. response
+    std::atomic<uint64_t> mqttPublished{0};
+    std::atomic<uint64_t> mqttFailures{0};
+    std::atomic<uint64_t> influxWrites{0};
+    std::atomic<uint64_t> influxFailures{0};
+
+    // decode stage: building a snapshot of the register values for readers
+    LatencyHistogram snapshotBuild;
+};
+
+extern PerfStats perfStats;
+
+// Histogram of the round trip of a request with Modbus function code fc
+LatencyHistogram& perfRttHistogram(uint8_t fc);
+LatencyHistogram& perfRttHistogram(PerfStats& stats, uint8_t fc);
+
+// Microseconds since an arbitrary start (steady clock), for timing
+uint64_t perfNowUs();
+
+// Writer of values owned elsewhere (queue depths, reconnects, ...) into the stats object
+typedef void (*PerfStatsSampler)(JsonWriter& w);
+void setPerfStatsSampler(PerfStatsSampler sampler);
+
+// Write all stats as one JSON object
+void writePerfStats(JsonWriter& w);
@@ -0,0 +1,34 @@
+#include "pipeline.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+void IdleBackoff::wait() {
+    if (us_ == 0) {
+        // first miss: the producer is usually mid-record, just yield
+        us_ = 50;
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us_));
+    us_ = us_ * 2 > maxUs_ ? maxUs_ : us_ * 2;
+}
+
+void pipelineThreadSetup(const char* name, int cpu) {
+    pthread_setname_np(pthread_self(), name);  // at most 15 characters
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        LOG_ERROR("Pinning %s to CPU %d failed: %s", name, cpu, strerror(rc));
+    } else {
+        LOG("Pinned %s to CPU %d", name, cpu);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+// Building blocks of the staged gateway pipeline (Modbus I/O -> decode ->
+// sinks): a bounded single-producer/single-consumer ring of preallocated
+// records, an idle backoff for the consuming threads and core pinning.
+
+// Bounded lock-free SPSC queue. Records are preallocated and filled or
+// read in place: the producer claim()s a slot, writes it and publish()es it;
+// the consumer peek()s records and pop()s them when done. A record stays
+// queued until it is popped, so empty() also means the consumer is idle.
+template <typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer: free slot to fill, nullptr while the ring is full
+    T* claim() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - headCache_ > mask_) {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail - headCache_ > mask_) return nullptr;
+        }
+        return &slots_[tail & mask_];
+    }
+    // producer: hand the claimed slot to the consumer
+    void publish() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // consumer: i-th queued record (0 is the oldest), nullptr if there are fewer
+    T* peek(size_t i = 0) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tailCache_ - head <= i) {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if (tailCache_ - head <= i) return nullptr;
+        }
+        return &slots_[(head + i) & mask_];
+    }
+    // consumer: release the n oldest records
+    void pop(size_t n = 1) { head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+    // approximate from other threads, exact from producer or consumer
+    size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_ = 0;
+    // consumer side: read index and its view of the write index
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tailCache_ = 0;
+    // producer side: write index and its view of the read index
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t headCache_ = 0;
+};
+
+// Sleep of a consumer that found its ring empty: short at first, doubling up
+// to maxUs while nothing arrives; reset() after work was found
+class IdleBackoff {
+public:
+    explicit IdleBackoff(unsigned maxUs) : maxUs_(maxUs) {}
+    void wait();
+    void reset() { us_ = 0; }
+
+private:
+    unsigned maxUs_;
+    unsigned us_ = 0;
+};
+
+// Name the calling thread and pin it to a core (cpu < 0: leave it unpinned)
+void pipelineThreadSetup(const char* name, int cpu);
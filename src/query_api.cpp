@@ -0,0 +1,389 @@
+#include "query_api.h"
+#include "http_server.h"
+#include "json_writer.h"
+#include "perf_stats.h"
+#include "register_snapshot.h"
+#include "timeseries.h"
+#include "trace.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <charconv>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+// Everything below runs on the server thread only, so the caches need no lock.
+
+// serialized state of one register, rebuilt only when something in it changed
+struct Fragment {
+    std::string payload;
+    int64_t changedMs = 0;
+    bool hasChanged = false;
+    uint64_t metaGeneration = 0;
+    uint64_t epoch = 0;  // last snapshot containing the register
+    std::shared_ptr<const std::string> json;
+    std::string metric;  // OpenMetrics sample line, empty if the value is not numeric
+};
+
+static HttpServer server;
+static const TimeSeriesStore* history = nullptr;
+
+static std::unordered_map<uint32_t, Fragment> fragments;  // key: (unitId << 16) | addr
+static std::vector<const Fragment*> ordered;              // fragments in snapshot order
+static std::vector<uint32_t> orderedKeys;
+static uint64_t cachedEpoch = 0;
+static std::string cachedTime;                            // ISO time of the cached snapshot
+static std::map<uint32_t, std::shared_ptr<const std::string>> listBodies;  // by listVariant()
+static std::shared_ptr<const std::string> metaBody;
+static uint64_t metaBodyGeneration = 0;
+static std::shared_ptr<const std::string> metricsBody;  // exposition of cachedEpoch, null until requested
+
+static const char* METRICS_CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+static const char METRICS_HEADER[] =
+    "# TYPE solplanet_register gauge\n"
+    "# HELP solplanet_register Decoded Modbus register value (gain applied).\n";
+
+static size_t formatIsoMs(int64_t ms, char* buf, size_t size) {
+    time_t tt = ms / 1000;
+    struct tm tmv;
+    gmtime_r(&tt, &tmv);
+    size_t len = strftime(buf, size, "%FT%T", &tmv);
+    len += snprintf(buf + len, size - len, ".%03dZ", (int)(ms % 1000));
+    return len;
+}
+
+static int64_t toMs(const std::chrono::system_clock::time_point& tp) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+}
+
+// decimal number in [0, max] from the whole of s
+static bool parseNumber(std::string_view s, int64_t max, int64_t& out) {
+    if (s.empty() || s.size() > 18) return false;
+    int64_t v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        v = v * 10 + (c - '0');
+    }
+    if (v > max) return false;
+    out = v;
+    return true;
+}
+
+// finite decimal number from the whole of s; hex payloads ("0x1a2b") and nan/inf are text
+static bool parseValue(const std::string& s, double& out) {
+    const char* end = s.data() + s.size();
+    auto r = std::from_chars(s.data(), end, out, std::chars_format::general);
+    return !s.empty() && r.ec == std::errc() && r.ptr == end && std::isfinite(out);
+}
+
+static std::shared_ptr<const std::string> serializeRegister(uint32_t key, const RegisterState& state,
+                                                            const RegisterMetaTable* meta) {
+    static JsonWriter w(1024);
+    uint16_t addr = key & 0xFFFF;
+    w.clear();
+    w.beginObject();
+    w.key("unit").value((unsigned)((key >> 16) & 0xFF));
+    w.key("addr").value((unsigned)addr);
+    w.key("value").value(state.payload);
+    double num;
+    if (parseValue(state.payload, num)) w.key("number").value(num);
+    w.key("changed");
+    if (state.hasChanged) {
+        char iso[40];
+        w.value(iso, formatIsoMs(toMs(state.lastChangeTime), iso, sizeof(iso)));
+    } else {
+        w.null();
+    }
+    w.key("meta");
+    const RegisterMeta* m = meta ? meta->find(addr) : nullptr;
+    if (m) w.raw(m->json.data(), m->json.size()); else w.null();
+    w.endObject();
+    return std::make_shared<const std::string>(w.str());
+}
+
+// label value with backslash, double quote and newline escaped
+static void appendLabel(std::string& out, const char* name, const char* value) {
+    out += name;
+    out += "=\"";
+    for (const char* p = value; *p; ++p) {
+        if (*p == '\\' || *p == '"') {
+            out += '\\';
+            out += *p;
+        } else if (*p == '\n') {
+            out += "\\n";
+        } else {
+            out += *p;
+        }
+    }
+    out += '"';
+}
+
+// solplanet_register{unit="3",addr="31301",name="...",uom="V"} 230.1
+static void formatMetric(uint32_t key, const RegisterState& state, const RegisterMetaTable* meta, std::string& out) {
+    out.clear();
+    double num;
+    if (!parseValue(state.payload, num)) return;
+    uint16_t addr = key & 0xFFFF;
+    char id[8];
+    out += "solplanet_register{";
+    snprintf(id, sizeof(id), "%u", (key >> 16) & 0xFF);
+    appendLabel(out, "unit", id);
+    out += ',';
+    snprintf(id, sizeof(id), "%u", addr);
+    appendLabel(out, "addr", id);
+    const RegisterMeta* m = meta ? meta->find(addr) : nullptr;
+    if (m && !m->name.empty()) {
+        out += ',';
+        appendLabel(out, "name", m->name.c_str());
+    }
+    if (m && !m->unit.empty()) {
+        out += ',';
+        appendLabel(out, "uom", m->unit.c_str());
+    }
+    out += "} ";
+    char value[32];
+    auto r = std::to_chars(value, value + sizeof(value), num);
+    out.append(value, r.ptr - value);
+    out += '\n';
+}
+
+// Bring the fragments up to date with snap (once per snapshot epoch)
+static void refresh(const RegisterSnapshot& snap) {
+    if (snap.epoch == cachedEpoch) return;
+    uint64_t metaGeneration = snap.meta ? snap.meta->generation : 0;
+    ordered.clear();
+    orderedKeys.clear();
+    for (const RegisterState& state : snap.registers) {
+        Fragment& f = fragments[state.key];
+        int64_t changedMs = state.hasChanged ? toMs(state.lastChangeTime) : 0;
+        if (!f.json || f.payload != state.payload || f.changedMs != changedMs || f.hasChanged != state.hasChanged ||
+            f.metaGeneration != metaGeneration) {
+            f.payload = state.payload;
+            f.changedMs = changedMs;
+            f.hasChanged = state.hasChanged;
+            f.metaGeneration = metaGeneration;
+            f.json = serializeRegister(state.key, state, snap.meta.get());
+            formatMetric(state.key, state, snap.meta.get(), f.metric);
+        }
+        f.epoch = snap.epoch;
+        ordered.push_back(&f);
+        orderedKeys.push_back(state.key);
+    }
+    // registers dropped from the table (map reload)
+    if (fragments.size() > ordered.size()) {
+        for (auto it = fragments.begin(); it != fragments.end();) {
+            if (it->second.epoch != snap.epoch) it = fragments.erase(it); else ++it;
+        }
+    }
+    char iso[40];
+    cachedTime.assign(iso, formatIsoMs(toMs(snap.time), iso, sizeof(iso)));
+    cachedEpoch = snap.epoch;
+    listBodies.clear();
+    metricsBody.reset();
+}
+
+// cache slot of a list variant: bit 8 changed only, bit 9 all units, else the unit id
+static uint32_t listVariant(int unit, bool changedOnly) {
+    return (changedOnly ? 0x100 : 0) | (unit < 0 ? 0x200 : (uint32_t)unit);
+}
+
+static std::shared_ptr<const std::string> listBody(int unit, bool changedOnly) {
+    auto& body = listBodies[listVariant(unit, changedOnly)];
+    if (body) return body;
+    static JsonWriter w(64 * 1024);
+    w.clear();
+    w.beginObject();
+    w.key("epoch").value(cachedEpoch);
+    w.key("time").value(cachedTime);
+    w.key("registers").beginArray();
+    for (size_t i = 0; i < ordered.size(); ++i) {
+        if (unit >= 0 && (int)((orderedKeys[i] >> 16) & 0xFF) != unit) continue;
+        if (changedOnly && !ordered[i]->hasChanged) continue;
+        w.raw(ordered[i]->json->data(), ordered[i]->json->size());
+    }
+    w.endArray();
+    w.endObject();
+    body = std::make_shared<const std::string>(w.str());
+    return body;
+}
+
+// Exposition of all numeric registers, joined from the cached sample lines once per snapshot
+static void serveMetrics(HttpResponse& resp) {
+    resp.contentType = METRICS_CONTENT_TYPE;
+    if (!metricsBody) {
+        static size_t lastSize = 0;
+        std::string body;
+        body.reserve(lastSize + 256);
+        body.append(METRICS_HEADER, sizeof(METRICS_HEADER) - 1);
+        for (const Fragment* f : ordered) body += f->metric;
+        body += "# EOF\n";
+        lastSize = body.size();
+        metricsBody = std::make_shared<const std::string>(std::move(body));
+    }
+    resp.shared = metricsBody;
+}
+
+static void serveMeta(const RegisterSnapshot& snap, HttpResponse& resp) {
+    if (!snap.meta) {
+        resp.status = 404;
+        return;
+    }
+    if (!metaBody || metaBodyGeneration != snap.meta->generation) {
+        JsonWriter w(64 * 1024);
+        w.beginObject();
+        w.key("generation").value(snap.meta->generation);
+        w.key("registers").beginArray();
+        for (const RegisterMeta& m : snap.meta->entries) w.raw(m.json.data(), m.json.size());
+        w.endArray();
+        w.endObject();
+        metaBody = std::make_shared<const std::string>(w.str());
+        metaBodyGeneration = snap.meta->generation;
+    }
+    resp.shared = metaBody;
+}
+
+static void serveHistory(const HttpRequest& req, uint32_t key, HttpResponse& resp) {
+    static std::vector<TimeSeriesStore::Point> points;
+    static JsonWriter w(16 * 1024);
+    if (!history || !history->contains(key)) {
+        resp.status = 404;
+        return;
+    }
+    std::string_view v;
+    TimeSeriesStore::Resolution res = TimeSeriesStore::RAW;
+    const char* resName = "raw";
+    if (req.param("res", v)) {
+        if (v == "1m") {
+            res = TimeSeriesStore::MIN1;
+            resName = "1m";
+        } else if (v == "15m") {
+            res = TimeSeriesStore::MIN15;
+            resName = "15m";
+        } else if (v != "raw") {
+            resp.status = 400;
+            return;
+        }
+    }
+    int64_t from = 0, to = INT64_MAX;
+    if ((req.param("from", v) && !parseNumber(v, INT64_MAX, from)) ||
+        (req.param("to", v) && !parseNumber(v, INT64_MAX, to))) {
+        resp.status = 400;
+        return;
+    }
+
+    points.resize(history->capacity(res) + 1);  // + the open rollup bucket
+    size_t n = history->query(key, res, from, to, points.data(), points.size());
+    w.clear();
+    w.beginObject();
+    w.key("unit").value((unsigned)((key >> 16) & 0xFF));
+    w.key("addr").value((unsigned)(key & 0xFFFF));
+    w.key("res").value(resName);
+    // raw: [t_ms, value]; rollups: [t_ms, min, max, avg, count]
+    w.key("points").beginArray();
+    for (size_t i = 0; i < n; ++i) {
+        const TimeSeriesStore::Point& p = points[i];
+        w.beginArray().value(p.t_ms);
+        if (res == TimeSeriesStore::RAW) {
+            w.value(p.avg);
+        } else {
+            w.value(p.min).value(p.max).value(p.avg).value((unsigned)p.count);
+        }
+        w.endArray();
+    }
+    w.endArray();
+    w.endObject();
+    resp.body = w.str();
+}
+
+static void handle(const HttpRequest& req, HttpResponse& resp) {
+    if (req.path == "/api/stats") {
+        // live counters: not cached
+        static JsonWriter w(8 * 1024);
+        w.clear();
+        writePerfStats(w);
+        resp.body = w.str();
+        return;
+    }
+    if (req.path == "/api/trace") {
+        traceDump(resp.body);
+        return;
+    }
+    std::shared_ptr<const RegisterSnapshot> snap = registerSnapshot();
+    if (!snap) {
+        resp.status = 503;  // nothing decoded yet
+        return;
+    }
+    refresh(*snap);
+
+    std::string_view path = req.path;
+    if (path == "/metrics") {
+        serveMetrics(resp);
+        return;
+    }
+    if (path == "/api/meta") {
+        serveMeta(*snap, resp);
+        return;
+    }
+    static const std::string_view prefix = "/api/registers";
+    if (path.substr(0, prefix.size()) != prefix) {
+        resp.status = 404;
+        return;
+    }
+    path.remove_prefix(prefix.size());
+    if (path.empty() || path == "/") {
+        std::string_view v;
+        int64_t unit = -1;
+        if (req.param("unit", v) && !parseNumber(v, 255, unit)) {
+            resp.status = 400;
+            return;
+        }
+        bool changedOnly = req.param("changed", v) && v != "0";
+        resp.shared = listBody((int)unit, changedOnly);
+        return;
+    }
+
+    // /<unit>/<addr>[/history]
+    path.remove_prefix(1);
+    size_t slash = path.find('/');
+    int64_t unit, addr;
+    if (slash == std::string_view::npos || !parseNumber(path.substr(0, slash), 255, unit)) {
+        resp.status = 404;
+        return;
+    }
+    path.remove_prefix(slash + 1);
+    slash = path.find('/');
+    if (!parseNumber(path.substr(0, slash), 0xFFFF, addr)) {
+        resp.status = 404;
+        return;
+    }
+    uint32_t key = ((uint32_t)unit << 16) | (uint32_t)addr;
+    if (slash != std::string_view::npos) {
+        if (path.substr(slash) != "/history") {
+            resp.status = 404;
+            return;
+        }
+        serveHistory(req, key, resp);
+        return;
+    }
+    auto it = fragments.find(key);
+    if (it == fragments.end()) {
+        resp.status = 404;
+        return;
+    }
+    resp.shared = it->second.json;
+}
+
+bool startQueryApi(const char* addr, int port, size_t maxConnections, unsigned idleMs, const TimeSeriesStore* store) {
+    history = store;
+    return server.start(addr, port, handle, maxConnections, idleMs);
+}
+
+void stopQueryApi() {
+    uint64_t requests = server.requests();
+    server.stop();
+    if (requests) LOG("HTTP API served %llu requests", (unsigned long long)requests);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+class TimeSeriesStore;
+
+// HTTP/JSON query API for local dashboards and scripts. Answers from the
+// published register snapshots (register_snapshot.h) and the in-memory history,
+// never from state of the polling or decode stages:
+//
+//   GET /api/registers[?unit=<id>][&changed=1]   latest values of all registers
+//   GET /api/registers/<unit>/<addr>             one register with its metadata
+//   GET /api/registers/<unit>/<addr>/history[?res=raw|1m|15m][&from=<ms>][&to=<ms>]
+//   GET /api/meta                                the register table
+//   GET /api/stats                               internal performance stats (perf_stats.h)
+//   GET /api/trace                               recorded trace events as Chrome trace JSON (trace.h)
+//   GET /metrics                                 numeric registers as OpenMetrics gauges
+//
+// Each register is serialized once per change into a JSON fragment; list bodies
+// and the metrics exposition are joined from fragments and sample lines once
+// per snapshot and shared by all requests until the next snapshot.
+
+// Serve on addr:port on a thread of its own; history may be nullptr. False if the port cannot be bound.
+bool startQueryApi(const char* addr, int port, size_t maxConnections, unsigned idleMs, const TimeSeriesStore* history);
+void stopQueryApi();
@@ -0,0 +1,276 @@
+#include "register_image.h"
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REGISTER_IMAGE_X86 1
+#endif
+
+// room for the full 16-bit address space plus one response beyond its end
+static const size_t IMAGE_WORDS = 65536 + REGISTER_IMAGE_MAX_WORDS;
+
+// fingerprint of the last response to a request starting at some address
+struct BatchPrint {
+    uint16_t words = 0;
+    bool valid = false;  // the image still holds this response
+    uint64_t hash = 0;
+    int64_t seenNs = 0;  // receive time of the last response
+};
+
+struct UnitImage {
+    uint8_t data[IMAGE_WORDS * 2];
+    uint64_t seen[IMAGE_WORDS / 64];
+    std::map<uint16_t, BatchPrint> batches;  // by start address
+};
+
+static std::unique_ptr<UnitImage> images[256];
+static std::mutex imageMutex;
+static uint64_t skippedResponses = 0;
+
+static UnitImage& imageFor(uint8_t unitId) {
+    std::unique_ptr<UnitImage>& img = images[unitId];
+    if (!img) img.reset(new UnitImage());
+    return *img;
+}
+
+static inline uint64_t rotl64(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+// 64-bit hash of a response: xxHash64 structure (four independent lanes over
+// 32-byte stripes, so the multiplies overlap), not seeded
+static const uint64_t P1 = 0x9e3779b185ebca87ULL, P2 = 0xc2b2ae3d27d4eb4fULL, P3 = 0x165667b19e3779f9ULL;
+
+static inline uint64_t round64(uint64_t acc, uint64_t w) { return rotl64(acc + w * P2, 31) * P1; }
+
+static uint64_t fingerprint(const uint8_t* p, size_t len) {
+    uint64_t v[4] = { P1 + P2, P2, 0, 0 - P1 };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        uint64_t w[4];
+        memcpy(w, p + i, 32);
+        for (int k = 0; k < 4; ++k) v[k] = round64(v[k], w[k]);
+    }
+    uint64_t h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18) + len;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = rotl64(h ^ round64(0, w), 27) * P1 + P3;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, len - i);
+    h = rotl64(h ^ (tail * P1), 23) * P2 + P3;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// kernels: compare n words of a and b, set bit i of mask for every differing word i
+typedef void (*DiffKernel)(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask);
+
+static void diffScalar(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask, size_t i) {
+    for (; i < n; ++i) {
+        if (a[2 * i] != b[2 * i] || a[2 * i + 1] != b[2 * i + 1]) mask[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+static void diffScalarKernel(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask) {
+    // skip equal runs of 4 words with one 64-bit compare
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint64_t x, y;
+        memcpy(&x, a + 2 * i, 8);
+        memcpy(&y, b + 2 * i, 8);
+        if (x != y) diffScalar(a, b, i + 4, mask, i);
+    }
+    diffScalar(a, b, n, mask, i);
+}
+
+#ifdef REGISTER_IMAGE_X86
+// words i .. n-1, i a multiple of 8
+__attribute__((target("sse2")))
+static void diffSse2(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask, size_t i) {
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(a + 2 * i)),
+                                     _mm_loadu_si128((const __m128i*)(b + 2 * i)));
+        // one byte per word, then one bit per word
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(eq, zero)) & 0xff;
+        if (same != 0xff) mask[i / 64] |= (uint64_t)(~same & 0xff) << (i % 64);
+    }
+    diffScalar(a, b, n, mask, i);
+}
+
+__attribute__((target("sse2")))
+static void diffSse2Kernel(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask) {
+    diffSse2(a, b, n, mask, 0);
+}
+
+__attribute__((target("avx2")))
+static void diffAvx2Kernel(const uint8_t* a, const uint8_t* b, size_t n, uint64_t* mask) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(a + 2 * i)),
+                                        _mm256_loadu_si256((const __m256i*)(b + 2 * i)));
+        // packs works per 128-bit lane: gather the two 8-byte halves, then one bit per word
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(eq, zero), 0x08);
+        unsigned same = (unsigned)_mm256_movemask_epi8(packed) & 0xffff;
+        if (same != 0xffff) mask[i / 64] |= (uint64_t)(~same & 0xffff) << (i % 64);
+    }
+    // leave the upper halves clean for the SSE code of the caller (not done for the tail call below)
+    _mm256_zeroupper();
+    if (i + 8 <= n) {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(a + 2 * i)),
+                                     _mm_loadu_si128((const __m128i*)(b + 2 * i)));
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128())) & 0xff;
+        if (same != 0xff) mask[i / 64] |= (uint64_t)(~same & 0xff) << (i % 64);
+        i += 8;
+    }
+    diffScalar(a, b, n, mask, i);
+}
+#endif
+
+static DiffKernel selectKernel(const char** name) {
+#ifdef REGISTER_IMAGE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return diffAvx2Kernel;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return diffSse2Kernel;
+    }
+#endif
+    *name = "scalar";
+    return diffScalarKernel;
+}
+
+static const char* kernelName = nullptr;
+static DiffKernel kernel = selectKernel(&kernelName);
+
+const char* registerImageKernel() {
+    return kernelName;
+}
+
+size_t registerImageDiff(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, uint64_t* mask) {
+    if (words > REGISTER_IMAGE_MAX_WORDS) words = REGISTER_IMAGE_MAX_WORDS;
+    mask[0] = mask[1] = 0;
+
+    std::lock_guard<std::mutex> lock(imageMutex);
+    UnitImage* img = &imageFor(unitId);
+
+    uint8_t* prev = img->data + 2 * (size_t)addr;
+    kernel(data, prev, words, mask);
+
+    // words never seen count as changed; walk the seen bitmap 64 words at a time
+    size_t w = addr, end = (size_t)addr + words;
+    while (w < end) {
+        size_t bit = w % 64;
+        size_t n = end - w < 64 - bit ? end - w : 64 - bit;
+        uint64_t span = (n == 64 ? ~0ULL : (1ULL << n) - 1) << bit;
+        uint64_t unseen = ~img->seen[w / 64] & span;
+        if (unseen) {
+            img->seen[w / 64] |= unseen;
+            uint64_t rel = unseen >> bit;  // bit j: word w + j
+            size_t i = w - addr;
+            mask[i / 64] |= rel << (i % 64);
+            if (i % 64 + n > 64) mask[i / 64 + 1] |= rel >> (64 - i % 64);
+        }
+        w += n;
+    }
+
+    size_t changed = (size_t)__builtin_popcountll(mask[0]) + (size_t)__builtin_popcountll(mask[1]);
+    if (changed) {
+        memcpy(prev, data, words * 2);
+        // other batches covering these words no longer match the image: their
+        // next response must be diffed even if it repeats their last one
+        auto it = img->batches.lower_bound(addr >= REGISTER_IMAGE_MAX_WORDS ? addr - REGISTER_IMAGE_MAX_WORDS : 0);
+        for (; it != img->batches.end() && it->first < end; ++it) {
+            if (it->first != addr && (size_t)it->first + it->second.words > addr) it->second.valid = false;
+        }
+    }
+    return changed;
+}
+
+bool registerImageSame(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, int64_t timeNs) {
+    if (words > REGISTER_IMAGE_MAX_WORDS) words = REGISTER_IMAGE_MAX_WORDS;
+    uint64_t hash = fingerprint(data, words * 2);
+
+    std::lock_guard<std::mutex> lock(imageMutex);
+    BatchPrint& b = imageFor(unitId).batches[addr];
+    b.seenNs = timeNs;
+    if (b.valid && b.words == words && b.hash == hash) {
+        ++skippedResponses;
+        return true;
+    }
+    b.words = (uint16_t)words;
+    b.valid = true;
+    b.hash = hash;
+    return false;
+}
+
+int64_t registerImageSeenNs(uint8_t unitId, uint16_t addr) {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    if (!images[unitId]) return 0;
+    const auto& batches = images[unitId]->batches;
+    int64_t seen = 0;
+    auto it = batches.lower_bound(addr >= REGISTER_IMAGE_MAX_WORDS ? addr - REGISTER_IMAGE_MAX_WORDS : 0);
+    for (; it != batches.end() && it->first <= addr; ++it) {
+        if ((size_t)it->first + it->second.words > addr && it->second.seenNs > seen) seen = it->second.seenNs;
+    }
+    return seen;
+}
+
+bool registerImageRead(uint8_t unitId, uint16_t addr, size_t words, uint16_t* out) {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    if (!images[unitId] || (size_t)addr + words > IMAGE_WORDS) return false;
+    const uint8_t* p = images[unitId]->data + 2 * (size_t)addr;
+    for (size_t i = 0; i < words; ++i) out[i] = (uint16_t)(p[2 * i] << 8 | p[2 * i + 1]);
+    return true;
+}
+
+bool registerImageReadFresh(uint8_t unitId, uint16_t addr, size_t words, uint16_t* out, int64_t minSeenNs) {
+    if (words == 0 || words > REGISTER_IMAGE_MAX_WORDS || (size_t)addr + words > 65536) return false;
+    int64_t latest[REGISTER_IMAGE_MAX_WORDS] = {};
+
+    std::lock_guard<std::mutex> lock(imageMutex);
+    if (!images[unitId]) return false;
+    const UnitImage& img = *images[unitId];
+    for (size_t w = addr; w < addr + words; ++w) {
+        if (!(img.seen[w / 64] & (1ULL << (w % 64)))) return false;
+    }
+    // receive time of each word: the latest response of a batch covering it
+    size_t end = (size_t)addr + words;
+    auto it = img.batches.lower_bound(addr >= REGISTER_IMAGE_MAX_WORDS ? addr - REGISTER_IMAGE_MAX_WORDS : 0);
+    for (; it != img.batches.end() && it->first < end; ++it) {
+        size_t from = it->first > addr ? it->first : addr;
+        size_t to = std::min(end, (size_t)it->first + it->second.words);
+        for (size_t w = from; w < to; ++w) {
+            if (it->second.seenNs > latest[w - addr]) latest[w - addr] = it->second.seenNs;
+        }
+    }
+    for (size_t i = 0; i < words; ++i) {
+        if (latest[i] < minSeenNs) return false;
+    }
+    const uint8_t* p = img.data + 2 * (size_t)addr;
+    for (size_t i = 0; i < words; ++i) out[i] = (uint16_t)(p[2 * i] << 8 | p[2 * i + 1]);
+    return true;
+}
+
+uint64_t registerImageSkipped() {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    return skippedResponses;
+}
+
+void registerImageReset() {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    for (auto& img : images) img.reset();
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "word_mask.h"
+
+// Previous-sweep image of all 16-bit registers, one per unit.
+//
+// Every read response is compared with the words it returned last time, so
+// only registers that actually moved need to be decoded and published. The
+// words are kept in wire order (big endian) and compared with SSE2/AVX2 where
+// available, 8 or 16 words per instruction, with a scalar fallback. Before
+// that, a fingerprint per request lets repeated responses skip even the diff.
+
+// most words in one response (125 per read request, 255 data bytes at most)
+#define REGISTER_IMAGE_MAX_WORDS WORD_MASK_WORDS
+
+/**
+ * Compare `words` registers starting at decimal address addr (data as received)
+ * with the image of unitId and store them. Sets bit i of the changed mask
+ * (mask[i / 64] bit i % 64, two words of mask) for every word that differs or
+ * was never seen. Returns the number of changed words.
+ */
+size_t registerImageDiff(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, uint64_t* mask);
+
+/**
+ * Fingerprint check of a whole response to a request for `words` registers at
+ * addr, before the diff: true if it is identical to the last response to that
+ * request (64-bit hash) and the image still holds it, so nothing can have
+ * changed. Records timeNs (receive time, ns) as the time the words were seen.
+ */
+bool registerImageSame(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, int64_t timeNs);
+
+// Receive time (ns) of the latest response containing addr, 0 if never read
+int64_t registerImageSeenNs(uint8_t unitId, uint16_t addr);
+
+// Copy the current words addr .. addr+words-1 of unitId (host order, 0 if never read); false if the unit is unknown
+bool registerImageRead(uint8_t unitId, uint16_t addr, size_t words, uint16_t* out);
+
+/**
+ * Copy words addr .. addr+words-1 of unitId (host order, at most
+ * REGISTER_IMAGE_MAX_WORDS) if every one of them was read and the latest
+ * response containing it arrived at or after minSeenNs; false otherwise.
+ */
+bool registerImageReadFresh(uint8_t unitId, uint16_t addr, size_t words, uint16_t* out, int64_t minSeenNs);
+
+// Number of responses skipped by registerImageSame()
+uint64_t registerImageSkipped();
+
+// Forget all images, so every register is reported again (e.g. after the register table changed)
+void registerImageReset();
+
+// compare kernel in use: "avx2", "sse2" or "scalar"
+const char* registerImageKernel();
@@ -0,0 +1,568 @@
+#include "register_map.h"
+#include "log.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+
+// register parsed from a map; strings point into the loaded file buffers
+struct MapRow {
+    uint16_t addr;
+    uint16_t length;
+    float gain;
+    uint8_t poll;
+    const char* name;
+    const char* type;
+    const char* unit;
+    const char* access;
+};
+
+struct ScanRange {
+    uint16_t from;
+    uint16_t to;
+    uint8_t poll;
+    const char* type;
+};
+
+// everything parsed from the map files; lives only while loading
+struct MapSet {
+    std::vector<MapRow> rows;
+    std::vector<ScanRange> scans;
+    std::deque<std::string> texts;  // CSV file buffers (tokenized in place)
+    std::deque<json> docs;          // JSON documents
+};
+
+// arena holding the installed table and its strings (one allocation)
+char* registerArena = nullptr;
+
+const char* nonEmpty(const char* s) {
+    return (s && s[0]) ? s : nullptr;
+}
+
+bool parseAddr(const char* s, uint16_t& out) {
+    char* end = nullptr;
+    unsigned long v = strtoul(s, &end, 10);
+    if (!s[0] || *end || v == 0 || v > 0xffff) return false;
+    out = (uint16_t)v;
+    return true;
+}
+
+bool validAccess(const char* s) {
+    return !strcmp(s, "RO") || !strcmp(s, "RW") || !strcmp(s, "WO");
+}
+
+// check and complete a row; logs and returns false if unusable
+bool finishRow(MapRow& r, const char* src, unsigned line) {
+    if (r.length == 0 || r.length > 125) {
+        LOG_WARN("%s:%u: invalid length %u for %u", src, line, r.length, r.addr);
+        return false;
+    }
+    if ((uint32_t)r.addr + r.length - 1 > 0xffff) {
+        LOG_WARN("%s:%u: register %u exceeds the address space", src, line, r.addr);
+        return false;
+    }
+    if (!nonEmpty(r.type)) {
+        LOG_WARN("%s:%u: missing type for %u", src, line, r.addr);
+        return false;
+    }
+    if (!nonEmpty(r.access)) r.access = "RO";
+    if (!validAccess(r.access)) {
+        LOG_WARN("%s:%u: invalid access '%s' for %u", src, line, r.access, r.addr);
+        return false;
+    }
+    r.name = nonEmpty(r.name);
+    r.unit = nonEmpty(r.unit);
+    return true;
+}
+
+// split a CSV line in place into NUL terminated fields, unquoting "..." fields
+size_t splitCsv(char* line, char** fields, size_t maxFields) {
+    size_t n = 0;
+    char* p = line;
+    while (n < maxFields) {
+        while (*p == ' ' || *p == '\t') ++p;
+        char* out = p;
+        fields[n++] = p;
+        if (*p == '"') {
+            // quoted: copy down over the opening quote, "" is a literal quote
+            char* in = p + 1;
+            while (*in) {
+                if (*in == '"') {
+                    if (in[1] == '"') { *out++ = '"'; in += 2; continue; }
+                    ++in;
+                    break;
+                }
+                *out++ = *in++;
+            }
+            while (*in && *in != ',') ++in;
+            bool more = (*in == ',');
+            *out = '\0';
+            if (!more) break;
+            p = in + 1;
+        } else {
+            char* comma = strchr(p, ',');
+            char* end = comma ? comma : p + strlen(p);
+            while (end > p && (end[-1] == ' ' || end[-1] == '\t')) --end;
+            *end = '\0';
+            if (!comma) break;
+            p = comma + 1;
+        }
+    }
+    return n;
+}
+
+enum Column { COL_ADDR, COL_LENGTH, COL_TYPE, COL_GAIN, COL_UNIT, COL_ACCESS, COL_POLL, COL_NAME, COLUMNS };
+const char* const columnNames[COLUMNS] = { "addr", "length", "type", "gain", "unit", "access", "poll", "name" };
+
+bool deviceMatches(const char* declared, const char* deviceType, const char* src) {
+    if (!deviceType || !deviceType[0] || !strcasecmp(declared, deviceType)) return true;
+    LOG("Skipping %s (device %s, want %s)", src, declared, deviceType);
+    return false;
+}
+
+// parse a CSV map into set; false if the map is for another device or unreadable
+bool parseCsvMap(std::string& text, const char* src, const char* deviceType, MapSet& set) {
+    int column[COLUMNS];
+    for (int c = 0; c < COLUMNS; ++c) column[c] = c;  // default order
+
+    size_t firstRow = set.rows.size();
+    size_t firstScan = set.scans.size();
+    unsigned line = 0;
+    char* p = &text[0];
+    while (*p) {
+        char* eol = strchr(p, '\n');
+        char* next = eol ? eol + 1 : p + strlen(p);
+        if (eol) *eol = '\0';
+        if (eol && eol > p && eol[-1] == '\r') eol[-1] = '\0';
+        ++line;
+        char* s = p;
+        p = next;
+        while (*s == ' ' || *s == '\t') ++s;
+        if (!*s || *s == '#') continue;
+
+        char* f[16];
+        size_t n = splitCsv(s, f, 16);
+        if (!strcasecmp(f[0], "device")) {
+            if (n < 2 || !deviceMatches(f[1], deviceType, src)) {
+                set.rows.resize(firstRow);
+                set.scans.resize(firstScan);
+                return false;
+            }
+            continue;
+        }
+        if (!strcasecmp(f[0], "scan")) {
+            ScanRange sr{0, 0, REG_POLL_FAST, "B16"};
+            if (n < 3 || !parseAddr(f[1], sr.from) || !parseAddr(f[2], sr.to) || sr.to < sr.from) {
+                LOG_WARN("%s:%u: invalid scan range", src, line);
+                continue;
+            }
+            if (n > 3 && f[3][0]) sr.type = f[3];
+            if (n > 4 && f[4][0]) {
+                int poll = registerPollClass(f[4]);
+                if (poll < 0) {
+                    LOG_WARN("%s:%u: unknown poll class '%s'", src, line, f[4]);
+                    continue;
+                }
+                sr.poll = (uint8_t)poll;
+            }
+            set.scans.push_back(sr);
+            continue;
+        }
+        if (!strcasecmp(f[0], "addr")) {
+            // header row: map column names to positions
+            for (int c = 0; c < COLUMNS; ++c) column[c] = -1;
+            for (size_t i = 0; i < n; ++i) {
+                for (int c = 0; c < COLUMNS; ++c) {
+                    if (!strcasecmp(f[i], columnNames[c])) column[c] = (int)i;
+                }
+            }
+            if (column[COL_ADDR] < 0 || column[COL_TYPE] < 0) {
+                LOG_WARN("%s:%u: header needs addr and type columns", src, line);
+                set.rows.resize(firstRow);
+                set.scans.resize(firstScan);
+                return false;
+            }
+            continue;
+        }
+
+        auto field = [&](int c) -> const char* {
+            return (column[c] >= 0 && (size_t)column[c] < n) ? f[column[c]] : "";
+        };
+        MapRow r{};
+        if (!parseAddr(field(COL_ADDR), r.addr)) {
+            LOG_WARN("%s:%u: invalid address '%s'", src, line, field(COL_ADDR));
+            continue;
+        }
+        const char* len = field(COL_LENGTH);
+        r.length = len[0] ? (uint16_t)std::min(strtoul(len, nullptr, 10), 0xffffUL) : 1;
+        const char* gain = field(COL_GAIN);
+        r.gain = gain[0] ? strtof(gain, nullptr) : 1.0f;
+        const char* poll = field(COL_POLL);
+        int pc = poll[0] ? registerPollClass(poll) : REG_POLL_FAST;
+        if (pc < 0) {
+            LOG_WARN("%s:%u: unknown poll class '%s'", src, line, poll);
+            continue;
+        }
+        r.poll = (uint8_t)pc;
+        r.type = field(COL_TYPE);
+        r.unit = field(COL_UNIT);
+        r.access = field(COL_ACCESS);
+        r.name = field(COL_NAME);
+        if (finishRow(r, src, line)) set.rows.push_back(r);
+    }
+    return true;
+}
+
+const char* jsonText(const json& obj, const char* key) {
+    auto it = obj.find(key);
+    if (it == obj.end() || !it->is_string()) return nullptr;
+    return it->get_ref<const std::string&>().c_str();
+}
+
+bool jsonAddr(const json& obj, const char* key, uint16_t& out) {
+    auto it = obj.find(key);
+    if (it == obj.end() || !it->is_number_unsigned()) return false;
+    uint64_t v = it->get<uint64_t>();
+    if (v == 0 || v > 0xffff) return false;
+    out = (uint16_t)v;
+    return true;
+}
+
+// parse a JSON map into set; false if the map is for another device or unreadable
+bool parseJsonMap(const json& doc, const char* src, const char* deviceType, MapSet& set) {
+    if (!doc.is_object()) {
+        LOG_WARN("%s: expected a JSON object", src);
+        return false;
+    }
+    const char* device = jsonText(doc, "device");
+    if (device && !deviceMatches(device, deviceType, src)) return false;
+
+    unsigned index = 0;
+    auto regs = doc.find("registers");
+    if (regs != doc.end() && regs->is_array()) {
+        for (const json& e : *regs) {
+            ++index;
+            MapRow r{};
+            if (!e.is_object() || !jsonAddr(e, "addr", r.addr)) {
+                LOG_WARN("%s: register #%u: invalid address", src, index);
+                continue;
+            }
+            r.length = (uint16_t)std::min(e.value("length", 1u), 0xffffu);
+            r.gain = e.value("gain", 1.0f);
+            const char* poll = jsonText(e, "poll");
+            int pc = poll ? registerPollClass(poll) : REG_POLL_FAST;
+            if (pc < 0) {
+                LOG_WARN("%s: register #%u: unknown poll class '%s'", src, index, poll);
+                continue;
+            }
+            r.poll = (uint8_t)pc;
+            r.type = jsonText(e, "type");
+            r.unit = jsonText(e, "unit");
+            r.access = jsonText(e, "access");
+            r.name = jsonText(e, "name");
+            if (finishRow(r, src, index)) set.rows.push_back(r);
+        }
+    }
+    auto scans = doc.find("scan");
+    if (scans != doc.end() && scans->is_array()) {
+        for (const json& e : *scans) {
+            ScanRange sr{0, 0, REG_POLL_FAST, "B16"};
+            if (!e.is_object() || !jsonAddr(e, "from", sr.from) || !jsonAddr(e, "to", sr.to) || sr.to < sr.from) {
+                LOG_WARN("%s: invalid scan range", src);
+                continue;
+            }
+            if (const char* type = jsonText(e, "type")) sr.type = type;
+            if (const char* poll = jsonText(e, "poll")) {
+                int pc = registerPollClass(poll);
+                if (pc < 0) {
+                    LOG_WARN("%s: unknown poll class '%s'", src, poll);
+                    continue;
+                }
+                sr.poll = (uint8_t)pc;
+            }
+            set.scans.push_back(sr);
+        }
+    }
+    return true;
+}
+
+bool hasSuffix(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && !strcasecmp(s.c_str() + s.size() - n, suffix);
+}
+
+// expand the ':' separated path list into map files (directories in name order)
+std::vector<std::string> mapFiles(const char* paths) {
+    std::vector<std::string> files;
+    std::string list(paths ? paths : "");
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(':', start);
+        if (end == std::string::npos) end = list.size();
+        std::string path = list.substr(start, end - start);
+        start = end + 1;
+        if (path.empty()) continue;
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            LOG_WARN("Register map %s not found", path.c_str());
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            files.push_back(path);
+            continue;
+        }
+        DIR* dir = opendir(path.c_str());
+        if (!dir) continue;
+        std::vector<std::string> names;
+        while (struct dirent* de = readdir(dir)) {
+            std::string name(de->d_name);
+            if (name[0] != '.' && (hasSuffix(name, ".csv") || hasSuffix(name, ".json"))) {
+                names.push_back(path + "/" + name);
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        files.insert(files.end(), names.begin(), names.end());
+    }
+    return files;
+}
+
+// string pool for short repeated strings (type, unit, access)
+struct Pool {
+    std::vector<const char*> strings;
+    size_t bytes = 0;
+    void add(const char* s) {
+        if (!s) return;
+        for (const char* p : strings) if (!strcmp(p, s)) return;
+        strings.push_back(s);
+        bytes += strlen(s) + 1;
+    }
+};
+
+// Build the merged table in one allocation and install it.
+// Rows win over scan ranges; of overlapping rows the first one wins.
+bool installMapSet(MapSet& set, size_t maxEntries, size_t maxBytes) {
+    // stable sort keeps map order for equal addresses, so the first map wins
+    std::stable_sort(set.rows.begin(), set.rows.end(),
+                     [](const MapRow& a, const MapRow& b) { return a.addr < b.addr; });
+    std::vector<MapRow> rows;
+    rows.reserve(set.rows.size());
+    uint32_t coveredTo = 0;  // first address after the last accepted row
+    for (const MapRow& r : set.rows) {
+        if (r.addr < coveredTo) {
+            LOG_WARN("Register %u overlaps register %u, ignored", r.addr, rows.back().addr);
+            continue;
+        }
+        rows.push_back(r);
+        coveredTo = (uint32_t)r.addr + r.length;
+    }
+
+    // overlapping scan ranges generate each address once
+    std::sort(set.scans.begin(), set.scans.end(),
+              [](const ScanRange& a, const ScanRange& b) { return a.from < b.from; });
+
+    // counting pass: entries and string bytes
+    Pool pool;
+    size_t entries = 0, nameBytes = 0;
+    auto forEachScanAddr = [&](auto&& fn) {
+        size_t ri = 0;
+        uint32_t next = 0;  // scan addresses below next were already generated
+        for (const ScanRange& sr : set.scans) {
+            for (uint32_t a = std::max<uint32_t>(sr.from, next); a <= sr.to; ++a) {
+                while (ri < rows.size() && (uint32_t)rows[ri].addr + rows[ri].length <= a) ++ri;
+                if (ri < rows.size() && rows[ri].addr <= a) continue;  // described by a map
+                fn((uint16_t)a, sr);
+            }
+            next = std::max<uint32_t>(next, (uint32_t)sr.to + 1);
+        }
+    };
+    for (const MapRow& r : rows) {
+        ++entries;
+        if (r.name) nameBytes += strlen(r.name) + 1;
+        pool.add(r.type);
+        pool.add(r.unit);
+        pool.add(r.access);
+    }
+    char scanName[24];
+    forEachScanAddr([&](uint16_t a, const ScanRange& sr) {
+        ++entries;
+        nameBytes += snprintf(scanName, sizeof(scanName), "Register %u", a) + 1;
+        pool.add(sr.type);
+    });
+    pool.add("RO");
+    if (entries == 0) {
+        LOG_ERROR("Register maps contain no registers");
+        return false;
+    }
+    size_t tableBytes = entries * sizeof(RegisterInfo);
+    size_t total = tableBytes + pool.bytes + nameBytes;
+    if (entries > maxEntries || total > maxBytes) {
+        LOG_ERROR("Register maps too large: %zu entries, %zu bytes (limit %zu entries, %zu bytes)",
+            entries, total, maxEntries, maxBytes);
+        return false;
+    }
+    char* arena = (char*)malloc(total);
+    if (!arena) {
+        LOG_ERROR("Out of memory for %zu byte register table", total);
+        return false;
+    }
+
+    // filling pass: pooled strings, then entries merged by address
+    RegisterInfo* table = (RegisterInfo*)arena;
+    char* strings = arena + tableBytes;
+    std::vector<const char*> pooled(pool.strings.size());
+    for (size_t i = 0; i < pool.strings.size(); ++i) {
+        size_t len = strlen(pool.strings[i]) + 1;
+        memcpy(strings, pool.strings[i], len);
+        pooled[i] = strings;
+        strings += len;
+    }
+    auto intern = [&](const char* s) -> const char* {
+        if (!s) return nullptr;
+        for (size_t i = 0; i < pool.strings.size(); ++i) {
+            if (!strcmp(pool.strings[i], s)) return pooled[i];
+        }
+        return nullptr;
+    };
+    auto copyName = [&](const char* s, size_t len) -> const char* {
+        memcpy(strings, s, len);
+        strings[len] = '\0';
+        const char* out = strings;
+        strings += len + 1;
+        return out;
+    };
+
+    size_t n = 0, ri = 0;
+    const char* ro = intern("RO");
+    auto emitRowsBelow = [&](uint32_t addr) {
+        for (; ri < rows.size() && rows[ri].addr < addr; ++ri) {
+            const MapRow& r = rows[ri];
+            RegisterInfo& e = table[n++];
+            e.addr = r.addr;
+            e.length = r.length;
+            e.name = r.name ? copyName(r.name, strlen(r.name)) : nullptr;
+            e.type = intern(r.type);
+            e.unit = intern(r.unit);
+            e.gain = r.gain;
+            e.access = intern(r.access);
+            e.poll = r.poll;
+        }
+    };
+    forEachScanAddr([&](uint16_t a, const ScanRange& sr) {
+        emitRowsBelow(a);
+        RegisterInfo& e = table[n++];
+        e.addr = a;
+        e.length = 1;
+        int len = snprintf(scanName, sizeof(scanName), "Register %u", a);
+        e.name = copyName(scanName, (size_t)len);
+        e.type = intern(sr.type);
+        e.unit = nullptr;
+        e.gain = 1.0f;
+        e.access = ro;
+        e.poll = sr.poll;
+    });
+    emitRowsBelow(0x10000);
+
+    char* old = registerArena;
+    registerArena = arena;
+    aiswei_registers = table;
+    aiswei_registers_count = n;
+    free(old);
+    LOG("Installed %zu registers (%zu from maps, %zu scanned) in %zu bytes",
+        n, rows.size(), n - rows.size(), total);
+    return true;
+}
+
+}  // namespace
+
+int registerPollClass(const char* name) {
+    if (!strcasecmp(name, "fast")) return REG_POLL_FAST;
+    if (!strcasecmp(name, "slow")) return REG_POLL_SLOW;
+    if (!strcasecmp(name, "once")) return REG_POLL_ONCE;
+    if (!strcasecmp(name, "off")) return REG_POLL_OFF;
+    return -1;
+}
+
+const char* registerPollClassName(uint8_t poll) {
+    switch (poll) {
+        case REG_POLL_SLOW: return "slow";
+        case REG_POLL_ONCE: return "once";
+        case REG_POLL_OFF: return "off";
+        default: return "fast";
+    }
+}
+
+void applyPollOverrides(const std::map<uint16_t, uint8_t>& overrides) {
+    for (const auto& o : overrides) {
+        int idx = aiswei_find_register_index(o.first);
+        if (idx < 0 || aiswei_registers[idx].addr != o.first) {
+            LOG_WARN("Poll class override for unknown register %u ignored", o.first);
+            continue;
+        }
+        aiswei_registers[idx].poll = o.second;
+    }
+}
+
+bool loadRegisterMaps(const char* paths, const char* deviceType, size_t maxEntries, size_t maxBytes) {
+    MapSet set;
+    unsigned loaded = 0;
+    for (const std::string& file : mapFiles(paths)) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in.is_open()) {
+            LOG_ERROR("Cannot open register map %s", file.c_str());
+            continue;
+        }
+        // bound the transient buffers as well
+        in.seekg(0, std::ios::end);
+        std::streamoff size = in.tellg();
+        in.seekg(0, std::ios::beg);
+        if (size < 0 || (size_t)size > maxBytes) {
+            LOG_WARN("Register map %s too large", file.c_str());
+            continue;
+        }
+        size_t rowsBefore = set.rows.size(), scansBefore = set.scans.size();
+        bool ok;
+        if (hasSuffix(file, ".json")) {
+            try {
+                set.docs.push_back(json::parse(in));
+                ok = parseJsonMap(set.docs.back(), file.c_str(), deviceType, set);
+            } catch (const std::exception& e) {
+                LOG_ERROR("Failed to parse %s: %s", file.c_str(), e.what());
+                set.rows.resize(rowsBefore);
+                set.scans.resize(scansBefore);
+                continue;
+            }
+        } else {
+            set.texts.emplace_back((size_t)size, '\0');
+            in.read(&set.texts.back()[0], size);
+            ok = parseCsvMap(set.texts.back(), file.c_str(), deviceType, set);
+        }
+        if (ok) {
+            ++loaded;
+            LOG("Loaded %s: %zu registers, %zu scan ranges", file.c_str(),
+                set.rows.size() - rowsBefore, set.scans.size() - scansBefore);
+        }
+    }
+    if (loaded == 0) return false;
+    return installMapSet(set, maxEntries, maxBytes);
+}
+
+bool generateRegisterScan(uint16_t from, uint16_t to, size_t maxEntries, size_t maxBytes) {
+    MapSet set;
+    set.scans.push_back(ScanRange{from, to, REG_POLL_FAST, "B16"});
+    return installMapSet(set, maxEntries, maxBytes);
+}
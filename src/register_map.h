@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+
+#include "modbus_registers.h"
+
+// Runtime register maps.
+//
+// A map is a CSV or JSON file describing registers (address, length, type,
+// gain, unit, access, poll class, name) and optional scan ranges. Scan ranges
+// generate one B16 entry per address not described by any map, so a device
+// can be explored while its known registers keep their real metadata.
+//
+// CSV: '#' starts a comment line, "device,<type>" declares the device type,
+// "scan,<from>,<to>[,<type>[,<poll>]]" adds a scan range, a header row naming
+// the columns (addr,length,type,gain,unit,access,poll,name) may reorder them;
+// all other rows are registers. Fields may be quoted ("a, b" or "say ""hi""").
+//
+// JSON: {"device":"aiswei",
+//        "registers":[{"addr":31301,"length":1,"type":"U16","gain":0.1,
+//                      "unit":"V","access":"RO","poll":"fast","name":"..."}],
+//        "scan":[{"from":30000,"to":49999,"type":"B16","poll":"fast"}]}
+//
+// All maps of the device type are merged into one table sorted by address.
+// Entries and strings share a single allocation sized in a counting pass, so
+// startup memory is bounded by maxEntries and maxBytes.
+
+/**
+ * Load all maps for deviceType and install them as aiswei_registers.
+ * `paths` is a ':' separated list of map files and directories (every .csv
+ * and .json file in name order). Maps declaring another device type are
+ * skipped, maps without a device declaration always apply. Overlapping
+ * registers are dropped with a warning (first map wins).
+ * Returns false and keeps the current table if nothing usable was loaded.
+ * The previous table is freed: call before polling starts or from the
+ * polling thread between transactions.
+ */
+bool loadRegisterMaps(const char* paths, const char* deviceType, size_t maxEntries, size_t maxBytes);
+
+/**
+ * Install a table of generic entries for every address in [from, to]
+ * (type B16, named "Register <addr>"). Used when no map file is available.
+ */
+bool generateRegisterScan(uint16_t from, uint16_t to, size_t maxEntries, size_t maxBytes);
+
+// Set the poll class of the entries starting at the given addresses
+void applyPollOverrides(const std::map<uint16_t, uint8_t>& overrides);
+
+// Poll class keyword ("fast", "slow", "once", "off") for REG_POLL_* and back; -1 if unknown
+int registerPollClass(const char* name);
+const char* registerPollClassName(uint8_t poll);
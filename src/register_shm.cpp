@@ -0,0 +1,150 @@
+#include "register_shm.h"
+#include "register_shm_reader.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t* base = nullptr;
+static size_t mapped = 0;
+static char shmName[64];
+static RegisterShmHeader* header = nullptr;
+
+static RegisterShmUnit* unitAt(uint32_t i) {
+    return (RegisterShmUnit*)(base + header->unitsOffset + i * header->unitBytes);
+}
+
+static RegisterShmValue* valueAt(uint32_t i) {
+    return (RegisterShmValue*)(base + header->valuesOffset) + i;
+}
+
+// region of unitId, claiming a free one on first use; nullptr if all are taken
+static RegisterShmUnit* unitFor(uint8_t unitId) {
+    for (uint32_t i = 0; i < header->unitSlots; ++i) {
+        RegisterShmUnit* u = unitAt(i);
+        if (!u->used) {
+            u->unitId = unitId;
+            __atomic_store_n(&u->used, 1, __ATOMIC_RELEASE);
+            return u;
+        }
+        if (u->unitId == unitId) return u;
+    }
+    return nullptr;
+}
+
+bool registerShmOpen(const char* name, size_t units, size_t values) {
+    if (values > 65535) values = 65535;  // slot numbers are 16 bit
+    size_t unitsOffset = (sizeof(RegisterShmHeader) + 63) & ~(size_t)63;
+    size_t unitBytes = (sizeof(RegisterShmUnit) + 63) & ~(size_t)63;
+    size_t valuesOffset = unitsOffset + units * unitBytes;
+    size_t total = valuesOffset + values * sizeof(RegisterShmValue);
+
+    // start from a fresh segment: readers of a previous one see writerPid 0 and reopen
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Cannot create shared memory %s: %s", name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, total) != 0) {
+        LOG_ERROR("Cannot size shared memory %s: %s", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* p = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("Cannot map shared memory %s: %s", name, strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    // the new segment is zero filled
+    base = (uint8_t*)p;
+    mapped = total;
+    snprintf(shmName, sizeof(shmName), "%s", name);
+    header = (RegisterShmHeader*)base;
+    header->version = REGISTER_SHM_VERSION;
+    header->unitSlots = units;
+    header->valueSlots = values;
+    header->writerPid = getpid();
+    header->unitsOffset = unitsOffset;
+    header->unitBytes = unitBytes;
+    header->valuesOffset = valuesOffset;
+    header->totalBytes = total;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, "JSREGSHM", 8);  // readers check it last
+    LOG("Live register image in shared memory %s (%zu KB, %zu units, %zu values)", name, total / 1024, units, values);
+    return true;
+}
+
+void registerShmClose() {
+    if (!base) return;
+    __atomic_store_n(&header->writerPid, 0, __ATOMIC_RELEASE);
+    munmap(base, mapped);
+    shm_unlink(shmName);
+    base = nullptr;
+    header = nullptr;
+}
+
+void registerShmWords(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, int64_t timeNs) {
+    if (!base) return;
+    RegisterShmUnit* u = unitFor(unitId);
+    if (!u) return;
+    if ((size_t)addr + words > 65536) words = 65536 - addr;
+
+    registerShmWriteBegin(&u->seq);
+    for (size_t i = 0; i < words; ++i) {
+        size_t a = addr + i;
+        u->words[a] = (uint16_t)(data[2 * i] << 8 | data[2 * i + 1]);
+        u->seen[a / 64] |= 1ULL << (a % 64);
+    }
+    u->updatedNs = timeNs;
+    registerShmWriteEnd(&u->seq);
+}
+
+void registerShmValue(uint8_t unitId, uint16_t addr, bool numeric, double value, const char* text, size_t len,
+                      int64_t updatedNs, int64_t changedNs) {
+    if (!base) return;
+    RegisterShmUnit* u = unitFor(unitId);
+    if (!u) return;
+    uint16_t slot = u->valueSlot[addr];
+    if (slot == 0) {
+        if (header->valuesUsed >= header->valueSlots) return;  // table full
+        slot = (uint16_t)++header->valuesUsed;
+    }
+    RegisterShmValue* v = valueAt(slot - 1);
+
+    registerShmWriteBegin(&v->seq);
+    v->key = ((uint32_t)unitId << 16) | addr;
+    v->numeric = numeric;
+    v->value = numeric ? value : 0;
+    v->updatedNs = updatedNs;
+    v->changedNs = changedNs;
+    if (len >= sizeof(v->text)) len = sizeof(v->text) - 1;
+    memcpy(v->text, text, len);
+    v->text[len] = '\0';
+    registerShmWriteEnd(&v->seq);
+
+    // publish the slot only once it holds the value
+    if (u->valueSlot[addr] == 0) __atomic_store_n(&u->valueSlot[addr], slot, __ATOMIC_RELEASE);
+}
+
+void registerShmResetValues() {
+    if (!base) return;
+    for (uint32_t i = 0; i < header->unitSlots; ++i) {
+        RegisterShmUnit* u = unitAt(i);
+        if (!u->used) continue;
+        for (size_t a = 0; a < 65536; ++a) __atomic_store_n(&u->valueSlot[a], 0, __ATOMIC_RELAXED);
+    }
+    for (uint32_t i = 0; i < header->valuesUsed; ++i) {
+        RegisterShmValue* v = valueAt(i);
+        registerShmWriteBegin(&v->seq);
+        v->key = 0;
+        registerShmWriteEnd(&v->seq);
+    }
+    header->valuesUsed = 0;
+    __atomic_store_n(&header->generation, header->generation + 1, __ATOMIC_RELEASE);
+}
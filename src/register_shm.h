@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Writer of the live register image in POSIX shared memory (layout and the
+// header-only reader for local tools: register_shm_reader.h). Only the decode
+// stage writes; readers never block it.
+
+// Create (or take over) the segment with room for `units` Modbus units and
+// `values` decoded registers; false if shared memory is unavailable
+bool registerShmOpen(const char* name, size_t units, size_t values);
+// Mark the segment as abandoned by the writer and remove its name
+void registerShmClose();
+
+// Store `words` registers starting at addr (data as received, big endian) with their receive time
+void registerShmWords(uint8_t unitId, uint16_t addr, const uint8_t* data, size_t words, int64_t timeNs);
+
+// Store the decoded value of the register at addr; value is used if numeric, text is the published payload
+void registerShmValue(uint8_t unitId, uint16_t addr, bool numeric, double value, const char* text, size_t len,
+                      int64_t updatedNs, int64_t changedNs);
+
+// Release all value slots (the register table changed); raw words stay
+void registerShmResetValues();
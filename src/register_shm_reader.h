@@ -0,0 +1,194 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Live register image of the gateway in POSIX shared memory, for local tools.
+// Header-only: copy this file into a reader project, no further dependencies
+// (link with -lrt on glibc < 2.34).
+//
+//   RegisterShmReader shm;
+//   RegisterShmReader::Value v;
+//   if (shm.open() && shm.readValue(3, 31371, v)) printf("%s\n", v.text);
+//
+// Layout: a header, one region per Modbus unit (raw words in host order, a
+// bitmap of the words read so far, and per address the slot of its decoded
+// value) and a table of decoded value slots. The gateway writes in place and
+// readers copy out, both lock-free: each unit region and each value slot has
+// a sequence counter that is odd while it is written (seqlock), readers retry
+// if it was odd or moved during their copy. A read costs one copy of the
+// requested words, no syscall.
+
+#define REGISTER_SHM_DEFAULT_NAME "/joba_solplanet"
+#define REGISTER_SHM_VERSION 1
+#define REGISTER_SHM_TEXT 64
+
+struct RegisterShmHeader {
+    char magic[8];           // "JSREGSHM"
+    uint32_t version;        // REGISTER_SHM_VERSION
+    uint32_t unitSlots;      // unit regions
+    uint32_t valueSlots;     // decoded value slots
+    uint32_t writerPid;      // gateway process, 0 after it shut down
+    uint64_t unitsOffset;    // offset of the first unit region
+    uint64_t unitBytes;      // size of a unit region
+    uint64_t valuesOffset;   // offset of the value table
+    uint64_t totalBytes;
+    uint32_t generation;     // incremented when the register table (and value slots) changed
+    uint32_t valuesUsed;     // value slots assigned
+};
+
+struct RegisterShmUnit {
+    uint32_t seq;              // seqlock of this region
+    uint8_t used;              // region belongs to unitId
+    uint8_t unitId;
+    uint16_t reserved;
+    int64_t updatedNs;         // receive time (ns since epoch) of the last response written
+    uint64_t seen[65536 / 64]; // bit per address: read at least once
+    uint16_t words[65536];     // raw register words, host order
+    uint16_t valueSlot[65536]; // 1 + value slot of the register starting at the address, 0: none
+};
+
+struct RegisterShmValue {
+    uint32_t seq;              // seqlock of this slot
+    uint32_t key;              // (unitId << 16) | addr
+    uint8_t numeric;           // value is valid (else text only)
+    uint8_t reserved[7];
+    double value;              // decoded value (gain applied)
+    int64_t updatedNs;         // time of the response it was last decoded from
+    int64_t changedNs;         // time of the last change, 0 if it never changed
+    char text[REGISTER_SHM_TEXT];  // value as published on MQTT (NUL terminated, may be truncated)
+};
+
+// Seqlock primitives shared by writer and reader (GCC/Clang atomics on plain fields)
+static inline uint32_t registerShmReadBegin(const uint32_t* seq) {
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+static inline bool registerShmReadRetry(const uint32_t* seq, uint32_t begin) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (begin & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != begin;
+}
+
+static inline void registerShmWriteBegin(uint32_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void registerShmWriteEnd(uint32_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+class RegisterShmReader {
+public:
+    struct Value {
+        bool numeric;
+        double value;
+        int64_t updatedNs;
+        int64_t changedNs;
+        char text[REGISTER_SHM_TEXT];
+    };
+
+    RegisterShmReader() = default;
+    ~RegisterShmReader() { close(); }
+    RegisterShmReader(const RegisterShmReader&) = delete;
+    RegisterShmReader& operator=(const RegisterShmReader&) = delete;
+
+    // map the segment read-only; false if it does not exist or has another layout version
+    bool open(const char* name = REGISTER_SHM_DEFAULT_NAME) {
+        close();
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RegisterShmHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base_ = (const uint8_t*)p;
+        len_ = st.st_size;
+        const RegisterShmHeader* h = header();
+        if (memcmp(h->magic, "JSREGSHM", 8) != 0 || h->version != REGISTER_SHM_VERSION || h->totalBytes > len_) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (base_) munmap((void*)base_, len_);
+        base_ = nullptr;
+        len_ = 0;
+    }
+
+    bool isOpen() const { return base_ != nullptr; }
+    // false once the gateway shut down (reopen after it restarted)
+    bool writerAlive() const { return base_ && __atomic_load_n(&header()->writerPid, __ATOMIC_RELAXED) != 0; }
+    const RegisterShmHeader* header() const { return (const RegisterShmHeader*)base_; }
+
+    /**
+     * Copy `words` raw registers starting at addr of unitId (host order) with
+     * the receive time of the latest response. False if the unit is unknown or
+     * one of the words was never read.
+     */
+    bool readWords(uint8_t unitId, uint16_t addr, size_t words, uint16_t* out, int64_t* updatedNs = nullptr) const {
+        const RegisterShmUnit* u = unit(unitId);
+        if (!u || addr + words > 65536) return false;
+        for (int attempt = 0; attempt < MAX_RETRIES; ++attempt) {
+            uint32_t begin = registerShmReadBegin(&u->seq);
+            bool seen = true;
+            for (size_t i = addr; i < addr + words; ++i) seen &= (u->seen[i / 64] >> (i % 64)) & 1;
+            memcpy(out, &u->words[addr], words * sizeof(uint16_t));
+            int64_t t = u->updatedNs;
+            if (registerShmReadRetry(&u->seq, begin)) continue;
+            if (updatedNs) *updatedNs = t;
+            return seen;
+        }
+        return false;
+    }
+
+    // Decoded value of the register starting at addr of unitId; false if it was not decoded yet
+    bool readValue(uint8_t unitId, uint16_t addr, Value& out) const {
+        const RegisterShmUnit* u = unit(unitId);
+        if (!u) return false;
+        uint16_t slot = __atomic_load_n(&u->valueSlot[addr], __ATOMIC_ACQUIRE);
+        const RegisterShmHeader* h = header();
+        if (slot == 0 || slot > h->valueSlots) return false;
+        const RegisterShmValue* v = (const RegisterShmValue*)(base_ + h->valuesOffset) + (slot - 1);
+        uint32_t key = ((uint32_t)unitId << 16) | addr;
+        for (int attempt = 0; attempt < MAX_RETRIES; ++attempt) {
+            uint32_t begin = registerShmReadBegin(&v->seq);
+            uint32_t k = v->key;
+            out.numeric = v->numeric;
+            out.value = v->value;
+            out.updatedNs = v->updatedNs;
+            out.changedNs = v->changedNs;
+            memcpy(out.text, v->text, sizeof(out.text));
+            if (registerShmReadRetry(&v->seq, begin)) continue;
+            out.text[sizeof(out.text) - 1] = '\0';
+            return k == key;  // slots are reassigned when the register table changes
+        }
+        return false;
+    }
+
+private:
+    enum { MAX_RETRIES = 1000 };  // the writer holds a lock for a copy of at most one response
+
+    const RegisterShmUnit* unit(uint8_t unitId) const {
+        if (!base_) return nullptr;
+        const RegisterShmHeader* h = header();
+        for (uint32_t i = 0; i < h->unitSlots; ++i) {
+            const RegisterShmUnit* u = (const RegisterShmUnit*)(base_ + h->unitsOffset + i * h->unitBytes);
+            if (__atomic_load_n(&u->used, __ATOMIC_ACQUIRE) && u->unitId == unitId) return u;
+        }
+        return nullptr;
+    }
+
+    const uint8_t* base_ = nullptr;
+    size_t len_ = 0;
+};
@@ -0,0 +1,91 @@
+#include "register_snapshot.h"
+#include "modbus_registers.h"
+#include "register_map.h"
+#include "json_writer.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+
+static std::shared_ptr<const RegisterSnapshot> current;  // accessed with std::atomic_load/store only
+static std::atomic<uint64_t> currentEpoch(0);
+
+static std::atomic<uint64_t> metaGeneration(0);
+
+// writer only: the two buffers published alternately
+static std::shared_ptr<RegisterSnapshot> buffers[2];
+static unsigned nextBuffer = 0;
+
+const RegisterState* RegisterSnapshot::find(uint32_t key) const {
+    auto it = std::lower_bound(registers.begin(), registers.end(), key,
+                               [](const RegisterState& s, uint32_t k) { return s.key < k; });
+    return it != registers.end() && it->key == key ? &*it : nullptr;
+}
+
+std::shared_ptr<const RegisterSnapshot> registerSnapshot() {
+    return std::atomic_load_explicit(&current, std::memory_order_acquire);
+}
+
+uint64_t registerSnapshotEpoch() {
+    return currentEpoch.load(std::memory_order_acquire);
+}
+
+std::shared_ptr<RegisterSnapshot> beginRegisterSnapshot() {
+    std::shared_ptr<RegisterSnapshot>& buf = buffers[nextBuffer];
+    // the other buffer is the published one; this one is free unless a reader still holds it
+    if (!buf || buf.use_count() > 1) {
+        buf = std::make_shared<RegisterSnapshot>();
+    } else {
+        // use_count() is a relaxed load: order the last reader's accesses, which
+        // its reference release published, before we overwrite the buffer
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return buf;
+}
+
+void publishRegisterSnapshot(std::shared_ptr<RegisterSnapshot> snapshot) {
+    uint64_t epoch = currentEpoch.load(std::memory_order_relaxed) + 1;
+    snapshot->epoch = epoch;
+    std::atomic_store_explicit(&current, std::shared_ptr<const RegisterSnapshot>(std::move(snapshot)),
+                               std::memory_order_release);
+    currentEpoch.store(epoch, std::memory_order_release);
+    nextBuffer ^= 1;
+}
+
+const RegisterMeta* RegisterMetaTable::find(uint16_t addr) const {
+    auto it = std::upper_bound(entries.begin(), entries.end(), addr,
+                               [](uint16_t a, const RegisterMeta& m) { return a < m.addr; });
+    if (it == entries.begin()) return nullptr;
+    --it;
+    return addr < it->addr + it->length ? &*it : nullptr;
+}
+
+std::shared_ptr<const RegisterMetaTable> buildRegisterMetaTable() {
+    auto table = std::make_shared<RegisterMetaTable>();
+    table->generation = ++metaGeneration;
+    table->entries.resize(aiswei_registers_count);
+    JsonWriter w(256);
+    for (size_t i = 0; i < aiswei_registers_count; ++i) {
+        const RegisterInfo& r = aiswei_registers[i];
+        w.clear();
+        w.beginObject();
+        w.key("addr").value((unsigned)r.addr);
+        w.key("length").value((unsigned)r.length);
+        w.key("name").value(r.name ? r.name : "");
+        w.key("type").value(r.type ? r.type : "");
+        char gain[24];  // shortest float form: 0.1, not 0.10000000149
+        w.key("gain").raw(gain, snprintf(gain, sizeof(gain), "%g", r.gain));
+        w.key("unit");
+        if (r.unit && r.unit[0]) w.value(r.unit); else w.null();
+        w.key("access").value(r.access ? r.access : "");
+        w.key("poll").value(registerPollClassName(r.poll));
+        w.endObject();
+        RegisterMeta& m = table->entries[i];
+        m.addr = r.addr;
+        m.length = r.length;
+        m.name = r.name ? r.name : "";
+        m.unit = r.unit ? r.unit : "";
+        m.json = w.str();
+    }
+    return table;
+}
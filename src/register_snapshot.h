@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct RuntimeConfig;
+struct RegisterMetaTable;
+
+// Immutable view of the current register values for readers on other threads
+// (summary, query APIs). The decode stage owns the live values and publishes a
+// copy now and then (read-copy-update): readers take a reference to the latest
+// snapshot and keep a consistent view for as long as they hold it, without
+// locking anything the decode stage writes.
+
+struct RegisterState {
+    uint32_t key;  // (unitId << 16) | addr
+    std::string payload;
+    std::chrono::system_clock::time_point lastChangeTime;
+    bool hasChanged;  // changed in this or a previous run
+};
+
+struct RegisterSnapshot {
+    uint64_t epoch = 0;  // increases with every published snapshot
+    std::chrono::system_clock::time_point time;
+    std::shared_ptr<const RuntimeConfig> config;  // config the values were decoded with
+    std::vector<RegisterState> registers;         // sorted by key
+    std::shared_ptr<const RegisterMetaTable> meta; // register table the values were decoded with
+
+    // binary search by key, nullptr if not present
+    const RegisterState* find(uint32_t key) const;
+};
+
+// Latest published snapshot (nullptr before the first one)
+std::shared_ptr<const RegisterSnapshot> registerSnapshot();
+// Epoch of the latest published snapshot (0: none yet)
+uint64_t registerSnapshotEpoch();
+
+/**
+ * Writer side (single thread). Double-buffered: beginRegisterSnapshot() returns
+ * the buffer not published last if no reader holds it anymore (its strings and
+ * vector capacity are reused), else a new one; fill it and publish it with
+ * publishRegisterSnapshot(), which assigns the epoch. Never waits for readers.
+ */
+std::shared_ptr<RegisterSnapshot> beginRegisterSnapshot();
+void publishRegisterSnapshot(std::shared_ptr<RegisterSnapshot> snapshot);
+
+// Metadata of one register map entry, serialized once when the table is installed
+struct RegisterMeta {
+    uint16_t addr;
+    uint16_t length;
+    std::string name;
+    std::string unit;  // empty if none
+    std::string json;  // {"addr":..,"length":..,"name":..,"type":..,"gain":..,"unit":..,"access":..,"poll":..}
+};
+
+// Immutable copy of the register table for readers on other threads (the table
+// itself is freed when the maps are reloaded)
+struct RegisterMetaTable {
+    uint64_t generation = 0;           // increases with every table installed
+    std::vector<RegisterMeta> entries;  // sorted by address
+
+    // entry covering addr (addr .. addr+length-1), nullptr if none
+    const RegisterMeta* find(uint16_t addr) const;
+};
+
+// Copy the current register table (aiswei_registers); call where the table may not change
+std::shared_ptr<const RegisterMetaTable> buildRegisterMetaTable();
@@ -0,0 +1,152 @@
+#include "runtime_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+#include "modbus_registers.h"
+#include "register_map.h"
+#include "mqtt_config.h"
+#include "influx_config.h"
+#include "modbus_config.h"
+#include "log.h"
+
+using json = nlohmann::json;
+
+static std::mutex loadMutex;  // serializes loads (generation counter)
+
+// Influx measurement: last part of the MQTT topic prefix
+static std::string measurementFor(const std::string& prefix) {
+    size_t pos = prefix.find_last_of('/');
+    if (pos == std::string::npos || pos + 1 == prefix.size()) return prefix;
+    return prefix.substr(pos + 1);
+}
+
+static std::shared_ptr<RuntimeConfig> makeDefaults() {
+    auto c = std::make_shared<RuntimeConfig>();
+    c->modbusServer = MODBUS_SERVER;
+    c->modbusPort = MODBUS_PORT;
+    c->unitId = MODBUS_UNIT_ID;
+    c->batchSize = MODBUS_BATCH_SIZE;
+    c->pollIntervalMs = MODBUS_POLL_INTERVAL_MS;
+    c->slowPollSweeps = MODBUS_SLOW_POLL_SWEEPS;
+    c->registerMaps = MODBUS_REGISTER_MAPS;
+    c->deviceType = MODBUS_DEVICE_TYPE;
+    c->mqttServer = MQTT_SERVER;
+    c->mqttPort = MQTT_PORT;
+    c->mqttPrefix = MQTT_TOPIC_PREFIX;
+    c->summaryCbor = MQTT_SUMMARY_CBOR;
+    c->influxServer = INFLUX_SERVER;
+    c->influxPort = INFLUX_PORT;
+    c->influxDb = INFLUX_DB;
+    c->influxMeasurement = measurementFor(c->mqttPrefix);
+    c->influxCompact = INFLUX_SCHEMA_COMPACT;
+    c->generation = 0;
+    return c;
+}
+
+static std::shared_ptr<const RuntimeConfig> current = makeDefaults();
+
+std::shared_ptr<const RuntimeConfig> runtimeConfig() {
+    return std::atomic_load(&current);
+}
+
+// copy an optional member of obj into out; throws on a type mismatch
+template <typename T>
+static void option(const json& obj, const char* key, T& out) {
+    auto it = obj.find(key);
+    if (it != obj.end()) out = it->get<T>();
+}
+
+// reject values the poller or the sinks cannot work with
+static const char* validate(const RuntimeConfig& c) {
+    if (c.modbusServer.empty() || c.mqttServer.empty() || c.influxServer.empty()) return "empty server name";
+    if (c.modbusPort <= 0 || c.modbusPort > 65535 || c.mqttPort <= 0 || c.mqttPort > 65535 ||
+        c.influxPort <= 0 || c.influxPort > 65535) return "port out of range";
+    if (c.batchSize < 1 || c.batchSize > 125) return "modbus.batch_size must be 1..125";
+    if (c.pollIntervalMs < 10) return "modbus.poll_interval_ms must be >= 10";
+    if (c.slowPollSweeps < 1) return "modbus.slow_poll_sweeps must be >= 1";
+    if (c.mqttPrefix.empty()) return "empty mqtt.topic_prefix";
+    if (c.influxDb.empty()) return "empty influx.db";
+    return nullptr;
+}
+
+bool loadRuntimeConfig(const char* path) {
+    std::lock_guard<std::mutex> lock(loadMutex);
+    auto c = makeDefaults();
+
+    std::ifstream file(path);
+    if (file.is_open()) {
+        try {
+            json data = json::parse(file);
+            unsigned unitId = c->unitId;
+            if (data.contains("modbus")) {
+                const json& m = data["modbus"];
+                option(m, "server", c->modbusServer);
+                option(m, "port", c->modbusPort);
+                option(m, "unit_id", unitId);
+                option(m, "batch_size", c->batchSize);
+                option(m, "poll_interval_ms", c->pollIntervalMs);
+                option(m, "slow_poll_sweeps", c->slowPollSweeps);
+                option(m, "register_maps", c->registerMaps);
+                option(m, "device_type", c->deviceType);
+            }
+            if (unitId > 247) {
+                LOG_WARN("%s: modbus.unit_id must be 0..247, keeping current config", path);
+                return false;
+            }
+            c->unitId = (uint8_t)unitId;
+            if (data.contains("mqtt")) {
+                const json& m = data["mqtt"];
+                option(m, "server", c->mqttServer);
+                option(m, "port", c->mqttPort);
+                option(m, "topic_prefix", c->mqttPrefix);
+                option(m, "summary_cbor", c->summaryCbor);
+            }
+            if (data.contains("influx")) {
+                const json& m = data["influx"];
+                option(m, "server", c->influxServer);
+                option(m, "port", c->influxPort);
+                option(m, "db", c->influxDb);
+                option(m, "schema_compact", c->influxCompact);
+            }
+            // per-register policies: {"31303": {"poll": "slow"}, ...}
+            if (data.contains("registers")) {
+                for (auto& [key, policy] : data["registers"].items()) {
+                    char* end = nullptr;
+                    unsigned long addr = strtoul(key.c_str(), &end, 10);
+                    if (key.empty() || *end || addr == 0 || addr > 0xffff) {
+                        LOG_WARN("%s: invalid register address '%s', keeping current config", path, key.c_str());
+                        return false;
+                    }
+                    std::string poll;
+                    option(policy, "poll", poll);
+                    if (!poll.empty()) {
+                        int pc = registerPollClass(poll.c_str());
+                        if (pc < 0) {
+                            LOG_WARN("%s: unknown poll class '%s', keeping current config", path, poll.c_str());
+                            return false;
+                        }
+                        c->pollOverrides[(uint16_t)addr] = (uint8_t)pc;
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            LOG_WARN("Error loading %s: %s, keeping current config", path, e.what());
+            return false;
+        }
+    } else {
+        LOG("No config file %s, using compiled-in defaults", path);
+    }
+
+    if (const char* err = validate(*c)) {
+        LOG_WARN("%s: %s, keeping current config", path, err);
+        return false;
+    }
+    c->influxMeasurement = measurementFor(c->mqttPrefix);
+    c->generation = runtimeConfig()->generation + 1;
+    std::atomic_store(&current, std::shared_ptr<const RuntimeConfig>(c));
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+
+// Operational parameters that can be changed without a rebuild.
+// Defaults are the compile-time values from the *_config.h files; the JSON
+// config file overrides them at startup and again on reload (SIGHUP, or
+// "reload" published on <prefix>/cmd). Readers keep a snapshot, so a reload
+// never changes values under a running transaction.
+
+#ifndef RUNTIME_CONFIG_FILE
+#define RUNTIME_CONFIG_FILE "joba_solplanet.json"
+#endif
+
+struct RuntimeConfig {
+    // Modbus poll plan
+    std::string modbusServer;
+    int modbusPort;
+    uint8_t unitId;
+    unsigned batchSize;                          // registers per request (1..125)
+    unsigned pollIntervalMs;                     // time between requests
+    unsigned slowPollSweeps;                     // "slow" registers every n-th sweep
+    std::string registerMaps;                    // see register_map.h
+    std::string deviceType;
+    std::map<uint16_t, uint8_t> pollOverrides;   // per-register poll class (REG_POLL_*)
+
+    // MQTT sink
+    std::string mqttServer;
+    int mqttPort;
+    std::string mqttPrefix;
+    bool summaryCbor;
+
+    // Influx sink
+    std::string influxServer;
+    int influxPort;
+    std::string influxDb;
+    std::string influxMeasurement;               // last part of the MQTT prefix
+    bool influxCompact;
+
+    uint64_t generation;                         // counts successful loads
+};
+
+/**
+ * Read the config file on top of the compile-time defaults and publish the
+ * result as the current snapshot. A missing file yields the defaults.
+ * A malformed file or invalid value keeps the current snapshot and returns false.
+ */
+bool loadRuntimeConfig(const char* path);
+
+// Current snapshot, never null (compile-time defaults before the first load)
+std::shared_ptr<const RuntimeConfig> runtimeConfig();
@@ -0,0 +1,184 @@
+#include "spill_log.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+static const uint32_t SPILL_MAGIC = 0x4c4c5053;  // "SPLL"
+static const uint32_t SPILL_VERSION = 1;
+static const uint32_t WRAP_MARK = 0xffffffff;     // rest of data area unused, continue at 0
+
+// records are stored as 32-bit length followed by the bytes, padded to 4 byte alignment
+static size_t padded(size_t len) { return (4 + len + 3) & ~(size_t)3; }
+
+SpillLog::~SpillLog() {
+    close();
+}
+
+bool SpillLog::open(const char* path, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (hdr_) return true;
+
+    capacity = (capacity + 3) & ~(size_t)3;
+    fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        LOG_ERROR("Failed to open spill file %s", path);
+        return false;
+    }
+
+    mapLen_ = sizeof(Header) + capacity;
+    struct stat st;
+    bool fresh = (fstat(fd_, &st) != 0 || (size_t)st.st_size != mapLen_);
+    if (fresh && ftruncate(fd_, mapLen_) != 0) {
+        LOG_ERROR("Failed to size spill file %s to %zu bytes", path, mapLen_);
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    void* p = mmap(nullptr, mapLen_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("Failed to map spill file %s", path);
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    hdr_ = (Header*)p;
+    data_ = (uint8_t*)p + sizeof(Header);
+
+    if (fresh || hdr_->magic != SPILL_MAGIC || hdr_->version != SPILL_VERSION || hdr_->capacity != capacity
+        || hdr_->head >= capacity || hdr_->tail >= capacity || hdr_->used > capacity) {
+        uint64_t dropped = fresh ? 0 : hdr_->dropped;
+        memset(hdr_, 0, sizeof(Header));
+        hdr_->dropped = dropped;
+        hdr_->magic = SPILL_MAGIC;
+        hdr_->version = SPILL_VERSION;
+        hdr_->capacity = capacity;
+    } else if (hdr_->records) {
+        LOG("Resuming spill file %s with %llu records", path, (unsigned long long)hdr_->records);
+    }
+    return true;
+}
+
+void SpillLog::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (hdr_) {
+        msync(hdr_, mapLen_, MS_ASYNC);
+        munmap(hdr_, mapLen_);
+        hdr_ = nullptr;
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+size_t SpillLog::recordSize(uint64_t off) const {
+    uint32_t len;
+    memcpy(&len, data_ + off, sizeof(len));
+    return len;
+}
+
+// drop the record at tail (skipping a wrap mark first)
+void SpillLog::dropOldest() {
+    if (hdr_->records == 0) return;
+    uint64_t cap = hdr_->capacity;
+    if (cap - hdr_->tail < 4 || recordSize(hdr_->tail) == WRAP_MARK) {
+        hdr_->used -= cap - hdr_->tail;
+        hdr_->tail = 0;
+    }
+    size_t sz = padded(recordSize(hdr_->tail));
+    hdr_->tail += sz;
+    hdr_->used -= sz;
+    if (hdr_->tail == cap) hdr_->tail = 0;
+    hdr_->records--;
+    hdr_->tailSeq++;
+    if (hdr_->records == 0) hdr_->head = hdr_->tail = hdr_->used = 0;
+}
+
+bool SpillLog::append(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!hdr_) return false;
+    uint64_t cap = hdr_->capacity;
+    size_t sz = padded(len);
+    if (sz > cap) return false;
+
+    for (;;) {
+        uint64_t head = hdr_->head;
+        // room at the end of the data area, or after wrapping to the start
+        uint64_t toEnd = cap - head;
+        bool wrap = toEnd < sz;
+        uint64_t need = wrap ? toEnd + sz : sz;
+        bool overlap = hdr_->records && (wrap ? (sz > hdr_->tail || head < hdr_->tail)
+                                               : (head < hdr_->tail && head + sz > hdr_->tail));
+        if (hdr_->used + need <= cap && !overlap) {
+            if (wrap) {
+                if (toEnd >= 4) memcpy(data_ + head, &WRAP_MARK, 4);
+                hdr_->used += toEnd;
+                head = 0;
+            }
+            uint32_t l = (uint32_t)len;
+            memcpy(data_ + head, &l, 4);
+            memcpy(data_ + head + 4, data, len);
+            hdr_->head = head + sz;
+            if (hdr_->head == cap) hdr_->head = 0;
+            hdr_->used += sz;
+            hdr_->records++;
+            return true;
+        }
+        // drop-oldest policy
+        dropOldest();
+        hdr_->dropped++;
+    }
+}
+
+size_t SpillLog::peek(std::string& out, size_t maxBytes, uint64_t& firstSeq) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.clear();
+    if (!hdr_) return 0;
+    firstSeq = hdr_->tailSeq;
+    uint64_t cap = hdr_->capacity;
+    uint64_t off = hdr_->tail;
+    size_t n = 0;
+    while (n < hdr_->records) {
+        if (cap - off < 4 || recordSize(off) == WRAP_MARK) off = 0;
+        size_t len = recordSize(off);
+        if (n > 0 && out.size() + len > maxBytes) break;
+        out.append((const char*)data_ + off + 4, len);
+        off += padded(len);
+        if (off == cap) off = 0;
+        ++n;
+    }
+    return n;
+}
+
+void SpillLog::consume(uint64_t firstSeq, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!hdr_) return;
+    while (hdr_->tailSeq < firstSeq + count && hdr_->records > 0) dropOldest();
+}
+
+bool SpillLog::empty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !hdr_ || hdr_->records == 0;
+}
+
+size_t SpillLog::records() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hdr_ ? hdr_->records : 0;
+}
+
+size_t SpillLog::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hdr_ ? hdr_->used : 0;
+}
+
+uint64_t SpillLog::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hdr_ ? hdr_->dropped : 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+
+// Memory-mapped, size-capped append-only log of records (e.g. Influx lines)
+// used to buffer data while a sink is unavailable. The file is a byte ring:
+// when it is full the oldest records are dropped. Head and tail live in the
+// mapped header, so a backlog survives a restart of the gateway.
+class SpillLog {
+public:
+    SpillLog() = default;
+    ~SpillLog();
+    SpillLog(const SpillLog&) = delete;
+    SpillLog& operator=(const SpillLog&) = delete;
+
+    // map (and create if needed) file with room for capacity bytes of records
+    bool open(const char* path, size_t capacity);
+    void close();
+    bool isOpen() const { return hdr_ != nullptr; }
+
+    // append one record, dropping oldest records if needed. False if record can never fit.
+    bool append(const char* data, size_t len);
+    bool append(const std::string& s) { return append(s.data(), s.size()); }
+
+    /**
+     * Concatenate records from the oldest on into out (replacing its content)
+     * until maxBytes would be exceeded (at least one record is returned).
+     * Returns number of records copied and the sequence number of the first one;
+     * pass both to consume() once they are delivered.
+     */
+    size_t peek(std::string& out, size_t maxBytes, uint64_t& firstSeq);
+    // remove records firstSeq .. firstSeq+count-1 unless already dropped meanwhile
+    void consume(uint64_t firstSeq, size_t count);
+
+    bool empty() const;
+    size_t records() const;
+    size_t bytes() const;
+    uint64_t dropped() const;
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity;  // size of data area
+        uint64_t head;      // write offset into data area
+        uint64_t tail;      // offset of oldest record
+        uint64_t used;      // bytes in use including wrap gaps
+        uint64_t records;
+        uint64_t dropped;
+        uint64_t tailSeq;   // sequence number of oldest record
+    };
+
+    void dropOldest();
+    size_t recordSize(uint64_t off) const;
+
+    int fd_ = -1;
+    Header* hdr_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t mapLen_ = 0;
+    mutable std::mutex mutex_;
+};
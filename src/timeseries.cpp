@@ -0,0 +1,179 @@
+#include "timeseries.h"
+
+// bucket lengths of the rollup resolutions
+static const int64_t BUCKET_MS[TimeSeriesStore::RESOLUTIONS] = { 0, 60 * 1000, 15 * 60 * 1000 };
+
+static uint32_t hashKey(uint32_t key) {
+    // murmur3 finalizer: spreads (unit << 16 | addr) keys over the table
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+TimeSeriesStore::TimeSeriesStore(size_t maxSeries, size_t rawCapacity, size_t min1Capacity, size_t min15Capacity)
+    : maxSeries_(maxSeries) {
+    cap_[RAW] = rawCapacity;
+    cap_[MIN1] = min1Capacity;
+    cap_[MIN15] = min15Capacity;
+
+    for (int r = 0; r < RESOLUTIONS; ++r) {
+        Columns &c = col_[r];
+        size_t n = maxSeries_ * cap_[r];
+        c.t.assign(n, 0);
+        c.vmin.assign(n, 0);
+        c.head.assign(maxSeries_, 0);
+        c.size.assign(maxSeries_, 0);
+        if (r != RAW) {
+            // raw samples only need time and value (kept in vmin)
+            c.vmax.assign(n, 0);
+            c.vsum.assign(n, 0);
+            c.count.assign(n, 0);
+            open_[r].assign(maxSeries_, OpenBucket());
+        }
+    }
+
+    // hash table at most half full
+    size_t hashSize = 16;
+    while (hashSize < maxSeries_ * 2) hashSize <<= 1;
+    hashKeys_.assign(hashSize, 0);
+    hashSeries_.assign(hashSize, 0);
+    hashMask_ = hashSize - 1;
+}
+
+int TimeSeriesStore::findSlot(uint32_t key) const {
+    size_t h = hashKey(key) & hashMask_;
+    while (hashKeys_[h] != 0) {
+        if (hashKeys_[h] == key + 1) return (int)hashSeries_[h];
+        h = (h + 1) & hashMask_;
+    }
+    return -1;
+}
+
+int TimeSeriesStore::insertSlot(uint32_t key) {
+    if (seriesCount_ >= maxSeries_) return -1;
+    size_t h = hashKey(key) & hashMask_;
+    while (hashKeys_[h] != 0) h = (h + 1) & hashMask_;
+    hashKeys_[h] = key + 1;
+    hashSeries_[h] = (uint32_t)seriesCount_;
+    return (int)seriesCount_++;
+}
+
+void TimeSeriesStore::push(Resolution res, size_t series, int64_t t, double vmin, double vmax, double vsum, uint32_t count) {
+    Columns &c = col_[res];
+    size_t cap = cap_[res];
+    if (cap == 0) return;
+    size_t slot = series * cap + c.head[series];
+    c.t[slot] = t;
+    c.vmin[slot] = vmin;
+    if (res != RAW) {
+        c.vmax[slot] = vmax;
+        c.vsum[slot] = vsum;
+        c.count[slot] = count;
+    }
+    c.head[series] = (uint32_t)((c.head[series] + 1) % cap);
+    if (c.size[series] < cap) c.size[series]++;
+}
+
+void TimeSeriesStore::rollup(Resolution res, size_t series, int64_t t_ms, double value) {
+    OpenBucket &b = open_[res][series];
+    int64_t start = t_ms - (t_ms % BUCKET_MS[res]);
+    if (b.start != start) {
+        // sample belongs to a new bucket: close the previous one
+        if (b.count > 0) push(res, series, b.start, b.vmin, b.vmax, b.vsum, b.count);
+        b.start = start;
+        b.vmin = b.vmax = value;
+        b.vsum = 0;
+        b.count = 0;
+    }
+    if (value < b.vmin) b.vmin = value;
+    if (value > b.vmax) b.vmax = value;
+    b.vsum += value;
+    b.count++;
+}
+
+bool TimeSeriesStore::append(uint32_t key, int64_t t_ms, double value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int s = findSlot(key);
+    if (s < 0) {
+        s = insertSlot(key);
+        if (s < 0) {
+            dropped_++;
+            return false;
+        }
+    }
+    push(RAW, s, t_ms, value, 0, 0, 1);
+    rollup(MIN1, s, t_ms, value);
+    rollup(MIN15, s, t_ms, value);
+    return true;
+}
+
+TimeSeriesStore::Point TimeSeriesStore::pointAt(Resolution res, size_t series, size_t slot) const {
+    const Columns &c = col_[res];
+    size_t i = series * cap_[res] + slot;
+    Point p;
+    p.t_ms = c.t[i];
+    if (res == RAW) {
+        p.min = p.max = p.avg = c.vmin[i];
+        p.count = 1;
+    } else {
+        p.min = c.vmin[i];
+        p.max = c.vmax[i];
+        p.count = c.count[i];
+        p.avg = p.count ? c.vsum[i] / p.count : 0;
+    }
+    return p;
+}
+
+size_t TimeSeriesStore::query(uint32_t key, Resolution res, int64_t from_ms, int64_t to_ms, Point* out, size_t maxOut) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int s = findSlot(key);
+    if (s < 0 || maxOut == 0) return 0;
+
+    const Columns &c = col_[res];
+    size_t cap = cap_[res];
+    size_t size = c.size[s];
+    size_t first = (c.head[s] + cap - size) % (cap ? cap : 1);  // oldest slot
+    size_t n = 0;
+    for (size_t i = 0; i < size && n < maxOut; ++i) {
+        size_t slot = (first + i) % cap;
+        int64_t t = c.t[s * cap + slot];
+        if (t < from_ms) continue;
+        if (t > to_ms) break;
+        out[n++] = pointAt(res, s, slot);
+    }
+
+    if (res != RAW && n < maxOut) {
+        const OpenBucket &b = open_[res][s];
+        if (b.count > 0 && b.start >= from_ms && b.start <= to_ms) {
+            out[n++] = { b.start, b.vmin, b.vmax, b.vsum / b.count, b.count };
+        }
+    }
+    return n;
+}
+
+bool TimeSeriesStore::latest(uint32_t key, Point& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int s = findSlot(key);
+    if (s < 0 || col_[RAW].size[s] == 0) return false;
+    size_t cap = cap_[RAW];
+    out = pointAt(RAW, s, (col_[RAW].head[s] + cap - 1) % cap);
+    return true;
+}
+
+bool TimeSeriesStore::contains(uint32_t key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findSlot(key) >= 0;
+}
+
+size_t TimeSeriesStore::seriesCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seriesCount_;
+}
+
+size_t TimeSeriesStore::droppedSamples() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+// Fixed-memory in-memory history of numeric register samples.
+// Every series keeps three rings: raw samples, 1 minute and 15 minute rollups
+// (min/max/avg). All rings live in a few contiguous columns that are allocated
+// once at construction, so appending never allocates. Values are kept as
+// double, so U32 counters and decoded decimals (230.1) come back unchanged.
+
+// maximum number of registers with history (further series are rejected)
+#ifndef TS_MAX_SERIES
+#define TS_MAX_SERIES 4096
+#endif
+// samples per series and resolution
+#ifndef TS_RAW_CAPACITY
+#define TS_RAW_CAPACITY 120
+#endif
+#ifndef TS_1MIN_CAPACITY
+#define TS_1MIN_CAPACITY 60
+#endif
+#ifndef TS_15MIN_CAPACITY
+#define TS_15MIN_CAPACITY 96
+#endif
+
+class TimeSeriesStore {
+public:
+    enum Resolution { RAW = 0, MIN1 = 1, MIN15 = 2, RESOLUTIONS = 3 };
+
+    // one query result row; raw samples have min == max == avg and count 1
+    struct Point {
+        int64_t t_ms;     // sample time or bucket start (ms since epoch)
+        double min;
+        double max;
+        double avg;
+        uint32_t count;
+    };
+
+    TimeSeriesStore(size_t maxSeries = TS_MAX_SERIES,
+                    size_t rawCapacity = TS_RAW_CAPACITY,
+                    size_t min1Capacity = TS_1MIN_CAPACITY,
+                    size_t min15Capacity = TS_15MIN_CAPACITY);
+
+    // Append a sample for key ((unitId << 16) | addr). Samples must be in time order per key.
+    // Returns false if the store is full and key has no series yet.
+    bool append(uint32_t key, int64_t t_ms, double value);
+
+    /**
+     * Copy points of a series with from_ms <= t_ms <= to_ms into out (oldest first).
+     * Rollup queries include the still open bucket as last point.
+     * Returns number of points written (at most maxOut).
+     */
+    size_t query(uint32_t key, Resolution res, int64_t from_ms, int64_t to_ms, Point* out, size_t maxOut) const;
+
+    // latest raw sample of a series, false if unknown
+    bool latest(uint32_t key, Point& out) const;
+
+    bool contains(uint32_t key) const;
+    size_t seriesCount() const;
+    size_t droppedSamples() const;
+    size_t capacity(Resolution res) const { return cap_[res]; }
+
+private:
+    // columnar ring storage of one resolution: series s owns slots [s*cap, (s+1)*cap)
+    struct Columns {
+        std::vector<int64_t> t;
+        std::vector<double> vmin;
+        std::vector<double> vmax;
+        std::vector<double> vsum;
+        std::vector<uint32_t> count;
+        std::vector<uint32_t> head;  // next write slot per series
+        std::vector<uint32_t> size;  // valid slots per series
+    };
+
+    // not yet closed rollup bucket per series
+    struct OpenBucket {
+        int64_t start = -1;
+        double vmin = 0, vmax = 0;
+        double vsum = 0;
+        uint32_t count = 0;
+    };
+
+    int findSlot(uint32_t key) const;
+    int insertSlot(uint32_t key);
+    void push(Resolution res, size_t series, int64_t t, double vmin, double vmax, double vsum, uint32_t count);
+    void rollup(Resolution res, size_t series, int64_t t_ms, double value);
+    Point pointAt(Resolution res, size_t series, size_t slot) const;
+
+    size_t maxSeries_;
+    size_t cap_[RESOLUTIONS];
+    Columns col_[RESOLUTIONS];
+    std::vector<OpenBucket> open_[RESOLUTIONS];  // RAW unused
+
+    // open addressing key -> series index (key + 1 stored, 0 = empty)
+    std::vector<uint32_t> hashKeys_;
+    std::vector<uint32_t> hashSeries_;
+    size_t hashMask_;
+    size_t seriesCount_ = 0;
+    size_t dropped_ = 0;
+
+    mutable std::mutex mutex_;
+};
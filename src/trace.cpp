@@ -0,0 +1,154 @@
+#include "trace.h"
+#include "json_writer.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// events kept per thread (power of two)
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 16384
+#endif
+
+std::atomic<bool> traceActive(false);
+
+struct TraceEvent {
+    std::atomic<uint64_t> seq{0};  // ring position + 1 once written, 0 while being written
+    uint64_t startNs;
+    uint64_t durNs;
+    const char* name;
+    uint64_t arg;   // span argument or flow id
+    char phase;     // 'X' span, 's' flow start, 'f' flow end
+};
+
+struct TraceRing {
+    std::unique_ptr<TraceEvent[]> events{new TraceEvent[TRACE_RING_EVENTS]};
+    std::atomic<uint64_t> head{0};  // events written so far
+    unsigned tid;
+    char threadName[16];
+};
+
+static std::mutex ringsMutex;  // registration and dump only
+static std::vector<std::unique_ptr<TraceRing>> rings;
+static std::atomic<uint64_t> nextFlowId(0);
+static thread_local TraceRing* threadRing = nullptr;
+
+uint64_t traceNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void traceSetEnabled(bool enabled) {
+    traceActive.store(enabled, std::memory_order_relaxed);
+}
+
+static TraceRing* ring() {
+    if (threadRing) return threadRing;
+    std::unique_ptr<TraceRing> r(new TraceRing());
+    if (pthread_getname_np(pthread_self(), r->threadName, sizeof(r->threadName)) != 0) r->threadName[0] = '\0';
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    r->tid = (unsigned)rings.size() + 1;
+    threadRing = r.get();
+    rings.push_back(std::move(r));
+    return threadRing;
+}
+
+static void record(char phase, const char* name, uint64_t startNs, uint64_t durNs, uint64_t arg) {
+    TraceRing* r = ring();
+    uint64_t h = r->head.load(std::memory_order_relaxed);
+    TraceEvent& e = r->events[h & (TRACE_RING_EVENTS - 1)];
+    e.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.startNs = startNs;
+    e.durNs = durNs;
+    e.name = name;
+    e.arg = arg;
+    e.phase = phase;
+    e.seq.store(h + 1, std::memory_order_release);
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void traceSpan(const char* name, uint64_t startNs, uint64_t arg) {
+    uint64_t now = traceNowNs();
+    record('X', name, startNs, now - startNs, arg);
+}
+
+uint64_t traceFlowId() {
+    return nextFlowId.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void traceFlowStart(const char* name, uint64_t id) {
+    if (traceEnabled()) record('s', name, traceNowNs(), 0, id);
+}
+
+void traceFlowEnd(const char* name, uint64_t id) {
+    if (traceEnabled()) record('f', name, traceNowNs(), 0, id);
+}
+
+static void writeTs(JsonWriter& w, const char* key, uint64_t ns) {
+    w.key(key).value(ns / 1000.0);
+}
+
+// Copy event i of r; false if it is not committed (being written, or
+// overwritten since the ring wrapped)
+static bool readEvent(const TraceRing& r, uint64_t i, TraceEvent& copy) {
+    const TraceEvent& e = r.events[i & (TRACE_RING_EVENTS - 1)];
+    if (e.seq.load(std::memory_order_acquire) != i + 1) return false;
+    copy.startNs = e.startNs;
+    copy.durNs = e.durNs;
+    copy.name = e.name;
+    copy.arg = e.arg;
+    copy.phase = e.phase;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(std::memory_order_relaxed) == i + 1;
+}
+
+void traceDump(std::string& out) {
+    JsonWriter w(256 * 1024);
+    w.beginObject();
+    w.key("displayTimeUnit").value("ns");
+    w.key("traceEvents").beginArray();
+    int pid = (int)getpid();
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (const auto& r : rings) {
+            w.beginObject();
+            w.key("name").value("thread_name");
+            w.key("ph").value("M");
+            w.key("pid").value(pid);
+            w.key("tid").value(r->tid);
+            w.key("args").beginObject().key("name").value(r->threadName).endObject();
+            w.endObject();
+
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+            TraceEvent e;
+            for (uint64_t i = first; i < head; ++i) {
+                if (!readEvent(*r, i, e)) continue;
+                w.beginObject();
+                w.key("name").value(e.name);
+                char ph[2] = { e.phase, '\0' };
+                w.key("ph").value(ph, 1);
+                w.key("pid").value(pid);
+                w.key("tid").value(r->tid);
+                writeTs(w, "ts", e.startNs);
+                if (e.phase == 'X') {
+                    writeTs(w, "dur", e.durNs);
+                    if (e.arg) w.key("args").beginObject().key("arg").value(e.arg).endObject();
+                } else {
+                    w.key("cat").value("change");
+                    w.key("id").value(e.arg);
+                    if (e.phase == 'f') w.key("bp").value("e");  // bind to the enclosing span
+                }
+                w.endObject();
+            }
+        }
+    }
+    w.endArray();
+    w.endObject();
+    out = w.str();
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+// Optional tracer for finding where sweep time goes. Every thread records
+// into a ring of its own (allocated on its first event, no locking); old
+// events are overwritten. Spans are recorded as one complete event when they
+// end (start and duration), flows connect a register change in the decode
+// stage with its publication in a sink. traceDump() renders all rings as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// While tracing is off an event costs one relaxed atomic load. Names must be
+// string literals (only the pointer is stored).
+
+extern std::atomic<bool> traceActive;
+
+static inline bool traceEnabled() { return traceActive.load(std::memory_order_relaxed); }
+void traceSetEnabled(bool enabled);
+
+// Monotonic time in ns
+uint64_t traceNowNs();
+
+// Span of name from startNs until now; arg is shown with it (e.g. an address)
+void traceSpan(const char* name, uint64_t startNs, uint64_t arg);
+
+// New id for a pair of flow events
+uint64_t traceFlowId();
+// Flow start (at the cause) and end (inside the span that completes it)
+void traceFlowStart(const char* name, uint64_t id);
+void traceFlowEnd(const char* name, uint64_t id);
+
+/**
+ * Chrome trace JSON of all recorded events ({"traceEvents":[...]}, times in
+ * microseconds). Recording goes on meanwhile: events still being written or
+ * overwritten during the copy are left out.
+ */
+void traceDump(std::string& out);
+
+// Span covering the enclosing scope
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, uint64_t arg = 0)
+        : name_(name), arg_(arg), start_(traceEnabled() ? traceNowNs() : 0) {}
+    ~TraceScope() {
+        if (start_ && traceEnabled()) traceSpan(name_, start_, arg_);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t arg_;
+    uint64_t start_;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(__VA_ARGS__)
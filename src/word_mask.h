@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Mask of the words of one read response: bit i (mask[i / 64] bit i % 64) for
+// word i, two words of mask for the at most 125 words of a response.
+#define WORD_MASK_WORDS 128
+
+// true if any of the words first .. first+count-1 is set in mask
+static inline bool wordMaskAny(const uint64_t* mask, size_t first, size_t count) {
+    for (size_t i = first; i < first + count && i < WORD_MASK_WORDS; ++i) {
+        if (mask[i / 64] & (1ULL << (i % 64))) return true;
+    }
+    return false;
+}